@@ -4,13 +4,15 @@ import pandas as pd
 
 KEY_TYPES = {
     'basic-heads': 'build', 'basic-prefix': 'build', 'basic-use-hint': 'build', 'branch-cache': 'build', 'data': 'run',
-    'descend-adapt-inner': 'build', 'dynamic-prefix': 'build', 'hash': 'build', 'hash-leaf-simd': 'build',
-    'head-early-abort-create': 'build', 'host': 'run', 'inner': 'build', 'leaf': 'build', 'op': 'run',
+    'descend-adapt-inner': 'build', 'dynamic-prefix': 'build', 'hash': 'build', 'hash-leaf-simd': 'build', 'head-simd': 'build',
+    'head-early-abort-create': 'build', 'host': 'run', 'inner': 'build', 'leaf': 'build', 'leaf-links': 'build', 'node-alloc': 'build', 'page-size': 'build', 'overflow': 'build', 'append': 'build', 'subtree-counts': 'build', 'frozen-top': 'build', 'int-leaf': 'build', 'op': 'run',
     'op_count': 'val',
-    'op_rates': 'run', 'range_len': 'run', 'revision': 'build', 'run_start': 'aux', 'strip-prefix': 'build',
+    'op_rates': 'run', 'range_len': 'run', 'batch_len': 'run', 'sample_interval': 'run', 'revision': 'build', 'run_start': 'aux', 'strip-prefix': 'build',
     'time': 'val', 'total_count': 'run', 'value_len': 'run', 'zipf_exponent': 'run', 'branch_misses': 'val',
     'cycles': 'val', 'instructions': 'val', 'l1d_misses': 'val', 'l1i_misses': 'val', 'll_misses': 'val',
-    'task_clock': 'val'
+    'task_clock': 'val', 'p50': 'val', 'p90': 'val', 'p99': 'val', 'p999': 'val', 'max_time': 'val',
+    'warehouse_count': 'run', 'node_backing': 'run', 'threads': 'run', 'run_time': 'run', 'load_time': 'val', 'tx_count': 'val',
+    'memory': 'val', 'statm': 'aux'
 }
 
 
@@ -19,19 +21,24 @@ def default_pivot(dt, aggregate=[]):
         assert KEY_TYPES[k] in ['build', 'run']
     for k in dt.columns:
         assert KEY_TYPES[k] in ['build', 'run', 'val', 'aux']
-    build = sorted([k for k in KEY_TYPES if KEY_TYPES[k] == 'build' and k not in aggregate])
-    run = sorted([k for k in KEY_TYPES if KEY_TYPES[k] == 'run' and k not in aggregate])
+    # tpcc and microbenchmark results have different run keys
+    build = sorted([k for k in KEY_TYPES if KEY_TYPES[k] == 'build' and k not in aggregate and k in dt.columns])
+    run = sorted([k for k in KEY_TYPES if KEY_TYPES[k] == 'run' and k not in aggregate and k in dt.columns])
     index = build + run
     index = [k for k in index if len(pd.unique(dt[k])) != 1]
-    values = sorted([k for k in KEY_TYPES if KEY_TYPES[k] == 'val'])
+    values = sorted([k for k in KEY_TYPES if KEY_TYPES[k] == 'val' and k in dt.columns])
     return dt.pivot_table(values=values, index=index)
 
 
 def load(f):
     dt = pd.read_json(f, lines=True)
-    dt['op_rates'] = dt['op_rates'].map(lambda x: ':'.join(str(r) for r in x))
-    for k in ['branch_misses', 'cycles', 'instructions', 'l1d_misses', 'l1i_misses', 'll_misses', 'task_clock']:
-        dt[k] = dt[k] / dt['total_count']
+    if 'op_rates' in dt.columns:
+        dt['op_rates'] = dt['op_rates'].map(lambda x: ':'.join(str(r) for r in x) if isinstance(x, list) else x)
+    # tpcc transaction counters are already per transaction
+    if 'total_count' in dt.columns:
+        for k in ['branch_misses', 'cycles', 'instructions', 'l1d_misses', 'l1i_misses', 'll_misses', 'task_clock']:
+            if k in dt.columns:
+                dt[k] = dt[k] / dt['total_count'].fillna(1)
     dt['host'] = dt['host'].map(lambda x: x.strip())
     return dt
 
@@ -10,13 +10,66 @@ extern "C" {
 struct RustBTree;
 
 RustBTree *btree_new();
+
+// node layouts for btree_new_with_layout, 255 selects the layout chosen by cargo features
+enum BTreeLeafLayout : std::uint8_t {
+    LEAF_BASIC = 0, LEAF_HASH = 1, LEAF_ADAPT = 2, LEAF_DEFAULT = 255
+};
+enum BTreeInnerLayout : std::uint8_t {
+    INNER_BASIC = 0, INNER_PADDED = 1, INNER_EXPLICIT_LENGTH = 2, INNER_ASCII = 3, INNER_ART = 4, INNER_DEFAULT = 255
+};
+
+RustBTree *btree_new_with_layout(BTreeLeafLayout leaf, BTreeInnerLayout inner);
+// node page size in bytes, selected by the page-size build feature
+std::uint64_t btree_page_size();
 void btree_insert(RustBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen, std::uint8_t *payload,
                   std::uint64_t payloadLen);
 std::uint8_t *btree_lookup(RustBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen, std::uint64_t *payloadLenOut);
+// if key is present, callback may modify the payload in place or set *replacement to a payload of different size.
+// otherwise, payload is inserted.
+void btree_upsert(RustBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen, std::uint8_t *payload,
+                  std::uint64_t payloadLen,
+                  void (*callback)(void *ctx, std::uint8_t *payload, std::uint64_t payloadLen,
+                                   std::uint8_t const **replacement, std::uint64_t *replacementLen),
+                  void *ctx);
+// returns the existing payload, or null if payload was inserted
+std::uint8_t *btree_insert_if_absent(RustBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen, std::uint8_t *payload,
+                                     std::uint64_t payloadLen, std::uint64_t *payloadLenOut);
+// looks up count keys at once, payloadsOut is set to null for missing keys
+void btree_lookup_batch(RustBTree *b_tree, std::uint8_t const *const *keys, std::uint64_t const *keyLens,
+                        std::uint64_t count, std::uint8_t **payloadsOut, std::uint64_t *payloadLensOut);
 bool btree_remove(RustBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen);
+// removes keys in [lower, upper), upper may be null. subtrees between the boundary leaves are freed as a whole.
+void btree_remove_range(RustBTree *b_tree, std::uint8_t const *lower, std::uint64_t lower_len,
+                        std::uint8_t const *upper, std::uint64_t upper_len);
 void btree_destroy(RustBTree *b_tree);
 void btree_print_info(RustBTree *b_tree);
+// node counts, fill factor and space per entry as json, free the result using btree_free_string
+char *btree_stats_json(RustBTree *b_tree);
+void btree_free_string(char *s);
 void print_tpcc_result(double time_sec, std::uint64_t tx_count, std::uint64_t warehouse_count);
+void print_ycsb_result(double time_sec, std::uint64_t op_count, std::uint64_t record_count, char workload,
+                       std::uint64_t threads);
+
+// per thread latency histograms and hardware counters of TPC-C transactions, one in sample_interval is measured.
+// must be created on the thread that runs the transactions.
+struct RustTxRecorder;
+
+RustTxRecorder *tpcc_recorder_new(std::uint64_t sample_interval, bool hardware_counters);
+void tpcc_recorder_begin(RustTxRecorder *recorder);
+// tx_type is the value returned by TPCCWorkload::tx
+void tpcc_recorder_end(RustTxRecorder *recorder, std::uint64_t tx_type);
+void tpcc_recorder_destroy(RustTxRecorder *recorder);
+// one json line per transaction type in the format of the rust benchmark
+void print_tpcc_tx_stats(RustTxRecorder *const *recorders, std::uint64_t recorder_count, double run_time_sec,
+                         double load_time_sec, std::uint64_t warehouse_count);
+
+// zipf distributed ranks in [0,n), 0 is the most frequent. not thread safe.
+struct RustZipfGenerator;
+
+RustZipfGenerator *zipf_generator_new(std::uint64_t n, double exponent, std::uint64_t seed);
+std::uint64_t zipf_generator_sample(RustZipfGenerator *generator);
+void zipf_generator_destroy(RustZipfGenerator *generator);
 
 // key_buffer and key must not be null, even if zero length
 void btree_scan_asc(RustBTree *b_tree, std::uint8_t const *key, std::uint64_t key_len, std::uint8_t *key_buffer,
@@ -24,5 +77,163 @@ void btree_scan_asc(RustBTree *b_tree, std::uint8_t const *key, std::uint64_t ke
 void btree_scan_desc(RustBTree *b_tree, std::uint8_t const *key, std::uint64_t key_len, std::uint8_t *key_buffer,
                      bool (*continue_callback)(std::uint8_t const *));
 
+// called with the key length, payload and payload length, the key is written to key_buffer.
+// returns false to end the scan.
+typedef bool (*btree_scan_callback)(void *ctx, std::uint64_t key_len, std::uint8_t const *payload,
+                                    std::uint64_t payload_len);
+
+// end_key is exclusive, pass null for an unbounded scan
+void btree_scan_asc_ctx(RustBTree *b_tree, std::uint8_t const *key, std::uint64_t key_len,
+                        std::uint8_t const *end_key, std::uint64_t end_key_len, std::uint8_t *key_buffer,
+                        btree_scan_callback continue_callback, void *ctx);
+void btree_scan_desc_ctx(RustBTree *b_tree, std::uint8_t const *key, std::uint64_t key_len,
+                         std::uint8_t const *end_key, std::uint64_t end_key_len, std::uint8_t *key_buffer,
+                         btree_scan_callback continue_callback, void *ctx);
+
+// counts keys in [lower, upper), upper may be null for an unbounded count.
+// with the subtree-counts_true feature, this only descends the two boundary paths, otherwise it scans the range.
+std::uint64_t btree_count_range(RustBTree *b_tree, std::uint8_t const *lower, std::uint64_t lower_len,
+                                std::uint8_t const *upper, std::uint64_t upper_len);
+
+// ascending scan returning entries in batches, usable with both tree variants.
+// batches must be requested from the tree the cursor was last positioned in.
+struct RustBTreeCursor;
+struct BTreeCursorEntry {
+    std::uint8_t const *key;
+    std::uint64_t key_len;
+    std::uint8_t const *payload;
+    std::uint64_t payload_len;
+};
+
+RustBTreeCursor *btree_cursor_open();
+// positions the cursor at the first key not less than key, end_key is exclusive and may be null
+void btree_cursor_seek(RustBTreeCursor *cursor, std::uint8_t const *key, std::uint64_t key_len,
+                       std::uint8_t const *end_key, std::uint64_t end_key_len);
+// copies up to max_entries keys and payloads to buffer, entries point into buffer.
+// returns the number of entries, zero at the end of the scan.
+// for RustBTree, the tree must not be modified between seek and the last batch.
+std::uint64_t btree_cursor_next_batch(RustBTree *b_tree, RustBTreeCursor *cursor, BTreeCursorEntry *entries,
+                                      std::uint64_t max_entries, std::uint8_t *buffer, std::uint64_t buffer_len);
+void btree_cursor_close(RustBTreeCursor *cursor);
+
+// writes the next entry, returns false at the end of the input.
+// key and payload must remain valid until the next call.
+typedef bool (*btree_bulk_load_next)(void *ctx, std::uint8_t const **key, std::uint64_t *key_len,
+                                     std::uint8_t const **payload, std::uint64_t *payload_len);
+
+// builds a tree from entries in strictly ascending key order
+RustBTree *btree_bulk_load(btree_bulk_load_next next, void *ctx);
+
+// thread safe variant, payloads are only accessible within callbacks
+struct RustConcurrentBTree;
+
+RustConcurrentBTree *btree_concurrent_new();
+RustConcurrentBTree *btree_concurrent_new_with_layout(BTreeLeafLayout leaf, BTreeInnerLayout inner);
+void btree_concurrent_insert(RustConcurrentBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen,
+                             std::uint8_t *payload, std::uint64_t payloadLen);
+// returns false if key is not present, callback is not called in that case
+bool btree_concurrent_lookup(RustConcurrentBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen,
+                             void (*callback)(void *ctx, std::uint8_t const *payload, std::uint64_t payloadLen),
+                             void *ctx);
+bool btree_concurrent_update(RustConcurrentBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen,
+                             void (*callback)(void *ctx, std::uint8_t *payload, std::uint64_t payloadLen),
+                             void *ctx);
+bool btree_concurrent_remove(RustConcurrentBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen);
+RustConcurrentBTree *btree_concurrent_bulk_load(btree_bulk_load_next next, void *ctx);
+void btree_concurrent_destroy(RustConcurrentBTree *b_tree);
+// must not run concurrently with modifications
+char *btree_concurrent_stats_json(RustConcurrentBTree *b_tree);
+// callbacks must not access the tree, end_key is exclusive and may be null
+void btree_concurrent_scan_asc(RustConcurrentBTree *b_tree, std::uint8_t const *key, std::uint64_t key_len,
+                               std::uint8_t const *end_key, std::uint64_t end_key_len, std::uint8_t *key_buffer,
+                               btree_scan_callback continue_callback, void *ctx);
+void btree_concurrent_scan_desc(RustConcurrentBTree *b_tree, std::uint8_t const *key, std::uint64_t key_len,
+                                std::uint8_t const *end_key, std::uint64_t end_key_len, std::uint8_t *key_buffer,
+                                btree_scan_callback continue_callback, void *ctx);
+// always scans the range, subtree counts are not maintained for concurrent trees
+std::uint64_t btree_concurrent_count_range(RustConcurrentBTree *b_tree, std::uint8_t const *lower,
+                                           std::uint64_t lower_len, std::uint8_t const *upper,
+                                           std::uint64_t upper_len);
+// like btree_cursor_next_batch, the leaf is latched while copying
+std::uint64_t btree_concurrent_cursor_next_batch(RustConcurrentBTree *b_tree, RustBTreeCursor *cursor,
+                                                 BTreeCursorEntry *entries, std::uint64_t max_entries,
+                                                 std::uint8_t *buffer, std::uint64_t buffer_len);
+
+// independent trees for consecutive key ranges, partition i holds keys in [split_points[i - 1], split_points[i]).
+// each partition has its own latch, so threads on disjoint partitions do not contend.
+// callbacks must not access the tree, scans and cursors continue across partitions in key order.
+struct RustPartitionedBTree;
+
+RustPartitionedBTree *btree_partitioned_new(BTreeLeafLayout leaf, BTreeInnerLayout inner,
+                                            std::uint8_t const *const *split_points,
+                                            std::uint64_t const *split_point_lens, std::uint64_t split_point_count);
+void btree_partitioned_insert(RustPartitionedBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen,
+                              std::uint8_t *payload, std::uint64_t payloadLen);
+bool btree_partitioned_lookup(RustPartitionedBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen,
+                              void (*callback)(void *ctx, std::uint8_t const *payload, std::uint64_t payloadLen),
+                              void *ctx);
+bool btree_partitioned_update(RustPartitionedBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen,
+                              void (*callback)(void *ctx, std::uint8_t *payload, std::uint64_t payloadLen),
+                              void *ctx);
+bool btree_partitioned_remove(RustPartitionedBTree *b_tree, std::uint8_t *key, std::uint64_t keyLen);
+void btree_partitioned_scan_asc(RustPartitionedBTree *b_tree, std::uint8_t const *key, std::uint64_t key_len,
+                                std::uint8_t const *end_key, std::uint64_t end_key_len, std::uint8_t *key_buffer,
+                                btree_scan_callback continue_callback, void *ctx);
+void btree_partitioned_scan_desc(RustPartitionedBTree *b_tree, std::uint8_t const *key, std::uint64_t key_len,
+                                 std::uint8_t const *end_key, std::uint64_t end_key_len, std::uint8_t *key_buffer,
+                                 btree_scan_callback continue_callback, void *ctx);
+std::uint64_t btree_partitioned_count_range(RustPartitionedBTree *b_tree, std::uint8_t const *lower,
+                                            std::uint64_t lower_len, std::uint8_t const *upper,
+                                            std::uint64_t upper_len);
+std::uint64_t btree_partitioned_cursor_next_batch(RustPartitionedBTree *b_tree, RustBTreeCursor *cursor,
+                                                  BTreeCursorEntry *entries, std::uint64_t max_entries,
+                                                  std::uint8_t *buffer, std::uint64_t buffer_len);
+void btree_partitioned_destroy(RustPartitionedBTree *b_tree);
+
+// page file, requires the node-alloc_pool feature.
+// maps the file at path at a fixed address, nodes allocated afterwards live in it.
+// must be called before any tree is created, returns true if an existing file was mapped.
+bool btree_page_file_map(char const *path, std::uint64_t capacity);
+// larger than memory trees, requires the node-alloc_pool feature and excludes btree_page_file_map.
+// nodes allocated afterwards live in a shared mapping of a scratch file that is truncated to capacity,
+// the kernel page cache writes cold nodes back to it and evicts them, there is no buffer manager of our own.
+// a background thread starts writeback of dirty nodes every writeback_interval_ms, 0 disables it.
+void btree_page_cache_file_map(char const *path, std::uint64_t capacity, std::uint64_t writeback_interval_ms);
+// records the root of a tree in one of 32 slots
+void btree_checkpoint(RustBTree *b_tree, std::uint64_t slot);
+void btree_concurrent_checkpoint(RustConcurrentBTree *b_tree, std::uint64_t slot);
+// atomically replaces the file with the current contents of the mapping.
+// checkpointed trees must not be modified until this returns.
+void btree_page_file_sync();
+// the first redo log record not reflected in the page file, replay starts there
+std::uint64_t btree_page_file_log_lsn();
+// returns the tree recorded in slot, or null. each slot must be opened at most once.
+RustBTree *btree_open(std::uint64_t slot);
+RustConcurrentBTree *btree_concurrent_open(std::uint64_t slot);
+
+// NUMA placement, requires the node-alloc_pool feature and excludes page and page cache files.
+// leaves are placed on the home node of the allocating thread, inner nodes are interleaved across nodes.
+// must be called before any tree is created, returns the number of nodes.
+std::uint64_t btree_numa_enable();
+// pins the calling thread to cpu and makes its node the home node, returns the node
+std::uint64_t btree_pin_thread(std::uint64_t cpu);
+void btree_set_home_node(std::uint64_t node);
+
+// redo log. records are collected in per thread buffers and written in groups with kernel aio,
+// a group is written at least every group_commit_us. the log is emptied if truncate is set.
+void btree_wal_open(char const *path, std::uint64_t group_commit_us, bool truncate);
+// logs insert, upsert, insert_if_absent, remove and remove_range of the tree under id.
+// payloads modified through the pointer returned by btree_lookup are not logged.
+void btree_wal_attach(RustBTree *b_tree, std::uint32_t id);
+// logs insert, update and remove, must be called before the tree is shared
+void btree_concurrent_wal_attach(RustConcurrentBTree *b_tree, std::uint32_t id);
+// lsn of the last record logged by the calling thread, 0 if there is none
+std::uint64_t btree_wal_thread_lsn();
+// blocks until lsn and all records before it are durable
+void btree_wal_wait(std::uint64_t lsn);
+// applies records with lsn >= from_lsn to trees[id] in lsn order, trees must not be attached yet
+void btree_wal_replay(char const *path, std::uint64_t from_lsn, RustBTree *const *trees, std::uint64_t tree_count);
+void btree_concurrent_wal_replay(char const *path, std::uint64_t from_lsn, RustConcurrentBTree *const *trees,
+                                 std::uint64_t tree_count);
 }
 #endif //BTREE_BTREE_RUST_H
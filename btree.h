@@ -36,6 +36,41 @@ public:
         return btree_remove(root, key, keyLength);
     }
 
+    // returns the existing payload, or null if payload was inserted
+    uint8_t *insert_if_absent(uint8_t *key, unsigned keyLength, uint8_t *payload, unsigned payloadLength) {
+        uint64_t sizeOut = 0;
+        return btree_insert_if_absent(root, key, keyLength, payload, payloadLength, &sizeOut);
+    }
+
+    // see btree_upsert
+    void upsert(uint8_t *key, unsigned keyLength, uint8_t *payload, unsigned payloadLength,
+                void (*callback)(void *ctx, std::uint8_t *payload, std::uint64_t payloadLen,
+                                 std::uint8_t const **replacement, std::uint64_t *replacementLen),
+                void *ctx) {
+        btree_upsert(root, key, keyLength, payload, payloadLength, callback, ctx);
+    }
+
+    // removes keys in [lower, upper), upper may be null
+    void remove_range(uint8_t const *lower, unsigned lowerLength, uint8_t const *upper, unsigned upperLength) {
+        btree_remove_range(root, lower, lowerLength, upper, upperLength);
+    }
+
+    // counts keys in [lower, upper), upper may be null
+    uint64_t count_range(uint8_t const *lower, unsigned lowerLength, uint8_t const *upper, unsigned upperLength) {
+        return btree_count_range(root, lower, lowerLength, upper, upperLength);
+    }
+
+    uint64_t cursor_next_batch(RustBTreeCursor *cursor, BTreeCursorEntry *entries, uint64_t maxEntries, uint8_t *buffer,
+                               uint64_t bufferLength) {
+        return btree_cursor_next_batch(root, cursor, entries, maxEntries, buffer, bufferLength);
+    }
+
+    // replaces the contents of the tree, entries must be in strictly ascending key order
+    void bulk_load(btree_bulk_load_next next, void *ctx) {
+        btree_destroy(root);
+        root = btree_bulk_load(next, ctx);
+    }
+
     void print_info() {
         btree_print_info(root);
     }
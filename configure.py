@@ -16,8 +16,7 @@ FEATURES = {
     # "inner": ["basic"],
     "leaf": ["basic", "hash", "adapt"],
     # "leaf" : ["hash","basic"],
-    # "hash-leaf-simd": ["32", "64"],
-    "hash-leaf-simd": ["32"],
+    "hash-leaf-simd": ["32", "64"],
     # "strip-prefix": ["true", "false"],
     "strip-prefix": ["false", "true"],
     # "hash": ["crc32","wyhash", "fx"],
@@ -31,6 +30,16 @@ FEATURES = {
     "basic-use-hint": ["false", "true", "naive"],
     "basic-prefix": ["false", "true"],
     "basic-heads": ["false", "true"],
+    "leaf-links": ["false", "true"],
+    "node-alloc": ["box", "pool"],
+    "head-simd": ["false", "true"],
+    # KiB, in page offsets are u16
+    "page-size": ["4", "8", "16", "32"],
+    "overflow": ["false", "true"],
+    "append": ["false", "true"],
+    "subtree-counts": ["false", "true"],
+    "frozen-top": ["0", "2", "3"],
+    "int-leaf": ["false", "true"],
 }
 
 
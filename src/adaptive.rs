@@ -1,22 +1,47 @@
-use once_cell::sync::Lazy;
-use rand::{Rng, SeedableRng};
+use rand::{Rng, RngCore, SeedableRng};
 use crate::BTreeNode;
 use crate::head_node::{U32ExplicitHeadNode, U32ZeroPaddedHeadNode, U64ExplicitHeadNode, U64ZeroPaddedHeadNode};
 use crate::node_traits::{InnerConversionSink};
 use crate::vtables::BTreeNodeTag;
-use rand::distributions::Distribution;
 use rand::rngs::SmallRng;
+use std::cell::UnsafeCell;
+use std::sync::atomic::{AtomicU64, Ordering};
 
-pub static mut RAND: Lazy<SmallRng> = Lazy::new(|| SmallRng::seed_from_u64(0x0123456789abcdef));
+/// sampling state is per thread, so concurrent operations do not contend on a shared cache line
+#[repr(align(64))]
+struct ThreadRand(SmallRng);
 
+thread_local! {
+    static RAND: UnsafeCell<ThreadRand> = UnsafeCell::new(ThreadRand(SmallRng::seed_from_u64(next_seed())));
+}
+
+static SEEDED_THREADS: AtomicU64 = AtomicU64::new(0);
+
+/// threads are seeded in creation order, so single threaded runs stay reproducible
+fn next_seed() -> u64 {
+    0x0123456789abcdef ^ SEEDED_THREADS.fetch_add(1, Ordering::Relaxed).wrapping_mul(0x9e3779b97f4a7c15)
+}
+
+/// calls f with the rng of the current thread, f must not use the rng through other functions
+#[inline]
+pub fn with_rand<R>(f: impl FnOnce(&mut SmallRng) -> R) -> R {
+    RAND.with(|r| f(unsafe { &mut (*r.get()).0 }))
+}
+
+/// true with probability 1/infrequency
 #[inline]
 pub fn infrequent(infrequency: u32) -> bool {
-    let distribution = rand::distributions::Bernoulli::from_ratio(1, infrequency).unwrap();
-    distribution.sample(unsafe { &mut *RAND })
+    (gen_random() as u64 * infrequency as u64) >> 32 == 0
 }
 
+#[inline]
 pub fn gen_random() -> u32 {
-    unsafe { &mut *RAND }.gen()
+    with_rand(|r| r.next_u32())
+}
+
+#[inline]
+pub fn gen_random_u64() -> u64 {
+    with_rand(|r| r.gen())
 }
 
 pub fn adapt_inner(node: &mut BTreeNode) {
@@ -1,5 +1,5 @@
-use crate::find_separator::find_separator;
-use crate::util::{common_prefix_len, MergeFences, partial_restore, short_slice, SplitFences};
+use crate::find_separator::find_leaf_separator;
+use crate::util::{common_prefix_len, entry_lengths, MergeFences, partial_restore, short_slice, SplitFences};
 use crate::{BTreeNode, PrefixTruncatedKey, PAGE_SIZE, FatTruncatedKey};
 use rustc_hash::FxHasher;
 use std::hash::Hasher;
@@ -61,8 +61,11 @@ struct LayoutInfo {
 }
 
 const USE_SIMD: bool = true;
+#[cfg(feature = "hash-leaf-simd_32")]
+const SIMD_WIDTH: usize = 32;
+#[cfg(feature = "hash-leaf-simd_64")]
 const SIMD_WIDTH: usize = 64;
-const SIMD_ALIGN: usize = align_of::<Simd<u8, SIMD_WIDTH>>();
+const SIMD_ALIGN: usize = 64;
 
 impl HashLeaf {
     pub fn space_needed_new_slot(&self, key_length: usize, payload_length: usize) -> usize {
@@ -89,6 +92,15 @@ impl HashLeaf {
             - self.head.space_used as usize
     }
 
+    pub fn entry_count(&self) -> usize {
+        self.head.count as usize
+    }
+
+    /// entry count, total stored key length, and total payload length
+    pub fn entry_lengths(&self) -> (usize, usize, usize) {
+        entry_lengths(self.slots().iter().map(|s| (s.key_len, s.val_len)))
+    }
+
     pub fn as_bytes(&self) -> &[u8; PAGE_SIZE] {
         assert_eq!(PAGE_SIZE, size_of::<Self>());
         unsafe { transmute(self as *const Self) }
@@ -285,7 +297,7 @@ impl HashLeaf {
         );
     }
 
-    fn set_fences(
+    pub fn set_fences(
         &mut self,
         fences @ FenceData {
             lower_fence,
@@ -383,33 +395,30 @@ impl HashLeaf {
     fn find_simd(&self, key: PrefixTruncatedKey, needle_hash: u8) -> Option<usize> {
         unsafe {
             use std::simd::ToBitMask;
-            type SimdDtype = std::simd::Simd<u8, SIMD_WIDTH>;
-            let count = self.head.count as usize;
-            let hash_offset_mod = self.head.hash_area.offset as usize % SIMD_ALIGN;
-            let hash_offset_floor = self.head.hash_area.offset as usize - hash_offset_mod;
-            let mut hash_ptr = (self as *const Self as *const u8).offset(hash_offset_floor as isize) as *const SimdDtype;
+            type SimdDtype = Simd<u8, SIMD_WIDTH>;
+            let hash_start = self.head.hash_area.offset as usize;
+            let hash_end = hash_start + self.head.count as usize;
             let needle = SimdDtype::splat(needle_hash);
-            debug_assert!(hash_ptr.is_aligned());
-            let mut shift = hash_offset_mod;
-            let mut matches = (*hash_ptr).simd_eq(needle).to_bitmask() >> shift;
-            let shift_limit = shift + count;
-            while shift < shift_limit {
-                let trailing_zeros = matches.trailing_zeros();
-                if trailing_zeros == SIMD_WIDTH as u32 {
-                    shift = shift - shift % SIMD_WIDTH + SIMD_WIDTH;
-                    hash_ptr = hash_ptr.offset(1);
-                    matches = (*hash_ptr).simd_eq(needle).to_bitmask();
-                } else {
-                    shift += trailing_zeros as usize;
-                    matches >>= trailing_zeros;
-                    matches = matches & !1;
-                    if shift >= shift_limit {
-                        return None;
-                    }
-                    if self.slots()[shift - hash_offset_mod].key(self.as_bytes()) == key {
-                        return Some(shift - hash_offset_mod);
+            // aligned loads never leave the page, lanes outside the hash array are masked
+            let mut chunk_start = hash_start - hash_start % SIMD_WIDTH;
+            while chunk_start < hash_end {
+                let hash_ptr = (self as *const Self as *const u8).add(chunk_start) as *const SimdDtype;
+                debug_assert!(hash_ptr.is_aligned());
+                let mut matches = (*hash_ptr).simd_eq(needle).to_bitmask() as u64;
+                if chunk_start < hash_start {
+                    matches &= !0u64 << (hash_start - chunk_start);
+                }
+                if hash_end - chunk_start < SIMD_WIDTH {
+                    matches &= (1u64 << (hash_end - chunk_start)) - 1;
+                }
+                while matches != 0 {
+                    let index = chunk_start + matches.trailing_zeros() as usize - hash_start;
+                    if self.slots()[index].key(self.as_bytes()) == key {
+                        return Some(index);
                     }
+                    matches &= matches - 1;
                 }
+                chunk_start += SIMD_WIDTH;
             }
         }
         None
@@ -549,15 +558,17 @@ unsafe impl Node for HashLeaf {
         self.sort();
 
         // split
+        let count = self.head.count as usize;
+        let append = &key_in_self[self.head.prefix_len as usize..] > self.slots()[count - 1].key(self.as_bytes()).0;
         let (sep_slot, truncated_sep_key) =
-            find_separator(self.head.count as usize, true, |i: usize| {
+            find_leaf_separator(count, append, |i: usize| {
                 self.slots()[i].key(self.as_bytes())
             });
         let full_sep_key_len = truncated_sep_key.0.len() + self.head.prefix_len as usize;
         let parent_prefix_len = parent.request_space_for_child(full_sep_key_len)?;
         let node_left_raw;
         let node_left = unsafe {
-            node_left_raw = BTreeNode::alloc();
+            node_left_raw = BTreeNode::alloc(BTreeNode::layout(self as *const Self as *const BTreeNode));
             (*node_left_raw).hash_leaf = ManuallyDrop::new(Self::new());
             &mut (*node_left_raw).hash_leaf
         };
@@ -571,6 +582,7 @@ unsafe impl Node for HashLeaf {
                 BTreeNode::dealloc(node_left_raw);
                 return Err(());
             }
+            BTreeNode::link_leaf_before(node_left_raw, self as *mut Self as *mut BTreeNode);
         }
         self.copy_key_value_range(&self.slots()[..=sep_slot], node_left);
         self.copy_key_value_range(&self.slots()[sep_slot + 1..], &mut node_right);
@@ -675,8 +687,10 @@ unsafe impl LeafNode for HashLeaf {
         self.sort();
         debug_assert!(!key_out.is_null());
         key_out.copy_from_nonoverlapping(start.as_ptr(), self.head.prefix_len as usize);
-        let start_index = self.lower_bound(self.truncate(start)).0.min(self.head.count as usize - 1);
-        for s in self.slots()[..=start_index].iter().rev() {
+        // largest key less than or equal to start
+        let (lower_bound, found) = self.lower_bound(self.truncate(start));
+        let end_index = if found { lower_bound + 1 } else { lower_bound };
+        for s in self.slots()[..end_index].iter().rev() {
             let k = s.key(self.as_bytes());
             key_out.offset(self.head.prefix_len as isize).copy_from_nonoverlapping(k.0.as_ptr(), k.0.len());
             if !callback((s.key_len + self.head.prefix_len) as usize, s.value(self.as_bytes())) {
@@ -439,6 +439,8 @@ impl InnerNode for ArtNode {
         }
     }
 
+    fn set_child_count(&mut self, _index: usize, _count: u64) {}
+
     fn find_child_index(&mut self, key: &[u8], bc: &mut BranchCacheAccessor) -> usize {
         let key = PrefixTruncatedKey(&key[self.head.prefix_len as usize..]);
         let index = bc.predict().filter(|&i| {
@@ -556,6 +558,11 @@ impl InnerConversionSource for ArtNode {
         }
     }
 
+    /// subtree counts are not stored, `BTree` rejects art inner nodes if SUBTREE_COUNTS is set
+    fn get_child_count(&self, _index: usize) -> u64 {
+        0
+    }
+
     fn get_key(&self, index: usize, dst: &mut [u8], strip_prefix: usize) -> Result<usize, ()> {
         get_key_from_slice(self.piv_entry(index).key(self), dst, strip_prefix)
     }
@@ -1,50 +1,313 @@
 use crate::{BTreeNode, op_count, PAGE_SIZE};
-use std::ptr;
+use crate::btree_node::STRIP_PREFIX;
+use crate::btree_node::{APPEND, LEAF_LINKS, SUBTREE_COUNTS};
+use crate::bulk_load::{bulk_load, LevelSlice};
+use crate::layout::{InnerLayout, NodeLayout};
+use std::{ptr, slice};
 use std::sync::atomic::{AtomicUsize, Ordering};
 use crate::branch_cache::BranchCacheAccessor;
 use crate::util::trailing_bytes;
 use op_count::count_op;
 use crate::hash_leaf::HashLeaf;
+use crate::node_traits::InnerNode;
+use crate::overflow::{self, EncodeBuffer, OVERFLOW};
+use crate::cursor::{BatchWriter, Cursor};
+use crate::node_pool;
+use crate::wal::{self, LogOp, LogRecord};
+use crate::frozen_top::FrozenTop;
 
 
 pub struct BTree {
     pub root: *mut BTreeNode,
     branch_cache: BranchCacheAccessor,
+    append_cache: AppendCache,
+    frozen_top: FrozenTop,
+    /// if set, modifications are appended to the redo log under this id
+    pub wal_id: Option<u32>,
+}
+
+/// leaf of the last insert with its parent and index, only used if APPEND is set.
+/// cleared whenever nodes are split or merged.
+struct AppendCache {
+    leaf: *mut BTreeNode,
+    parent: *mut BTreeNode,
+    index: usize,
+    /// prefix of leaf if STRIP_PREFIX is set, the leaf does not store it
+    prefix: Vec<u8>,
+}
+
+impl AppendCache {
+    fn new() -> Self {
+        AppendCache {
+            leaf: ptr::null_mut(),
+            parent: ptr::null_mut(),
+            index: 0,
+            prefix: Vec::new(),
+        }
+    }
+
+    fn clear(&mut self) {
+        self.leaf = ptr::null_mut();
+    }
+
+    unsafe fn store(&mut self, leaf: *mut BTreeNode, parent: *mut BTreeNode, index: usize, key: &[u8]) {
+        self.leaf = leaf;
+        self.parent = parent;
+        self.index = index;
+        if STRIP_PREFIX {
+            self.prefix.clear();
+            self.prefix.extend_from_slice(&key[..(*leaf).leaf_fences().prefix_len]);
+        }
+    }
+
+    unsafe fn get(&self, key: &[u8]) -> Option<(*mut BTreeNode, *mut BTreeNode, usize)> {
+        if !self.leaf.is_null() && (*self.leaf).leaf_fences().contains(&self.prefix, key) {
+            Some((self.leaf, self.parent, self.index))
+        } else {
+            None
+        }
+    }
+}
+
+impl Drop for BTree {
+    fn drop(&mut self) {
+        if OVERFLOW {
+            let mut key_buffer = [0u8; PAGE_SIZE / 4];
+            self.range_lookup_stored(&[], key_buffer.as_mut_ptr(), &mut |_, stored| {
+                unsafe { overflow::free(stored) };
+                true
+            });
+        }
+        unsafe { BTreeNode::dealloc_tree(self.root) }
+    }
 }
 
 impl BTree {
     pub fn new() -> Self {
+        Self::with_layout(NodeLayout::DEFAULT)
+    }
+
+    pub fn with_layout(layout: NodeLayout) -> Self {
         count_op();
+        assert_counts_supported(layout);
         BTree {
-            root: BTreeNode::new_leaf(),
+            root: BTreeNode::new_leaf(layout),
             branch_cache: BranchCacheAccessor::new(),
+            append_cache: AppendCache::new(),
+            frozen_top: FrozenTop::new(),
+            wal_id: None,
+        }
+    }
+
+    /// entries must be in strictly ascending key order
+    pub fn bulk_load<'a>(layout: NodeLayout, entries: impl Iterator<Item=(&'a [u8], &'a [u8])>) -> Self {
+        count_op();
+        assert_counts_supported(layout);
+        let root = if OVERFLOW {
+            let mut buffer = [0u8; PAGE_SIZE / 4];
+            // bulk_load copies each entry before requesting the next
+            bulk_load(layout, entries.map(move |(key, payload)| {
+                let stored = overflow::encode(key, payload, &mut buffer);
+                (key, unsafe { &*(stored as *const [u8]) })
+            }))
+        } else {
+            bulk_load(layout, entries)
+        };
+        BTree {
+            root,
+            branch_cache: BranchCacheAccessor::new(),
+            append_cache: AppendCache::new(),
+            frozen_top: FrozenTop::new(),
+            wal_id: None,
+        }
+    }
+
+    /// records the root in `slot` of the page file, see `BTreeNode::map_page_file`.
+    /// the tree must not be modified until the next `node_pool::sync_file`.
+    pub fn checkpoint(&self, slot: usize) {
+        node_pool::set_file_root(slot, self.root as *mut u8);
+    }
+
+    /// reopens the tree recorded in `slot` of the page file, the tree must be opened at most once
+    pub fn open(slot: usize) -> Option<Self> {
+        let root = node_pool::file_root(slot) as *mut BTreeNode;
+        if root.is_null() {
+            return None;
+        }
+        Some(BTree {
+            root,
+            branch_cache: BranchCacheAccessor::new(),
+            append_cache: AppendCache::new(),
+            frozen_top: FrozenTop::new(),
+            wal_id: None,
+        })
+    }
+
+    /// returns the representation of payload that is stored in the leaf
+    fn encode_payload<'b>(key: &[u8], payload: &'b [u8], buffer: &'b mut EncodeBuffer) -> &'b [u8] {
+        if OVERFLOW {
+            overflow::encode(key, payload, buffer)
+        } else {
+            assert!((key.len() + payload.len()) as usize <= PAGE_SIZE / 4);
+            payload
         }
     }
 
     #[tracing::instrument(skip(self))]
     pub fn insert(&mut self, key: &[u8], payload: &[u8]) {
         count_op();
-        assert!((key.len() + payload.len()) as usize <= PAGE_SIZE / 4);
+        self.log(LogOp::Put, key, payload);
+        // unused without OVERFLOW
+        let mut buffer = [0u8; PAGE_SIZE / 4];
+        let payload = Self::encode_payload(key, payload, &mut buffer);
         unsafe {
-            let (node, parent, pos) = (&mut *self.root).descend(key, |_| false, &mut self.branch_cache);
-            let node = &mut *node;
-            node.leave_notify_point_op();
-            if node.to_leaf_mut().insert(key, payload).is_ok() {
+            let (node, parent, pos) = self.descend_for_insert(key);
+            (&mut *node).leave_notify_point_op();
+            if OVERFLOW {
+                if let Some(old) = (*node).to_leaf_mut().lookup(key) {
+                    overflow::free(old);
+                }
+            }
+            self.insert_into_leaf(node, parent, pos, key, payload);
+        }
+    }
+
+    /// applies a record of the redo log, `wal_id` should be unset during replay
+    pub fn redo(&mut self, record: &LogRecord) {
+        match record.op {
+            LogOp::Put => self.insert(record.key, record.payload),
+            LogOp::Remove => {
+                unsafe { self.remove(record.key) };
+            }
+            LogOp::RemoveRange => self.remove_range(record.key, Some(record.payload)),
+            LogOp::RemoveFrom => self.remove_range(record.key, None),
+        }
+    }
+
+    /// the tree is exclusively borrowed by every modification, so log order matches the order they are applied in
+    fn log(&self, op: LogOp, key: &[u8], payload: &[u8]) {
+        if let Some(id) = self.wal_id {
+            wal::append(id, op, key, payload);
+        }
+    }
+
+    /// returns the leaf responsible for key, its parent, and its index within the parent.
+    /// starts at the node found by the frozen top levels if they are indexed.
+    unsafe fn descend(&mut self, key: &[u8]) -> (*mut BTreeNode, *mut BTreeNode, usize) {
+        let start = self.frozen_top.find(self.root, key).unwrap_or(self.root);
+        (&mut *start).descend(key, |_| false, &mut self.branch_cache)
+    }
+
+    /// like `descend`, but reuses the leaf of the previous insert if it is responsible for key.
+    unsafe fn descend_for_insert(&mut self, key: &[u8]) -> (*mut BTreeNode, *mut BTreeNode, usize) {
+        if APPEND {
+            if let Some(target) = self.append_cache.get(key) {
+                return target;
+            }
+        }
+        self.descend(key)
+    }
+
+    /// inserts into the leaf responsible for key, splitting it as necessary.
+    /// only descends again if the parent had to be split as well.
+    unsafe fn insert_into_leaf(&mut self, mut node: *mut BTreeNode, mut parent: *mut BTreeNode, mut pos: usize, key: &[u8], payload: &[u8]) {
+        loop {
+            let count_before = (*node).leaf_entry_count();
+            if (*node).to_leaf_mut().insert(key, payload).is_ok() {
+                if SUBTREE_COUNTS && (*node).leaf_entry_count() > count_before {
+                    self.adjust_counts(key, 1);
+                }
+                if APPEND {
+                    self.append_cache.store(node, parent, pos, key);
+                }
                 return;
             }
-            self.split_node(node, parent, key, pos);
-            self.insert(key, payload);
+            (node, parent, pos) = match self.split_node(node, parent, key, pos) {
+                Some(target) => target,
+                None => self.descend(key),
+            };
         }
     }
 
+    /// descends once.
+    /// if key is present, `update` is called with its payload and may modify it in place.
+    /// if `update` returns a replacement, it is stored instead, which may change the payload size.
+    /// if key is absent, `payload` is inserted.
+    pub fn upsert<'r>(&mut self, key: &[u8], payload: &[u8], update: impl FnOnce(&mut [u8]) -> Option<&'r [u8]>) {
+        count_op();
+        unsafe {
+            let (node, parent, pos) = self.descend_for_insert(key);
+            (&mut *node).leave_notify_point_op();
+            let mut buffer = [0u8; PAGE_SIZE / 4];
+            let new_payload = match (*node).to_leaf_mut().lookup(key) {
+                Some(old) => match update(overflow::decode_mut(old)) {
+                    Some(replacement) => {
+                        self.log(LogOp::Put, key, replacement);
+                        // replacement may point into the old payload, so it is copied before that is freed or overwritten
+                        let encoded = if OVERFLOW {
+                            Self::encode_payload(key, replacement, &mut buffer)
+                        } else {
+                            assert!(key.len() + replacement.len() <= PAGE_SIZE / 4);
+                            buffer[..replacement.len()].copy_from_slice(replacement);
+                            &buffer[..replacement.len()]
+                        };
+                        overflow::free(old);
+                        encoded
+                    }
+                    None => {
+                        self.log(LogOp::Put, key, overflow::decode(old));
+                        return;
+                    }
+                },
+                None => {
+                    self.log(LogOp::Put, key, payload);
+                    Self::encode_payload(key, payload, &mut buffer)
+                }
+            };
+            self.insert_into_leaf(node, parent, pos, key, new_payload);
+        }
+    }
+
+    /// calls f with the payload of key, which it may modify in place. returns None if key is absent.
+    pub fn update<R>(&mut self, key: &[u8], f: impl FnOnce(&mut [u8]) -> R) -> Option<R> {
+        count_op();
+        unsafe {
+            let (node, _, _) = self.descend(key);
+            (&mut *node).leave_notify_point_op();
+            let payload = overflow::decode_mut((*node).to_leaf_mut().lookup(key)?);
+            let result = f(payload);
+            self.log(LogOp::Put, key, payload);
+            Some(result)
+        }
+    }
+
+    /// descends once, inserts payload if key is absent.
+    /// returns the existing payload or null if payload was inserted.
+    pub unsafe fn insert_if_absent(&mut self, key: &[u8], payload: &[u8], payload_len_out: *mut u64) -> *mut u8 {
+        count_op();
+        let (node, parent, pos) = self.descend_for_insert(key);
+        (&mut *node).leave_notify_point_op();
+        if let Some(data) = (*node).to_leaf_mut().lookup(key) {
+            let data = overflow::decode_mut(data);
+            ptr::write(payload_len_out, data.len() as u64);
+            return data.as_mut_ptr();
+        }
+        self.log(LogOp::Put, key, payload);
+        let mut buffer = [0u8; PAGE_SIZE / 4];
+        let payload = Self::encode_payload(key, payload, &mut buffer);
+        self.insert_into_leaf(node, parent, pos, key, payload);
+        ptr::null_mut()
+    }
+
     #[tracing::instrument(skip(self))]
     pub unsafe fn lookup(&mut self, payload_len_out: *mut u64, key: &[u8]) -> *mut u8 {
         count_op();
         tracing::info!("lookup {key:?}");
-        let (node, _, _) = (*self.root).descend(key, |_| false, &mut self.branch_cache);
+        let (node, _, _) = self.descend(key);
         let node = &mut *node;
         node.leave_notify_point_op();
         if let Some(data) = node.to_leaf_mut().lookup(key) {
+            let data = overflow::decode_mut(data);
             ptr::write(payload_len_out, data.len() as u64);
             data.as_mut_ptr()
         } else {
@@ -52,6 +315,36 @@ impl BTree {
         }
     }
 
+    /// looks up all keys, writing payload pointers (null on miss) and lengths to the output slices.
+    /// leaf adaption may rewrite a leaf in place, so all leaves are notified before the first payload pointer is taken.
+    pub unsafe fn lookup_batch(&mut self, keys: &[&[u8]], payloads_out: &mut [*mut u8], payload_lens_out: &mut [u64]) {
+        count_op();
+        const BATCH_SIZE: usize = 64;
+        assert!(keys.len() == payloads_out.len() && keys.len() == payload_lens_out.len());
+        let mut leaves = vec![ptr::null_mut(); keys.len()];
+        for (keys, leaves) in keys.chunks(BATCH_SIZE).zip(leaves.chunks_mut(BATCH_SIZE)) {
+            self.frozen_top.find_batch(self.root, keys, leaves);
+            BTreeNode::descend_batch(keys, leaves);
+            for (i, &leaf) in leaves.iter().enumerate() {
+                // consecutive keys often share a leaf
+                if i == 0 || leaf != leaves[i - 1] {
+                    (*leaf).leave_notify_point_op();
+                }
+            }
+        }
+        for (i, (key, &leaf)) in keys.iter().zip(leaves.iter()).enumerate() {
+            if let Some(data) = (*leaf).to_leaf_mut().lookup(key) {
+                let data = overflow::decode_mut(data);
+                payload_lens_out[i] = data.len() as u64;
+                payloads_out[i] = data.as_mut_ptr();
+            } else {
+                payloads_out[i] = ptr::null_mut();
+            }
+        }
+    }
+
+    /// returns the half responsible for key, its parent, and its index within the parent.
+    /// returns None if the parent had to be split as well.
     #[tracing::instrument(skip(self))]
     unsafe fn split_node(
         &mut self,
@@ -59,8 +352,12 @@ impl BTree {
         mut parent: *mut BTreeNode,
         key: &[u8],
         index_in_parent: usize,
-    ) {
+    ) -> Option<(*mut BTreeNode, *mut BTreeNode, usize)> {
         count_op();
+        self.append_cache.clear();
+        if (*node).tag().is_inner() {
+            self.frozen_top.invalidate();
+        }
         if parent.is_null() {
             parent = BTreeNode::new_inner(node);
             self.root = parent;
@@ -69,6 +366,86 @@ impl BTree {
         self.validate();
         if success.is_err() {
             self.ensure_space(parent, key);
+            return None;
+        }
+        if SUBTREE_COUNTS {
+            // the new node is left of node
+            self.recount_children(parent, index_in_parent + 1);
+        }
+        let mut bc = BranchCacheAccessor::new();
+        bc.set_inactive();
+        let parent_inner = (&mut *parent).to_inner_mut();
+        let index = parent_inner.find_child_index(key, &mut bc);
+        Some((parent_inner.get_child(index), parent, index))
+    }
+
+    /// adds delta to the subtree counts stored for the children on the path to key
+    unsafe fn adjust_counts(&mut self, key: &[u8], delta: i64) {
+        let mut bc = BranchCacheAccessor::new();
+        bc.set_inactive();
+        let mut node = self.root;
+        while (*node).tag().is_inner() {
+            let inner = (*node).to_inner_mut();
+            let index = inner.find_child_index(key, &mut bc);
+            inner.set_child_count(index, inner.get_child_count(index).wrapping_add(delta as u64));
+            node = inner.get_child(index);
+        }
+    }
+
+    /// recomputes the subtree counts parent stores for its children at index and index - 1
+    unsafe fn recount_children(&mut self, parent: *mut BTreeNode, index: usize) {
+        let inner = (*parent).to_inner_mut();
+        for i in index.saturating_sub(1)..=index.min(inner.key_count()) {
+            inner.set_child_count(i, BTreeNode::entry_count(inner.get_child(i)));
+        }
+    }
+
+    /// number of entries with keys less than key
+    unsafe fn rank(&mut self, key: &[u8]) -> u64 {
+        let mut bc = BranchCacheAccessor::new();
+        bc.set_inactive();
+        let mut node = self.root;
+        let mut rank = 0;
+        while (*node).tag().is_inner() {
+            let inner = (*node).to_inner_mut();
+            let index = inner.find_child_index(key, &mut bc);
+            // the counts of the children to the left are stored in node, so each level reads one node
+            rank += (0..index).map(|i| inner.get_child_count(i)).sum::<u64>();
+            node = inner.get_child(index);
+        }
+        let mut key_buffer = [0u8; PAGE_SIZE / 4];
+        let mut not_less = 0;
+        (*node).to_leaf_mut().range_lookup(key, key_buffer.as_mut_ptr(), &mut |_, _| {
+            not_less += 1;
+            true
+        });
+        rank + (*node).leaf_entry_count() as u64 - not_less
+    }
+
+    /// number of keys in [lower, upper), an absent upper bound is unbounded.
+    /// only descends the two boundary paths if SUBTREE_COUNTS is set, scans the range otherwise.
+    pub fn count_range(&mut self, lower: &[u8], upper: Option<&[u8]>) -> u64 {
+        if SUBTREE_COUNTS {
+            count_op();
+            unsafe {
+                let end = match upper {
+                    Some(upper) => self.rank(upper),
+                    None => BTreeNode::entry_count(self.root),
+                };
+                end.saturating_sub(self.rank(lower))
+            }
+        } else {
+            let mut key_buffer = [0u8; PAGE_SIZE / 4];
+            let key_out = key_buffer.as_mut_ptr();
+            let mut count = 0;
+            self.range_lookup_stored(lower, key_out, &mut |key_len, _| {
+                if upper.map_or(false, |upper| unsafe { std::slice::from_raw_parts(key_out, key_len) } >= upper) {
+                    return false;
+                }
+                count += 1;
+                true
+            });
+            count
         }
     }
 
@@ -101,15 +478,29 @@ impl BTree {
         count_op();
         let mut merge_target: *mut BTreeNode = ptr::null_mut();
         loop {
-            let (node, parent, index) = (&mut *self.root).descend(key, |n| n == merge_target, &mut self.branch_cache);
+            let (node, parent, index) = if merge_target.is_null() {
+                self.descend(key)
+            } else {
+                (&mut *self.root).descend(key, |n| n == merge_target, &mut self.branch_cache)
+            };
             if merge_target.is_null() {
                 (&mut *node).leave_notify_point_op();
+                if OVERFLOW {
+                    if let Some(old) = (*node).to_leaf_mut().lookup(key) {
+                        overflow::free(old);
+                    }
+                }
                 let not_found = (&mut *node).to_leaf_mut().remove(key).is_none();
                 self.validate();
                 if not_found {
-                    return false; // todo validate
+                    return false;
+                }
+                self.log(LogOp::Remove, key, &[]);
+                if SUBTREE_COUNTS {
+                    self.adjust_counts(key, -1);
                 }
                 if (*node).is_underfull() {
+                    self.append_cache.clear();
                     merge_target = node;
                 } else {
                     return true;
@@ -120,7 +511,15 @@ impl BTree {
                 break;
             }
             debug_assert!((*node).is_underfull());
-            if (*parent).to_inner_mut().merge_children_check(index).is_ok() && (*parent).is_underfull() {
+            if (*node).tag().is_inner() {
+                self.frozen_top.invalidate();
+            }
+            let merged = (*parent).to_inner_mut().merge_children_check(index).is_ok();
+            if merged && SUBTREE_COUNTS {
+                // the merged node replaces the child at index or its left neighbour
+                self.recount_children(parent, index);
+            }
+            if merged && (*parent).is_underfull() {
                 (&mut *parent).adaption_state().set_adapted(false);
                 self.validate();
                 merge_target = parent;
@@ -133,9 +532,191 @@ impl BTree {
         true
     }
 
+    /// removes all keys in [lower, upper), an absent upper bound is unbounded.
+    /// only the two boundary paths are visited, subtrees between them are freed and replaced by a single empty subtree.
+    pub fn remove_range(&mut self, lower: &[u8], upper: Option<&[u8]>) {
+        count_op();
+        if upper.map_or(false, |upper| upper <= lower) {
+            return;
+        }
+        match upper {
+            Some(upper) => self.log(LogOp::RemoveRange, lower, upper),
+            None => self.log(LogOp::RemoveFrom, lower, &[]),
+        }
+        self.append_cache.clear();
+        self.frozen_top.invalidate();
+        unsafe {
+            if OVERFLOW {
+                let mut key_buffer = [0u8; PAGE_SIZE / 4];
+                let key_out = key_buffer.as_mut_ptr();
+                self.range_lookup_stored(lower, key_out, &mut |key_len, stored| {
+                    if upper.map_or(false, |upper| slice::from_raw_parts(key_out, key_len) >= upper) {
+                        return false;
+                    }
+                    overflow::free(stored);
+                    true
+                });
+            }
+            match restrict_range(Some(lower), upper, &[], &[]) {
+                (None, None) => {
+                    let layout = BTreeNode::layout(self.root);
+                    BTreeNode::dealloc_tree(self.root);
+                    self.root = BTreeNode::new_leaf(layout);
+                }
+                (lo, hi) => self.remove_range_in(self.root, &[], &[], lo, hi),
+            }
+            self.validate();
+        }
+    }
+
+    /// removes the keys in [lo, hi) from the subtree of node, which has the full length fences lower and upper.
+    /// absent bounds are not limited within node, at least one must be present.
+    unsafe fn remove_range_in(&mut self, node: *mut BTreeNode, lower: &[u8], upper: &[u8], lo: Option<&[u8]>, hi: Option<&[u8]>) {
+        debug_assert!(lo.is_some() || hi.is_some());
+        if (*node).tag().is_leaf() {
+            let mut key_buffer = [0u8; PAGE_SIZE / 4];
+            let key_out = key_buffer.as_mut_ptr();
+            let mut keys = Vec::new();
+            (*node).to_leaf_mut().range_lookup(lo.unwrap_or(lower), key_out, &mut |key_len, _| {
+                let key = slice::from_raw_parts(key_out, key_len);
+                if hi.map_or(false, |hi| key >= hi) {
+                    return false;
+                }
+                keys.push(key.to_vec());
+                true
+            });
+            for key in keys {
+                (*node).to_leaf_mut().remove(&key);
+            }
+            return;
+        }
+        let layout = BTreeNode::layout(node);
+        let inner = (*node).to_inner_mut();
+        let key_count = inner.key_count();
+        let prefix_len = inner.fences().prefix_len;
+        let prefix = if lower.is_empty() { &upper[..prefix_len] } else { &lower[..prefix_len] };
+        let mut key_buffer = [0u8; PAGE_SIZE / 4];
+        let mut separators: Vec<Vec<u8>> = (0..key_count).map(|i| {
+            let len = inner.get_key(i, &mut key_buffer, 0).unwrap();
+            [prefix, trailing_bytes(&key_buffer, len)].concat()
+        }).collect();
+        let mut children: Vec<*mut BTreeNode> = (0..key_count + 1).map(|i| inner.get_child(i)).collect();
+        let child_lower = |i: usize| if i == 0 { lower } else { &separators[i - 1][..] };
+        let child_upper = |i: usize| if i == key_count { upper } else { &separators[i][..] };
+
+        let mut bc = BranchCacheAccessor::new();
+        bc.set_inactive();
+        let first = lo.map_or(0, |lo| inner.find_child_index(lo, &mut bc));
+        let last = hi.map_or(key_count, |hi| inner.find_child_index(hi, &mut bc));
+        // children strictly between the boundary children are covered entirely, the boundary children may be as well
+        let mut covered = first + 1..last.max(first + 1);
+        match restrict_range(lo, hi, child_lower(first), child_upper(first)) {
+            (None, None) => covered.start = first,
+            (child_lo, child_hi) => self.remove_range_in(children[first], child_lower(first), child_upper(first), child_lo, child_hi),
+        }
+        if last != first {
+            match restrict_range(lo, hi, child_lower(last), child_upper(last)) {
+                (None, None) => covered.end = last + 1,
+                (child_lo, child_hi) => self.remove_range_in(children[last], child_lower(last), child_upper(last), child_lo, child_hi),
+            }
+        }
+
+        if !covered.is_empty() {
+            let covered_lower = child_lower(covered.start).to_vec();
+            let covered_upper = child_upper(covered.end - 1).to_vec();
+            let mut height = 0;
+            let mut n = children[covered.start];
+            while (*n).tag().is_inner() {
+                n = (*n).to_inner().get_child(0);
+                height += 1;
+            }
+            let replacement = empty_subtree(layout, height, &covered_lower, &covered_upper);
+            if LEAF_LINKS {
+                let prev = BTreeNode::leaf_links(edge_leaf(children[covered.start], false)).prev;
+                let next = BTreeNode::leaf_links(edge_leaf(children[covered.end - 1], true)).next;
+                let leaf = edge_leaf(replacement, false);
+                BTreeNode::leaf_links(leaf).prev = prev;
+                BTreeNode::leaf_links(leaf).next = next;
+                if !prev.is_null() {
+                    BTreeNode::leaf_links(prev).next = leaf;
+                }
+                if !next.is_null() {
+                    BTreeNode::leaf_links(next).prev = leaf;
+                }
+            }
+            for &child in &children[covered.clone()] {
+                BTreeNode::dealloc_tree(child);
+            }
+            children.splice(covered.clone(), [replacement]);
+            separators.drain(covered.start..covered.end - 1);
+            // fewer keys within the same fences always fit
+            let mut tmp = BTreeNode::new_uninit();
+            layout.inner.create(&mut tmp, &LevelSlice::with_fences(&children, &separators, lower, upper)).unwrap();
+            ptr::copy_nonoverlapping(&tmp, node, 1);
+        }
+
+        // rebalance the boundary children, the replacement between them, and the left neighbour of the first one.
+        // like in remove, only underfull children are merged. descending, so merges do not move the children still to visit.
+        let last = last - covered.len().saturating_sub(1);
+        let inner = (*node).to_inner_mut();
+        for i in (first.saturating_sub(1)..=last).rev() {
+            if i <= inner.key_count() && (*inner.get_child(i)).is_underfull() {
+                let _ = inner.merge_children_check(i);
+            }
+        }
+        if SUBTREE_COUNTS {
+            // node was rebuilt, so recount all of its children
+            for i in 0..=inner.key_count() {
+                inner.set_child_count(i, BTreeNode::entry_count(inner.get_child(i)));
+            }
+        }
+    }
+
     pub fn range_lookup(&mut self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
+        if OVERFLOW {
+            self.range_lookup_stored(initial_start, key_out, &mut |key_len, stored| callback(key_len, overflow::decode(stored)))
+        } else {
+            self.range_lookup_stored(initial_start, key_out, callback)
+        }
+    }
+
+    pub fn range_lookup_desc(&mut self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
+        if OVERFLOW {
+            self.range_lookup_desc_stored(initial_start, key_out, &mut |key_len, stored| callback(key_len, overflow::decode(stored)))
+        } else {
+            self.range_lookup_desc_stored(initial_start, key_out, callback)
+        }
+    }
+
+    /// fills batch with the entries following the position of cursor.
+    /// the tree must not be modified between seeking cursor and its last batch.
+    pub fn cursor_next_batch(&mut self, cursor: &mut Cursor, batch: &mut BatchWriter) -> usize {
+        unsafe {
+            while !cursor.done {
+                if cursor.leaf.is_null() {
+                    cursor.leaf = self.descend(cursor.start()).0;
+                    (*cursor.leaf).leave_notify_range_op();
+                }
+                let leaf = cursor.leaf;
+                if !cursor.scan_leaf(&mut *leaf, batch, OVERFLOW) {
+                    break;
+                }
+                cursor.leaf = ptr::null_mut();
+                if !cursor.advance_past(&*leaf) {
+                    break;
+                }
+                if LEAF_LINKS {
+                    cursor.leaf = BTreeNode::leaf_links(leaf).next;
+                    (*cursor.leaf).leave_notify_range_op();
+                }
+            }
+        }
+        batch.count()
+    }
+
+    /// passes payloads as stored in the leaves
+    fn range_lookup_stored(&mut self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
         count_op();
-        let mut get_key_buffer = [0u8; PAGE_SIZE / 4];
         let mut start_key_buffer = [0u8; PAGE_SIZE / 4];
         start_key_buffer[..initial_start.len()].copy_from_slice(initial_start);
         let mut start_key_len = initial_start.len();
@@ -158,21 +739,28 @@ impl BTree {
                         if !node.to_leaf_mut().range_lookup(&start_key_buffer[..start_key_len], key_out, callback) {
                             return;
                         }
+                        if LEAF_LINKS {
+                            // walk the leaf list instead of descending again
+                            let mut leaf: *mut BTreeNode = node;
+                            loop {
+                                let next = BTreeNode::leaf_links(leaf).next;
+                                if next.is_null() {
+                                    return;
+                                }
+                                start_key_len = leaf_start_after(&*leaf, &mut start_key_buffer);
+                                leaf = next;
+                                (*leaf).leave_notify_range_op();
+                                if !(*leaf).to_leaf_mut().range_lookup(&start_key_buffer[..start_key_len], key_out, callback) {
+                                    return;
+                                }
+                            }
+                        }
                         if let Some(p) = parent {
-                            let fence_data = p.fences();
-                            let count = p.key_count();
-                            let upper = if index < count {
-                                let upper_len = p.get_key(index, &mut get_key_buffer, 0).unwrap();
-                                trailing_bytes(&get_key_buffer, upper_len)
+                            if let Some(len) = next_leaf_start_asc(p, index, &mut start_key_buffer) {
+                                start_key_len = len;
                             } else {
-                                fence_data.upper_fence.to_stripped(fence_data.prefix_len).0
-                            };
-                            if upper.is_empty() {
                                 return;
                             }
-                            start_key_buffer[fence_data.prefix_len..][..upper.len()].copy_from_slice(upper);
-                            start_key_buffer[fence_data.prefix_len + upper.len()] = 0;
-                            start_key_len = fence_data.prefix_len + upper.len() + 1;
                         } else {
                             return;
                         }
@@ -183,9 +771,8 @@ impl BTree {
         }
     }
 
-    pub fn range_lookup_desc(&mut self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
+    fn range_lookup_desc_stored(&mut self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
         count_op();
-        let mut get_key_buffer = [0u8; PAGE_SIZE / 4];
         let mut start_key_buffer = [0u8; PAGE_SIZE / 4];
         start_key_buffer[..initial_start.len()].copy_from_slice(initial_start);
         let mut start_key_len = initial_start.len();
@@ -208,20 +795,28 @@ impl BTree {
                         if !node.to_leaf_mut().range_lookup_desc(&start_key_buffer[..start_key_len], key_out, callback) {
                             return;
                         }
+                        if LEAF_LINKS {
+                            // walk the leaf list instead of descending again
+                            let mut leaf: *mut BTreeNode = node;
+                            loop {
+                                let prev = BTreeNode::leaf_links(leaf).prev;
+                                if prev.is_null() {
+                                    return;
+                                }
+                                start_key_len = leaf_start_before(&*leaf, &mut start_key_buffer);
+                                leaf = prev;
+                                (*leaf).leave_notify_range_op();
+                                if !(*leaf).to_leaf_mut().range_lookup_desc(&start_key_buffer[..start_key_len], key_out, callback) {
+                                    return;
+                                }
+                            }
+                        }
                         if let Some(p) = parent {
-                            let fence_data = p.fences();
-                            let count = p.key_count();
-                            let lower = if index > 0 {
-                                let upper_len = p.get_key(index - 1, &mut get_key_buffer, 0).unwrap();
-                                trailing_bytes(&get_key_buffer, upper_len)
+                            if let Some(len) = next_leaf_start_desc(p, index, &mut start_key_buffer) {
+                                start_key_len = len;
                             } else {
-                                fence_data.lower_fence.to_stripped(fence_data.prefix_len).0
-                            };
-                            if lower.is_empty() {
                                 return;
                             }
-                            start_key_buffer[fence_data.prefix_len..][..lower.len()].copy_from_slice(lower);
-                            start_key_len = fence_data.prefix_len + lower.len();
                         } else {
                             return;
                         }
@@ -232,3 +827,95 @@ impl BTree {
         }
     }
 }
+
+/// writes the smallest key of the leaf following child `index` of `parent` to `start_key_buffer`.
+/// `start_key_buffer` must already start with the prefix of `parent`.
+/// returns the length of the new start key or None if there is no next leaf.
+pub fn next_leaf_start_asc(parent: &dyn InnerNode, index: usize, start_key_buffer: &mut [u8; PAGE_SIZE / 4]) -> Option<usize> {
+    let mut get_key_buffer = [0u8; PAGE_SIZE / 4];
+    let fence_data = parent.fences();
+    let upper = if index < parent.key_count() {
+        let upper_len = parent.get_key(index, &mut get_key_buffer, 0).unwrap();
+        trailing_bytes(&get_key_buffer, upper_len)
+    } else {
+        fence_data.upper_fence.to_stripped(fence_data.prefix_len).0
+    };
+    if upper.is_empty() {
+        return None;
+    }
+    start_key_buffer[fence_data.prefix_len..][..upper.len()].copy_from_slice(upper);
+    start_key_buffer[fence_data.prefix_len + upper.len()] = 0;
+    Some(fence_data.prefix_len + upper.len() + 1)
+}
+
+/// like `next_leaf_start_asc`, but writes the largest key of the preceding leaf.
+pub fn next_leaf_start_desc(parent: &dyn InnerNode, index: usize, start_key_buffer: &mut [u8; PAGE_SIZE / 4]) -> Option<usize> {
+    let mut get_key_buffer = [0u8; PAGE_SIZE / 4];
+    let fence_data = parent.fences();
+    let lower = if index > 0 {
+        let lower_len = parent.get_key(index - 1, &mut get_key_buffer, 0).unwrap();
+        trailing_bytes(&get_key_buffer, lower_len)
+    } else {
+        fence_data.lower_fence.to_stripped(fence_data.prefix_len).0
+    };
+    if lower.is_empty() {
+        return None;
+    }
+    start_key_buffer[fence_data.prefix_len..][..lower.len()].copy_from_slice(lower);
+    Some(fence_data.prefix_len + lower.len())
+}
+
+/// restricts the bounds of a range to a node with the full length fences lower and upper.
+/// bounds that do not limit the keys of the node become None.
+fn restrict_range<'a>(lo: Option<&'a [u8]>, hi: Option<&'a [u8]>, lower: &[u8], upper: &[u8]) -> (Option<&'a [u8]>, Option<&'a [u8]>) {
+    (
+        lo.filter(|&lo| lo > lower),
+        hi.filter(|&hi| upper.is_empty() || hi <= upper),
+    )
+}
+
+/// art inner nodes do not store subtree counts
+fn assert_counts_supported(layout: NodeLayout) {
+    assert!(!SUBTREE_COUNTS || layout.inner != InnerLayout::Art, "subtree counts do not support art inner nodes");
+}
+
+/// allocates a chain of `height` inner nodes with a single child ending in an empty leaf, all bounded by the full length fences
+unsafe fn empty_subtree(layout: NodeLayout, height: usize, lower: &[u8], upper: &[u8]) -> *mut BTreeNode {
+    let node = if height == 0 { BTreeNode::alloc(layout) } else { BTreeNode::alloc_inner(layout) };
+    if height == 0 {
+        (*node).init_leaf(layout.leaf, lower, upper);
+    } else {
+        let child = empty_subtree(layout, height - 1, lower, upper);
+        let mut tmp = BTreeNode::new_uninit();
+        layout.inner.create(&mut tmp, &LevelSlice::with_fences(&[child], &[], lower, upper)).unwrap();
+        ptr::copy_nonoverlapping(&tmp, node, 1);
+    }
+    node
+}
+
+/// leftmost or rightmost leaf of the subtree of node
+unsafe fn edge_leaf(mut node: *mut BTreeNode, rightmost: bool) -> *mut BTreeNode {
+    while (*node).tag().is_inner() {
+        let inner = (*node).to_inner();
+        node = inner.get_child(if rightmost { inner.key_count() } else { 0 });
+    }
+    node
+}
+
+/// writes the smallest key that may be stored in the leaf following `leaf` to `start_key_buffer`.
+/// `start_key_buffer` must already start with the prefix of `leaf`.
+pub fn leaf_start_after(leaf: &BTreeNode, start_key_buffer: &mut [u8; PAGE_SIZE / 4]) -> usize {
+    let fence_data = leaf.leaf_fences();
+    let upper = fence_data.upper_fence.to_stripped(fence_data.prefix_len).0;
+    start_key_buffer[fence_data.prefix_len..][..upper.len()].copy_from_slice(upper);
+    start_key_buffer[fence_data.prefix_len + upper.len()] = 0;
+    fence_data.prefix_len + upper.len() + 1
+}
+
+/// like `leaf_start_after`, but writes the largest key of the leaf preceding `leaf`.
+fn leaf_start_before(leaf: &BTreeNode, start_key_buffer: &mut [u8; PAGE_SIZE / 4]) -> usize {
+    let fence_data = leaf.leaf_fences();
+    let lower = fence_data.lower_fence.to_stripped(fence_data.prefix_len).0;
+    start_key_buffer[fence_data.prefix_len..][..lower.len()].copy_from_slice(lower);
+    fence_data.prefix_len + lower.len()
+}
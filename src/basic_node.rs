@@ -1,8 +1,8 @@
-use crate::btree_node::{AdaptionState, BASIC_PREFIX, BTreeNode, BTreeNodeHead, PAGE_SIZE};
-use crate::find_separator::find_separator;
+use crate::btree_node::{AdaptionState, BASIC_PREFIX, BTreeNode, BTreeNodeHead, PAGE_SIZE, SUBTREE_COUNTS};
+use crate::find_separator::{find_leaf_separator, find_separator};
 
 use crate::node_traits::{FenceData, FenceRef, InnerConversionSink, InnerConversionSource, InnerNode, LeafNode, merge, Node, SeparableInnerConversionSource, split_in_place};
-use crate::util::{common_prefix_len, get_key_from_slice, head, MergeFences, partial_restore, reinterpret_mut, short_slice, SmallBuff, SplitFences, trailing_bytes};
+use crate::util::{common_prefix_len, entry_lengths, get_key_from_slice, head, MergeFences, partial_restore, reinterpret_mut, short_slice, SmallBuff, SplitFences, trailing_bytes};
 use crate::{FatTruncatedKey, PrefixTruncatedKey};
 use std::mem::{size_of, transmute};
 
@@ -47,6 +47,17 @@ pub struct FenceKeySlot {
 pub const HINT_COUNT: usize = 16;
 const DYNAMIC_PREFIX: bool = cfg!(feature = "dynamic-prefix_true");
 
+/// inner slots store the child pointer, followed by the entry count of its subtree if SUBTREE_COUNTS is set
+pub const INNER_VALUE_LEN: usize = size_of::<*mut BTreeNode>() + if SUBTREE_COUNTS { size_of::<u64>() } else { 0 };
+
+/// the first INNER_VALUE_LEN bytes are the value of an inner slot
+pub fn inner_value(child: *mut BTreeNode, count: u64) -> [u8; 16] {
+    let mut value = [0u8; 16];
+    value[..8].copy_from_slice(&(child as usize).to_ne_bytes());
+    value[8..].copy_from_slice(&count.to_ne_bytes());
+    value
+}
+
 #[derive(Clone, Copy, Debug)]
 #[repr(C)]
 pub struct BasicNodeHead {
@@ -56,6 +67,8 @@ pub struct BasicNodeHead {
     pub space_used: u16,
     pub data_offset: u16,
     pub upper: *mut BTreeNode,
+    #[cfg(feature = "subtree-counts_true")]
+    pub upper_count: u64,
     pub lower_fence: FenceKeySlot,
     pub upper_fence: FenceKeySlot,
     pub prefix_len: u16,
@@ -91,6 +104,8 @@ impl BasicNode {
                     adaption_state: AdaptionState::new(),
                 },
                 upper: ptr::null_mut(),
+                #[cfg(feature = "subtree-counts_true")]
+                upper_count: 0,
                 lower_fence: FenceKeySlot { offset: 0, len: 0 },
                 upper_fence: FenceKeySlot { offset: 0, len: 0 },
                 count: 0,
@@ -273,6 +288,11 @@ impl BasicNode {
             - self.slots().len() * size_of::<BasicSlot>()
     }
 
+    /// entry count, total stored key length, and total payload length
+    pub fn entry_lengths(&self) -> (usize, usize, usize) {
+        entry_lengths(self.slots().iter().map(|s| (s.key_len, s.val_len)))
+    }
+
     pub fn request_space(&mut self, space: usize) -> Result<usize, ()> {
         if space <= self.free_space() {
             Ok(self.head.prefix_len as usize)
@@ -291,6 +311,10 @@ impl BasicNode {
         tmp.set_fences(self.fences());
         self.copy_key_value_range(self.slots(), &mut tmp, FatTruncatedKey::full(&[]));
         tmp.head.upper = self.head.upper;
+        #[cfg(feature = "subtree-counts_true")]
+        {
+            tmp.head.upper_count = self.head.upper_count;
+        }
         *self = tmp;
         self.make_hint();
         debug_assert!(self.free_space() == should);
@@ -578,6 +602,20 @@ impl InnerConversionSource for BasicNode {
         }
     }
 
+    fn get_child_count(&self, index: usize) -> u64 {
+        debug_assert!(index <= self.head.count as usize);
+        #[cfg(feature = "subtree-counts_true")]
+        if index == self.head.count as usize {
+            return self.head.upper_count;
+        }
+        if SUBTREE_COUNTS {
+            let value = self.slots()[index].value(self.as_bytes());
+            u64::from_ne_bytes(value[8..16].try_into().unwrap())
+        } else {
+            0
+        }
+    }
+
     fn get_key(&self, index: usize, dst: &mut [u8], strip_prefix: usize) -> Result<usize, ()> {
         get_key_from_slice(self.slots()[index].key(self.as_bytes()), dst, strip_prefix)
     }
@@ -599,22 +637,24 @@ unsafe impl Node for BasicNode {
         key_in_node: &[u8],
     ) -> Result<(), ()> {
         if self.head.head.tag.is_inner() {
-            type Dst = crate::btree_node::DefaultInnerNodeConversionSink;
-            return split_in_place::<BasicNode, Dst, Dst>(
+            let layout = unsafe { BTreeNode::layout(self as *const Self as *const BTreeNode) };
+            return crate::with_inner_sink!(layout.inner, Dst => split_in_place::<BasicNode, Dst, Dst>(
                 unsafe { reinterpret_mut(self) },
                 parent,
                 index_in_parent,
                 key_in_node,
-            );
+            ));
         }
 
         // split
-        let (sep_slot, truncated_sep_key) = self.find_separator();
+        let count = self.head.count as usize;
+        let append = &key_in_node[self.head.prefix_len as usize..] > self.slots()[count - 1].key(self.as_bytes()).0;
+        let (sep_slot, truncated_sep_key) = find_leaf_separator(count, append, |i: usize| self.slots()[i].key(self.as_bytes()));
         let full_sep_key_len = truncated_sep_key.0.len() + self.head.prefix_len as usize;
         let parent_prefix_len = parent.request_space_for_child(full_sep_key_len)?;
         let node_left_raw;
         let node_left = unsafe {
-            node_left_raw = BTreeNode::alloc();
+            node_left_raw = BTreeNode::alloc(BTreeNode::layout(self as *const Self as *const BTreeNode));
             (*node_left_raw).basic = Self::new(self.head.head.tag.is_leaf());
             &mut (*node_left_raw).basic
         };
@@ -630,6 +670,7 @@ unsafe impl Node for BasicNode {
                 BTreeNode::dealloc(node_left_raw);
                 return Err(());
             }
+            BTreeNode::link_leaf_before(node_left_raw, self as *mut Self as *mut BTreeNode);
         }
 
         self.copy_key_value_range(
@@ -704,13 +745,14 @@ unsafe impl InnerConversionSink for BasicNode {
             for i in 0..key_count {
                 let dynamic_prefix_len = this.head.dynamic_prefix_len as usize;
                 let bytes = this.as_bytes_mut();
-                let child_bytes = (src.get_child(i) as usize).to_ne_bytes();
+                let count = if SUBTREE_COUNTS { src.get_child_count(i) } else { 0 };
+                let value = inner_value(src.get_child(i), count);
                 let val_len = get_key_from_slice(
-                    PrefixTruncatedKey(child_bytes.as_slice()),
+                    PrefixTruncatedKey(&value[..INNER_VALUE_LEN]),
                     &mut bytes[min_offset..offset],
                     0,
                 )?;
-                debug_assert_eq!(val_len, 8);
+                debug_assert_eq!(val_len, INNER_VALUE_LEN);
                 offset -= val_len;
                 let key_len = src.get_key(i, &mut bytes[min_offset..offset], 0)?;
                 offset -= key_len;
@@ -727,6 +769,9 @@ unsafe impl InnerConversionSink for BasicNode {
         }
         this.head.space_used += this.head.data_offset - offset as u16;
         this.head.data_offset = offset as u16;
+        if SUBTREE_COUNTS {
+            this.set_child_count(key_count, src.get_child_count(key_count));
+        }
         this.make_hint();
         this.validate();
         Ok(())
@@ -792,15 +837,30 @@ impl InnerNode for BasicNode {
                 self.change_dynamic_prefix(0);
             }
         }
-        self.raw_insert(index, key, &(child as usize).to_ne_bytes());
+        self.raw_insert(index, key, &inner_value(child, 0)[..INNER_VALUE_LEN]);
         Ok(())
     }
 
     fn request_space_for_child(&mut self, key_length: usize) -> Result<usize, ()> {
-        self.request_space(self.space_needed(key_length, size_of::<*mut BTreeNode>())
+        self.request_space(self.space_needed(key_length, INNER_VALUE_LEN)
         )
     }
 
+    fn set_child_count(&mut self, index: usize, count: u64) {
+        debug_assert!(index <= self.head.count as usize);
+        #[cfg(feature = "subtree-counts_true")]
+        if index == self.head.count as usize {
+            self.head.upper_count = count;
+            return;
+        }
+        if SUBTREE_COUNTS {
+            let slot = self.slots()[index];
+            unsafe {
+                self.as_bytes_mut()[(slot.offset + slot.key_len) as usize + 8..][..8].copy_from_slice(&count.to_ne_bytes());
+            }
+        }
+    }
+
     fn find_child_index(&mut self, key: &[u8], bc: &mut BranchCacheAccessor) -> usize {
         #[cfg(feature = "basic-heads_true")]
         self.maybe_grow_dynamic_prefix();
@@ -876,8 +936,10 @@ unsafe impl LeafNode for BasicNode {
     unsafe fn range_lookup_desc(&mut self, start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) -> bool {
         debug_assert!(!key_out.is_null());
         key_out.copy_from_nonoverlapping(start.as_ptr(), self.head.prefix_len as usize);
-        let start_index = self.lower_bound(self.truncate(start)).0.min(self.key_count() - 1);
-        for s in self.slots()[..=start_index].iter().rev() {
+        // largest key less than or equal to start
+        let (lower_bound, found) = self.lower_bound(self.truncate(start));
+        let end_index = if found { lower_bound + 1 } else { lower_bound };
+        for s in self.slots()[..end_index].iter().rev() {
             let k = s.key(self.as_bytes());
             key_out.offset(self.head.prefix_len as isize).copy_from_nonoverlapping(k.0.as_ptr(), k.0.len());
             if !callback((s.key_len + self.head.prefix_len) as usize, s.value(self.as_bytes())) {
@@ -3,7 +3,6 @@ use std::hint::black_box;
 use std::io::BufRead;
 use std::process::Command;
 use std::ptr;
-use std::sync::atomic::Ordering;
 use bumpalo::Bump;
 use rand::{RngCore, SeedableRng};
 use rand::distributions::{WeightedIndex};
@@ -52,12 +51,40 @@ enum Op {
     Insert,
     Remove,
     Range,
+    RangeDesc,
+    HitBatch,
+}
+
+/// four buckets per power of two
+const HISTOGRAM_BUCKETS: usize = 256;
+
+fn histogram_bucket(sample: u64) -> usize {
+    if sample < 4 {
+        sample as usize
+    } else {
+        let log = 63 - sample.leading_zeros() as usize;
+        log * 4 - 4 + ((sample >> (log - 2)) & 3) as usize
+    }
+}
+
+fn histogram_bucket_start(bucket: usize) -> u64 {
+    if bucket < 4 {
+        bucket as u64
+    } else {
+        (4 + bucket as u64 % 4) << (bucket / 4 - 1)
+    }
 }
 
-#[derive(Default)]
 struct StatAggregator {
-    sum: u64,
+    /// all ops, including those that were not timed
     count: u64,
+    sampled_count: u64,
+    sum: u64,
+    max: u64,
+    histogram: Box<[u64; HISTOGRAM_BUCKETS]>,
+    /// only one in `sample_interval` calls is timed
+    sample_interval: u64,
+    calls: u64,
 }
 
 struct Perf {
@@ -66,15 +93,19 @@ struct Perf {
 
 impl Perf {
     fn new() -> Self {
+        Self::try_new().unwrap()
+    }
+
+    fn try_new() -> std::io::Result<Self> {
         let mut counters = Vec::new();
-        counters.push(("task_clock", perf_event::Builder::new().kind(Software::TASK_CLOCK).build().unwrap()));
-        counters.push(("cycles", perf_event::Builder::new().kind(Hardware::CPU_CYCLES).build().unwrap()));
-        counters.push(("instructions", perf_event::Builder::new().kind(Hardware::INSTRUCTIONS).build().unwrap()));
-        counters.push(("l1d_misses", perf_event::Builder::new().kind(Cache { which: WhichCache::L1D, operation: CacheOp::READ, result: CacheResult::MISS }).build().unwrap()));
-        counters.push(("l1i_misses", perf_event::Builder::new().kind(Cache { which: WhichCache::L1I, operation: CacheOp::READ, result: CacheResult::MISS }).build().unwrap()));
-        counters.push(("ll_misses", perf_event::Builder::new().kind(Hardware::CACHE_MISSES).build().unwrap()));
-        counters.push(("branch_misses", perf_event::Builder::new().kind(Hardware::BRANCH_MISSES).build().unwrap()));
-        Self { counters }
+        counters.push(("task_clock", perf_event::Builder::new().kind(Software::TASK_CLOCK).build()?));
+        counters.push(("cycles", perf_event::Builder::new().kind(Hardware::CPU_CYCLES).build()?));
+        counters.push(("instructions", perf_event::Builder::new().kind(Hardware::INSTRUCTIONS).build()?));
+        counters.push(("l1d_misses", perf_event::Builder::new().kind(Cache { which: WhichCache::L1D, operation: CacheOp::READ, result: CacheResult::MISS }).build()?));
+        counters.push(("l1i_misses", perf_event::Builder::new().kind(Cache { which: WhichCache::L1I, operation: CacheOp::READ, result: CacheResult::MISS }).build()?));
+        counters.push(("ll_misses", perf_event::Builder::new().kind(Hardware::CACHE_MISSES).build()?));
+        counters.push(("branch_misses", perf_event::Builder::new().kind(Hardware::BRANCH_MISSES).build()?));
+        Ok(Self { counters })
     }
 
     fn read_counter(c: &mut Counter) -> f64 {
@@ -85,21 +116,92 @@ impl Perf {
     fn to_json(&mut self) -> serde_json::Value {
         serde_json::Value::Object(self.counters.iter_mut().map(|(n, c)| (n.to_string(), Self::read_counter(c).into())).collect())
     }
+
+    fn read_all(&mut self, dst: &mut [f64]) {
+        for (d, (_, c)) in dst.iter_mut().zip(self.counters.iter_mut()) {
+            *d = Self::read_counter(c);
+        }
+    }
 }
 
 impl StatAggregator {
-    fn submit(&mut self, sample: u64) {
-        self.sum += sample;
-        self.count += 1;
+    fn new(sample_interval: u64) -> Self {
+        assert!(sample_interval > 0);
+        StatAggregator {
+            count: 0,
+            sampled_count: 0,
+            sum: 0,
+            max: 0,
+            histogram: Box::new([0; HISTOGRAM_BUCKETS]),
+            sample_interval,
+            calls: 0,
+        }
+    }
+
+    /// records `count` ops taking `time` nanoseconds each
+    fn submit(&mut self, time: u64, count: u64) {
+        self.sum += time * count;
+        self.sampled_count += count;
+        self.max = self.max.max(time);
+        self.histogram[histogram_bucket(time)] += count;
+    }
+
+    fn should_sample(&mut self) -> bool {
+        self.calls += 1;
+        self.calls % self.sample_interval == 0
     }
 
     fn time_fn<R>(&mut self, f: impl FnOnce() -> R) -> R {
+        self.time_fn_batch(1, f)
+    }
+
+    /// records the time of `f` as `count` samples
+    fn time_fn_batch<R>(&mut self, count: usize, f: impl FnOnce() -> R) -> R {
+        self.count += count as u64;
+        if !self.should_sample() {
+            return f();
+        }
         let t1 = minstant::Instant::now();
         let r = f();
         let t2 = minstant::Instant::now();
-        self.submit(t2.duration_since(t1).as_nanos() as u64);
+        self.submit(t2.duration_since(t1).as_nanos() as u64 / count as u64, count as u64);
         r
     }
+
+    fn merge(&mut self, other: &Self) {
+        self.count += other.count;
+        self.sampled_count += other.sampled_count;
+        self.sum += other.sum;
+        self.max = self.max.max(other.max);
+        for (a, b) in self.histogram.iter_mut().zip(other.histogram.iter()) {
+            *a += b;
+        }
+    }
+
+    /// upper bound of the bucket containing the given quantile
+    fn quantile(&self, q: f64) -> u64 {
+        let rank = (self.sampled_count as f64 * q).ceil().max(1.0) as u64;
+        let mut seen = 0;
+        for (bucket, &c) in self.histogram.iter().enumerate() {
+            seen += c;
+            if seen >= rank {
+                return (histogram_bucket_start(bucket + 1) - 1).min(self.max);
+            }
+        }
+        self.max
+    }
+
+    fn to_json(&self) -> serde_json::Value {
+        json!({
+            "op_count": self.count,
+            "time": self.sum as f64 / self.sampled_count as f64,
+            "p50": self.quantile(0.5),
+            "p90": self.quantile(0.9),
+            "p99": self.quantile(0.99),
+            "p999": self.quantile(0.999),
+            "max_time": self.max,
+        })
+    }
 }
 
 struct Bench {
@@ -109,6 +211,7 @@ struct Bench {
     initial_size: usize,
     value_length: usize,
     range_length: usize,
+    batch_length: usize,
     zipf_exponent: f64,
     inserted_start: usize,
     inserted_count: usize,
@@ -127,7 +230,9 @@ impl Bench {
         initial_size: usize,
         value_length: usize,
         range_length: usize,
+        batch_length: usize,
         zipf_exponent: f64,
+        sample_interval: u64,
         mut data: Vec<Vec<u8>>,
     ) -> Self {
         let mut rng = Xoshiro128PlusPlus::seed_from_u64(123);
@@ -142,12 +247,13 @@ impl Bench {
         }
         unsafe { btree_print_info(&mut tree) };
         Bench {
-            stats: Default::default(),
+            stats: std::array::from_fn(|_| StatAggregator::new(sample_interval)),
             sample_op,
             instruction_buffer: Vec::new(),
             initial_size,
             value_length,
             range_length,
+            batch_length,
             zipf_exponent,
             inserted_start: 0,
             inserted_count: initial_size,
@@ -172,6 +278,10 @@ impl Bench {
         Zipf::new(n as u64, self.zipf_exponent).unwrap().sample(&mut self.rng) as usize - 1
     }
 
+    fn hit_index(&mut self) -> usize {
+        (self.inserted_start + self.inserted_count - 1 - self.zipf_sample(self.inserted_count)) % self.data.len()
+    }
+
     fn op_from_usize(n: usize) -> Op {
         let op_enum = enum_iterator::all::<Op>().nth(n).unwrap();
         assert!(op_enum as usize == n);
@@ -190,6 +300,26 @@ impl Bench {
             let len = u16::from_ne_bytes(*len_bytes) as usize;
             let key = &self.instruction_buffer[i + 3..][..len];
             i += len + 3;
+            if let Op::HitBatch = op {
+                // the first key is followed by batch_length - 1 more keys
+                let mut keys = Vec::with_capacity(self.batch_length);
+                keys.push(key);
+                for _ in 1..self.batch_length {
+                    let len_bytes: &[u8; 2] = self.instruction_buffer[i..][..2].try_into().unwrap();
+                    let len = u16::from_ne_bytes(*len_bytes) as usize;
+                    keys.push(&self.instruction_buffer[i + 2..][..len]);
+                    i += len + 2;
+                }
+                let mut payloads = vec![ptr::null_mut(); keys.len()];
+                let mut payload_lens = vec![0; keys.len()];
+                unsafe {
+                    self.stats[op as usize].time_fn_batch(keys.len(), ||
+                        black_box(self.tree.lookup_batch(black_box(&keys), &mut payloads, &mut payload_lens))
+                    );
+                }
+                debug_assert!(payloads.iter().all(|p| !p.is_null()));
+                continue;
+            }
             match op {
                 Op::Hit => {
                     let mut out = 0;
@@ -210,8 +340,16 @@ impl Bench {
                     debug_assert!(found.is_null());
                 }
                 Op::Update => {
+                    let payload = &self.payload;
                     self.stats[op as usize].time_fn(||
-                        black_box(self.tree.insert(black_box(key), black_box(&self.payload)))
+                        black_box(self.tree.upsert(black_box(key), black_box(payload), |old| {
+                            if old.len() == payload.len() {
+                                old.copy_from_slice(payload);
+                                None
+                            } else {
+                                Some(payload)
+                            }
+                        }))
                     );
                 }
                 Op::Insert => {
@@ -251,6 +389,25 @@ impl Bench {
                         assert!(count == expected.len());
                     }
                 }
+                Op::RangeDesc => {
+                    #[cfg(debug_assertions)]
+                        let expected: Vec<&Vec<u8>> = self.std_set.range(..=key.to_owned()).rev().take(self.range_length).collect();
+                    let mut count = 0;
+                    self.stats[op as usize].time_fn(||
+                        black_box(
+                            self.tree.range_lookup_desc(&key, range_lookup_key_out.as_mut_ptr(), &mut |key_len, _value| {
+                                #[cfg(debug_assertions)]{
+                                    assert!(expected[count] == &range_lookup_key_out[..key_len])
+                                }
+                                count += 1;
+                                count < self.range_length
+                            })
+                        ));
+                    #[cfg(debug_assertions)]{
+                        assert!(count == expected.len());
+                    }
+                }
+                Op::HitBatch => unreachable!(),
             }
         }
         for c in &mut self.perf.counters {
@@ -263,8 +420,17 @@ impl Bench {
     fn run(mut self, op_count: usize) -> ([StatAggregator; Op::CARDINALITY], Perf) {
         for _ in 0..op_count {
             let op = self.sample_op.sample(&mut self.rng);
+            if let Op::HitBatch = Self::op_from_usize(op) {
+                self.instruction_buffer.push(op as u8);
+                for _ in 0..self.batch_length {
+                    let index = self.hit_index();
+                    self.instruction_buffer.extend_from_slice(&(self.data[index].len() as u16).to_ne_bytes());
+                    self.instruction_buffer.extend_from_slice(&self.data[index]);
+                }
+                continue;
+            }
             let index = match Self::op_from_usize(op) {
-                Op::Hit | Op::Update | Op::Range => (self.inserted_start + self.inserted_count - 1 - self.zipf_sample(self.inserted_count)) % self.data.len(),
+                Op::Hit | Op::Update | Op::Range | Op::RangeDesc => self.hit_index(),
                 Op::Miss => (self.inserted_start + self.inserted_count + self.zipf_sample(self.data.len() - self.inserted_count)) % self.data.len(),
                 Op::Insert => {
                     let index = (self.inserted_start + self.inserted_count) % self.data.len();
@@ -277,6 +443,7 @@ impl Bench {
                     self.inserted_start = (self.inserted_start + 1) % self.data.len();
                     index
                 }
+                Op::HitBatch => unreachable!(),
             };
             self.instruction_buffer.push(op as u8);
             self.instruction_buffer.extend_from_slice(&(self.data[index].len() as u16).to_ne_bytes());
@@ -316,13 +483,18 @@ pub fn bench_main() {
     let value_len: usize = std::env::var("VALUE_LEN").as_deref().unwrap_or("8").parse().unwrap();
     let range_len: usize = std::env::var("RANGE_LEN").as_deref().unwrap_or("10").parse().unwrap();
     let zipf_exponent: f64 = std::env::var("ZIPF_EXPONENT").as_deref().unwrap_or("0.15").parse().unwrap();
-    let op_rates: Vec<usize> = serde_json::from_str(std::env::var("OP_RATES").as_deref().unwrap_or("[40,40,5,5,5,5]")).unwrap();
-    assert!(op_rates.len() == 6);
+    let batch_len: usize = std::env::var("BATCH_LEN").as_deref().unwrap_or("16").parse().unwrap();
+    let sample_interval: u64 = std::env::var("SAMPLE_INTERVAL").as_deref().unwrap_or("1").parse().unwrap();
+    let mut op_rates: Vec<usize> = serde_json::from_str(std::env::var("OP_RATES").as_deref().unwrap_or("[40,40,5,5,5,5,0,0]")).unwrap();
+    // rates for ops added later default to zero
+    assert!(op_rates.len() >= 6 && op_rates.len() <= Op::CARDINALITY);
+    op_rates.resize(Op::CARDINALITY, 0);
+    assert!(batch_len > 0);
     let sample_op = WeightedIndex::new(op_rates.clone()).unwrap();
 
     let initial_size = if std::env::var("START_EMPTY").as_deref().unwrap_or("0") == "1" { 0 } else { keys.len() / 2 };
 
-    let (stats, mut perf) = Bench::init(sample_op, initial_size, value_len, range_len, zipf_exponent, keys).run(total_count);
+    let (stats, mut perf) = Bench::init(sample_op, initial_size, value_len, range_len, batch_len, zipf_exponent, sample_interval, keys).run(total_count);
     let mem_info = mem_info();
     let build_info = build_info().into();
     let common_info = json!({
@@ -330,6 +502,8 @@ pub fn bench_main() {
         "total_count":total_count,
         "value_len":value_len,
         "range_len":range_len,
+        "batch_len":batch_len,
+        "sample_interval":sample_interval,
         "zipf_exponent":zipf_exponent,
         "op_rates":op_rates,
         "host": host_name(),
@@ -337,14 +511,10 @@ pub fn bench_main() {
     });
     for op in enum_iterator::all::<Op>() {
         let stat = &stats[op as usize];
-        let op_count = stat.count;
-        let average_time = stat.sum as f64 / stat.count as f64;
         let op_info = json!({
             "op": format!("{op:?}"),
-            "op_count": op_count,
-            "time": average_time,
         });
-        print_joint_objects(&[&build_info, &common_info, &op_info]);
+        print_joint_objects(&[&build_info, &common_info, &op_info, &stat.to_json()]);
     }
     let perf_info = perf.to_json();
     print_joint_objects(&[&build_info, &common_info, &perf_info, &mem_info]);
@@ -356,15 +526,156 @@ pub fn print_tpcc_result(time: f64, tx_count: u64, warehouses: u64) {
         "host": host_name(),
         "run_start":  std::time::SystemTime::now(),
         "warehouse_count":warehouses,
+        "node_backing": crate::node_pool::backing(),
         "tx_count": tx_count,
         "time": time,
     });
     print_joint_objects(&[&build_info().into(), &tpcc, &mem_info]);
 }
 
+/// transaction types in the order of the codes returned by `TPCCWorkload::tx`
+const TPCC_TX_NAMES: [&str; 5] = ["payment", "order_status", "delivery", "stock_level", "new_order"];
+
+/// latency and hardware counters of the TPC-C transactions run by one thread.
+/// one in `sample_interval` transactions is measured.
+pub struct TxRecorder {
+    stats: Vec<StatAggregator>,
+    /// counters of the calling thread, absent if disabled
+    perf: Option<Perf>,
+    /// per transaction type, counter totals of sampled transactions
+    perf_totals: Vec<Vec<f64>>,
+    sampling: bool,
+    start_time: minstant::Instant,
+    start_counts: Vec<f64>,
+}
+
+impl TxRecorder {
+    /// must be called on the thread that runs the transactions
+    pub fn new(sample_interval: u64, hardware_counters: bool) -> Self {
+        let enabled_perf = || -> std::io::Result<Perf> {
+            let mut perf = Perf::try_new()?;
+            for c in &mut perf.counters {
+                c.1.enable()?;
+            }
+            Ok(perf)
+        };
+        // records latency only if the counters are unavailable, e.g. due to perf_event_paranoid
+        let perf = match hardware_counters.then(enabled_perf) {
+            Some(Err(e)) => {
+                eprintln!("hardware counters unavailable: {}", e);
+                None
+            }
+            perf => perf.and_then(Result::ok),
+        };
+        let counter_count = perf.as_ref().map_or(0, |p| p.counters.len());
+        TxRecorder {
+            stats: TPCC_TX_NAMES.iter().map(|_| StatAggregator::new(sample_interval)).collect(),
+            perf,
+            perf_totals: vec![vec![0.0; counter_count]; TPCC_TX_NAMES.len()],
+            sampling: false,
+            start_time: minstant::Instant::now(),
+            start_counts: vec![0.0; counter_count],
+        }
+    }
+
+    pub fn begin(&mut self) {
+        // the type is only known afterwards, so sampling is decided by the first aggregator for all types
+        self.sampling = self.stats[0].should_sample();
+        if self.sampling {
+            if let Some(perf) = &mut self.perf {
+                perf.read_all(&mut self.start_counts);
+            }
+            self.start_time = minstant::Instant::now();
+        }
+    }
+
+    pub fn end(&mut self, tx_type: usize) {
+        let stat = &mut self.stats[tx_type];
+        stat.count += 1;
+        if !self.sampling {
+            return;
+        }
+        let time = minstant::Instant::now().duration_since(self.start_time).as_nanos() as u64;
+        stat.submit(time, 1);
+        if let Some(perf) = &mut self.perf {
+            let totals = &mut self.perf_totals[tx_type];
+            for ((total, start), (_, c)) in totals.iter_mut().zip(&self.start_counts).zip(perf.counters.iter_mut()) {
+                *total += Perf::read_counter(c) - start;
+            }
+        }
+    }
+}
+
+/// prints one line per transaction type, counters are averages over sampled transactions
+pub fn print_tpcc_tx_stats(recorders: &[&TxRecorder], run_time: f64, load_time: f64, warehouses: u64) {
+    let build_info = build_info().into();
+    let common_info = json!({
+        "host": host_name(),
+        "run_start":  std::time::SystemTime::now(),
+        "warehouse_count": warehouses,
+        "threads": recorders.len(),
+        "run_time": run_time,
+        "load_time": load_time,
+        "sample_interval": recorders.first().map_or(1, |r| r.stats[0].sample_interval),
+    });
+    for (tx_type, name) in TPCC_TX_NAMES.iter().enumerate() {
+        let mut stat = StatAggregator::new(1);
+        let mut perf_totals: Vec<f64> = Vec::new();
+        let mut counter_names = Vec::new();
+        for r in recorders {
+            stat.merge(&r.stats[tx_type]);
+            if let Some(perf) = &r.perf {
+                perf_totals.resize(r.perf_totals[tx_type].len(), 0.0);
+                counter_names = perf.counters.iter().map(|c| c.0).collect();
+                for (a, b) in perf_totals.iter_mut().zip(&r.perf_totals[tx_type]) {
+                    *a += b;
+                }
+            }
+        }
+        let tx_info = json!({
+            "op": name,
+        });
+        let perf_info = serde_json::Value::Object(counter_names.iter().zip(&perf_totals)
+            .map(|(n, t)| (n.to_string(), (t / stat.sampled_count as f64).into())).collect());
+        print_joint_objects(&[&build_info, &common_info, &tx_info, &stat.to_json(), &perf_info]);
+    }
+}
+
+pub fn print_ycsb_result(time: f64, op_count: u64, record_count: u64, workload: u8, threads: u64) {
+    let mem_info = mem_info();
+    let ycsb = json!({
+        "host": host_name(),
+        "run_start":  std::time::SystemTime::now(),
+        "ycsb_workload": (workload as char).to_string(),
+        "record_count": record_count,
+        "threads": threads,
+        "op_count": op_count,
+        "time": time,
+    });
+    print_joint_objects(&[&build_info().into(), &ycsb, &mem_info]);
+}
+
+/// zipf distributed ranks in `0..n`, 0 being the most frequent.
+/// one generator per thread.
+pub struct ZipfGenerator {
+    zipf: Zipf<f64>,
+    rng: Xoshiro128PlusPlus,
+}
+
+impl ZipfGenerator {
+    pub fn new(n: u64, exponent: f64, seed: u64) -> Self {
+        ZipfGenerator {
+            zipf: Zipf::new(n, exponent).unwrap(),
+            rng: Xoshiro128PlusPlus::seed_from_u64(seed),
+        }
+    }
+
+    pub fn sample(&mut self) -> u64 {
+        self.zipf.sample(&mut self.rng) as u64 - 1
+    }
+}
+
 fn print_joint_objects(objects: &[&serde_json::Value]) {
-    // this is just a convenient place to set the flag, as all benchmarks call this at the end.
-    crate::MEASUREMENT_COMPLETE.store(true, Ordering::Relaxed);
     let joint: serde_json::Map<_, _> = objects.iter().flat_map(|o| o.as_object().unwrap().iter()).map(|(s, v)| (s.clone(), v.clone())).collect();
     println!("{}", serde_json::to_string(&joint).unwrap());
 }
\ No newline at end of file
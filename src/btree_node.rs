@@ -1,39 +1,30 @@
 use crate::basic_node::BasicNode;
 use crate::hash_leaf::HashLeaf;
-use crate::node_traits::{FenceData, InnerConversionSink, InnerConversionSource, merge_to_right};
+use crate::int_leaf::{basic_to_int_leaf, int_leaf_to_basic, INT_LEAF, IntLeaf32, IntLeaf64, is_int_leaf};
+use crate::node_traits::{FenceData, FenceRef, InnerConversionSink, InnerConversionSource, merge_to_right};
 use crate::{FatTruncatedKey};
 use num_enum::{TryFromPrimitive};
 use std::intrinsics::transmute;
 use std::mem::{ManuallyDrop};
 use std::{mem, ptr};
 use std::ops::Range;
+use std::path::Path;
 use std::simd::Simd;
-use std::sync::atomic::Ordering;
-use rand::{Rng};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::Duration;
 use rand::distributions::Uniform;
 use rand::distributions::uniform::{UniformInt, UniformSampler};
 use rand::prelude::SliceRandom;
-use crate::adaptive::{adapt_inner, infrequent, RAND};
+use crate::adaptive::{adapt_inner, gen_random_u64, infrequent, with_rand};
 use crate::art_node::ArtNode;
 use crate::branch_cache::BranchCacheAccessor;
+use crate::node_pool;
+use crate::overflow::OVERFLOW;
+use crate::page_state::PageState;
 use crate::vtables::BTreeNodeTag;
-#[allow(unused_imports)]
-use crate::head_node;
-#[allow(unused_imports)]
-use crate::node_traits::FallbackInnerConversionSink;
-use crate::util::reinterpret_mut;
-
-
-#[cfg(feature = "inner_basic")]
-pub type DefaultInnerNodeConversionSink = BasicNode;
-#[cfg(feature = "inner_art")]
-pub type DefaultInnerNodeConversionSink = ArtNode;
-#[cfg(feature = "inner_padded")]
-pub type DefaultInnerNodeConversionSink = FallbackInnerConversionSink<FallbackInnerConversionSink<head_node::U32ZeroPaddedHeadNode, head_node::U64ZeroPaddedHeadNode>, BasicNode>;
-#[cfg(feature = "inner_explicit_length")]
-pub type DefaultInnerNodeConversionSink = FallbackInnerConversionSink<FallbackInnerConversionSink<head_node::U32ExplicitHeadNode, head_node::U64ExplicitHeadNode>, BasicNode>;
-#[cfg(feature = "inner_ascii")]
-pub type DefaultInnerNodeConversionSink = FallbackInnerConversionSink<head_node::AsciiHeadNode, BasicNode>;
+use crate::layout::{LeafLayout, NodeLayout};
+use crate::util::{prefetch, reinterpret_mut};
+
 
 #[cfg(feature = "basic-prefix_true")]
 pub const BASIC_PREFIX: bool = true;
@@ -45,17 +36,72 @@ pub const STRIP_PREFIX: bool = true;
 #[cfg(feature = "strip-prefix_false")]
 pub const STRIP_PREFIX: bool = false;
 
-pub const PAGE_SIZE: usize = 4096;
+#[cfg(feature = "page-size_4")]
+pub const PAGE_SIZE: usize = 4 << 10;
+#[cfg(feature = "page-size_8")]
+pub const PAGE_SIZE: usize = 8 << 10;
+#[cfg(feature = "page-size_16")]
+pub const PAGE_SIZE: usize = 16 << 10;
+#[cfg(feature = "page-size_32")]
+pub const PAGE_SIZE: usize = 32 << 10;
+
+// in page offsets are u16, art node references use the top bit as a flag
+const _: () = assert!(PAGE_SIZE <= 1 << 15);
 
 #[repr(C)]
 pub union BTreeNode {
     pub raw_bytes: [u8; PAGE_SIZE],
     pub basic: BasicNode,
     pub hash_leaf: ManuallyDrop<HashLeaf>,
+    pub int_leaf32: IntLeaf32,
+    pub int_leaf64: IntLeaf64,
     pub uninit: (),
     pub art_node: ManuallyDrop<ArtNode>,
 }
 
+pub const LEAF_LINKS: bool = cfg!(feature = "leaf-links_true");
+
+/// inserts skip the descent if they hit the leaf of the previous insert, leaves split unevenly for keys beyond their last key
+pub const APPEND: bool = cfg!(feature = "append_true");
+
+/// inner nodes of `BTree` store the number of entries in the subtree of each child next to its pointer
+pub const SUBTREE_COUNTS: bool = cfg!(feature = "subtree-counts_true");
+
+/// number of top inner levels of `BTree` that are copied to a read optimized index, see `FrozenTop`
+#[cfg(feature = "frozen-top_0")]
+pub const FROZEN_LEVELS: usize = 0;
+#[cfg(feature = "frozen-top_2")]
+pub const FROZEN_LEVELS: usize = 2;
+#[cfg(feature = "frozen-top_3")]
+pub const FROZEN_LEVELS: usize = 3;
+
+/// heap allocated nodes are preceded by their latch, leaf links, and the layout of their tree.
+/// these live outside the page, so rewriting a whole node in place leaves them intact.
+#[repr(C)]
+struct NodeAllocation {
+    latch: PageState,
+    links: LeafLinks,
+    layout: NodeLayout,
+    node: BTreeNode,
+}
+
+/// neighbouring leaves in key order, only maintained if LEAF_LINKS is set.
+/// null at the ends of the tree.
+#[derive(Clone, Copy, Debug)]
+pub struct LeafLinks {
+    pub prev: *mut BTreeNode,
+    pub next: *mut BTreeNode,
+}
+
+const NODE_LATCH_OFFSET: usize = mem::size_of::<NodeAllocation>() - PAGE_SIZE;
+
+/// process wide node allocation counts
+pub static ALLOCATED_NODES: AtomicUsize = AtomicUsize::new(0);
+pub static FREED_NODES: AtomicUsize = AtomicUsize::new(0);
+
+/// allocate nodes from huge page backed regions instead of the global allocator
+const NODE_POOL: bool = cfg!(feature = "node-alloc_pool");
+
 #[derive(Clone, Copy, Debug)]
 #[repr(C)]
 pub struct BTreeNodeHead {
@@ -108,17 +154,37 @@ impl BTreeNode {
                         if slots.len() == 0 {
                             break 'key_scan;
                         }
-                        let indices: u16x8 = UniformInt::<u16x8>::sample_single(u16x8::splat(0), u16x8::splat(slots.len() as u16), unsafe { &mut *RAND });
-                        (0..u16x8::lanes()).all(|i| slots[indices.extract(i) as usize].key_len <= 4)
+                        let indices: u16x8 = with_rand(|r| UniformInt::<u16x8>::sample_single(u16x8::splat(0), u16x8::splat(slots.len() as u16), r));
+                        let sampled_len = |i: usize| slots[indices.extract(i) as usize].key_len;
+                        let is_short = (0..u16x8::lanes()).all(|i| sampled_len(i) <= 4);
+                        // the conversion checks all keys, the sample only avoids futile attempts
+                        let int_candidate = INT_LEAF && (0..u16x8::lanes()).all(|i| sampled_len(i) <= 8 && sampled_len(i) == sampled_len(0));
+                        if int_candidate && basic_to_int_leaf(self) {
+                            return;
+                        }
+                        is_short
                     }
                     BTreeNodeTag::HashLeaf => {
                         let slots = unsafe { self.hash_leaf.slots() };
                         if slots.len() == 0 {
                             break 'key_scan;
                         }
-                        let indices: u16x8 = UniformInt::<u16x8>::sample_single(u16x8::splat(0), u16x8::splat(slots.len() as u16), unsafe { &mut *RAND });
-                        (0..u16x8::lanes()).all(|i| slots[indices.extract(i) as usize].key_len <= 4)
+                        let indices: u16x8 = with_rand(|r| UniformInt::<u16x8>::sample_single(u16x8::splat(0), u16x8::splat(slots.len() as u16), r));
+                        let sampled_len = |i: usize| slots[indices.extract(i) as usize].key_len;
+                        let is_short = (0..u16x8::lanes()).all(|i| sampled_len(i) <= 4);
+                        // int leaves are built from basic leaves, so all keys are checked before converting.
+                        // if the int conversion still fails, e.g. for lack of space, the node goes back to being a hash leaf.
+                        let int_candidate = INT_LEAF && (0..u16x8::lanes()).all(|i| sampled_len(i) <= 8 && sampled_len(i) == sampled_len(0))
+                            && slots.iter().all(|s| s.key_len == sampled_len(0));
+                        if int_candidate && HashLeaf::to_basic(self).is_ok() {
+                            if !basic_to_int_leaf(self) {
+                                HashLeaf::from_basic(self);
+                            }
+                            return;
+                        }
+                        is_short
                     }
+                    BTreeNodeTag::IntLeaf32 | BTreeNodeTag::IntLeaf64 => break 'key_scan,
                     _ => unreachable!()
                 };
                 self.head_mut().adaption_state.0 = self.head_mut().adaption_state.0 % 128 + if is_short { 128 } else { 0 };
@@ -141,14 +207,16 @@ impl BTreeNode {
                     }
                 }
             }
+            // int leaves serve point and range operations alike, they become basic leaves once a key does not fit
+            BTreeNodeTag::IntLeaf32 | BTreeNodeTag::IntLeaf64 => {}
             _ => unreachable!()
         }
     }
 
     pub fn leave_notify_point_op(&mut self) {
-        #[cfg(feature = "leaf_adapt")]{
+        if unsafe { Self::layout(self) }.leaf == LeafLayout::Adapt {
             const THRESHOLD: u64 = (LEAVE_NOTIFY_POINT_WEIGHT * RAND_BIT as f64) as u64;
-            let rand = unsafe { &mut *RAND }.gen::<u64>();
+            let rand = gen_random_u64();
             if rand & (RAND_BIT - 1) < THRESHOLD {
                 let head = self.head_mut();
                 if head.adaption_state.0 % 128 > 0 {
@@ -160,9 +228,9 @@ impl BTreeNode {
     }
 
     pub fn leave_notify_range_op(&mut self) {
-        #[cfg(feature = "leaf_adapt")]{
+        if unsafe { Self::layout(self) }.leaf == LeafLayout::Adapt {
             const THRESHOLD: u64 = (LEAVE_NOTIFY_RANGE_WEIGHT * RAND_BIT as f64) as u64;
-            let rand = unsafe { &mut *RAND }.gen::<u64>();
+            let rand = gen_random_u64();
             if rand & (RAND_BIT - 1) < THRESHOLD {
                 let head = self.head_mut();
                 if head.adaption_state.0 % 128 < LEAVE_ADAPTION_RANGE {
@@ -189,6 +257,18 @@ impl BTreeNode {
         BTreeNodeTag::try_from_primitive(unsafe { self.raw_bytes[0] }).unwrap()
     }
 
+    pub fn leaf_entry_count(&self) -> usize {
+        unsafe {
+            match self.tag() {
+                BTreeNodeTag::BasicLeaf => self.basic.head.count as usize,
+                BTreeNodeTag::HashLeaf => self.hash_leaf.entry_count(),
+                BTreeNodeTag::IntLeaf32 => self.int_leaf32.entry_count(),
+                BTreeNodeTag::IntLeaf64 => self.int_leaf64.entry_count(),
+                _ => unreachable!(),
+            }
+        }
+    }
+
     pub fn head_mut(&mut self) -> &mut BTreeNodeHead {
         // this method is intended for dynamic leave layout selection
         // interpretation of head is different for inner and leave nodes
@@ -236,28 +316,196 @@ impl BTreeNode {
         (self, parent, index)
     }
 
-    pub unsafe fn alloc() -> *mut BTreeNode {
-        Box::into_raw(Box::new(BTreeNode::new_uninit()))
+    /// descends to the leaves for all keys level by level, replacing the start node of each key in `leaves` by its leaf.
+    /// all start nodes must be on the same level.
+    /// each child is prefetched before moving on to the next key, so cache misses of different keys overlap.
+    /// inner nodes are not adapted.
+    pub fn descend_batch(keys: &[&[u8]], leaves: &mut [*mut BTreeNode]) {
+        debug_assert_eq!(keys.len(), leaves.len());
+        // interleaved descents would confuse the branch cache
+        let mut bc = BranchCacheAccessor::new();
+        bc.set_inactive();
+        // all leaves are on the same level
+        while !leaves.is_empty() && unsafe { (*leaves[0]).tag().is_inner() } {
+            for (key, node) in keys.iter().zip(leaves.iter_mut()) {
+                unsafe {
+                    let inner = (**node).to_inner_mut();
+                    *node = inner.get_child(inner.find_child_index(key, &mut bc));
+                }
+                prefetch(*node);
+            }
+        }
+    }
+
+    /// allocates all future nodes in a mapping of the page file at path, see `node_pool::map_file`
+    pub unsafe fn map_page_file(path: &Path, capacity: usize) -> bool {
+        assert!(NODE_POOL, "page files require node-alloc_pool");
+        assert!(!OVERFLOW, "overflow payloads are allocated outside the page file");
+        node_pool::map_file(path, capacity, mem::size_of::<NodeAllocation>())
+    }
+
+    /// allocates all future nodes in a shared mapping of a scratch file, see `node_pool::map_page_cache_file`
+    pub unsafe fn map_page_cache_file(path: &Path, capacity: usize, writeback_interval: Option<Duration>) {
+        assert!(NODE_POOL, "page cache files require node-alloc_pool");
+        node_pool::map_page_cache_file(path, capacity, writeback_interval)
+    }
+
+    /// new nodes of a tree must be allocated with the layout of the tree
+    pub unsafe fn alloc(layout: NodeLayout) -> *mut BTreeNode {
+        Self::alloc_placed(layout, false)
+    }
+
+    /// like `alloc`, for nodes that are descended through by all threads.
+    /// these are interleaved across NUMA nodes if NUMA placement is enabled, other nodes are local to the allocating thread.
+    pub unsafe fn alloc_inner(layout: NodeLayout) -> *mut BTreeNode {
+        Self::alloc_placed(layout, true)
+    }
+
+    /// enables NUMA placement of pool allocated nodes, see `node_pool::enable_numa`
+    pub fn enable_numa() -> usize {
+        assert!(NODE_POOL, "NUMA placement requires node-alloc_pool");
+        node_pool::enable_numa()
+    }
+
+    unsafe fn alloc_placed(layout: NodeLayout, shared: bool) -> *mut BTreeNode {
+        ALLOCATED_NODES.fetch_add(1, Ordering::Relaxed);
+        let allocation = if NODE_POOL {
+            let allocation = node_pool::alloc(mem::size_of::<NodeAllocation>(), shared) as *mut NodeAllocation;
+            ptr::addr_of_mut!((*allocation).latch).write(PageState::new());
+            ptr::addr_of_mut!((*allocation).links).write(LeafLinks { prev: ptr::null_mut(), next: ptr::null_mut() });
+            ptr::addr_of_mut!((*allocation).layout).write(layout);
+            allocation
+        } else {
+            Box::into_raw(Box::new(NodeAllocation {
+                latch: PageState::new(),
+                links: LeafLinks { prev: ptr::null_mut(), next: ptr::null_mut() },
+                layout,
+                node: BTreeNode::new_uninit(),
+            }))
+        };
+        ptr::addr_of_mut!((*allocation).node)
     }
 
     pub unsafe fn dealloc(node: *mut BTreeNode) {
-        drop(Box::from_raw(node));
+        FREED_NODES.fetch_add(1, Ordering::Relaxed);
+        if NODE_POOL {
+            node_pool::dealloc(Self::allocation(node) as *mut u8);
+        } else {
+            drop(Box::from_raw(Self::allocation(node)));
+        }
+    }
+
+    /// deallocates node and all its descendants
+    pub unsafe fn dealloc_tree(node: *mut BTreeNode) {
+        if (*node).tag().is_inner() {
+            let inner = (*node).to_inner();
+            for i in 0..inner.key_count() + 1 {
+                Self::dealloc_tree(inner.get_child(i));
+            }
+        }
+        Self::dealloc(node);
+    }
+
+    /// node must have been allocated using `alloc`
+    unsafe fn allocation(node: *const BTreeNode) -> *mut NodeAllocation {
+        (node as *mut u8).sub(NODE_LATCH_OFFSET) as *mut NodeAllocation
+    }
+
+    /// node must have been allocated using `alloc`
+    pub unsafe fn latch<'a>(node: *const BTreeNode) -> &'a PageState {
+        &(*Self::allocation(node)).latch
+    }
+
+    /// node must have been allocated using `alloc`
+    pub unsafe fn layout(node: *const BTreeNode) -> NodeLayout {
+        (*Self::allocation(node)).layout
+    }
+
+    /// node must have been allocated using `alloc`
+    pub unsafe fn leaf_links<'a>(node: *const BTreeNode) -> &'a mut LeafLinks {
+        &mut (*Self::allocation(node)).links
+    }
+
+    /// number of entries in the subtree of node, only maintained for inner nodes if SUBTREE_COUNTS is set.
+    /// inner nodes sum the counts stored next to their child pointers, so this reads node only.
+    pub unsafe fn entry_count(node: *const BTreeNode) -> u64 {
+        if (*node).tag().is_leaf() {
+            (*node).leaf_entry_count() as u64
+        } else {
+            let inner = (*node).to_inner();
+            (0..inner.key_count() + 1).map(|i| inner.get_child_count(i)).sum()
+        }
+    }
+
+    /// inserts the new leaf `left` into the leaf list immediately before `right`
+    pub unsafe fn link_leaf_before(left: *mut BTreeNode, right: *mut BTreeNode) {
+        if LEAF_LINKS {
+            let prev = Self::leaf_links(right).prev;
+            *Self::leaf_links(left) = LeafLinks { prev, next: right };
+            Self::leaf_links(right).prev = left;
+            if !prev.is_null() {
+                Self::leaf_links(prev).next = left;
+            }
+        }
     }
 
-    pub fn new_leaf() -> *mut BTreeNode {
+    /// removes `leaf` from the leaf list
+    pub unsafe fn unlink_leaf(leaf: *mut BTreeNode) {
+        if LEAF_LINKS {
+            let LeafLinks { prev, next } = *Self::leaf_links(leaf);
+            if !prev.is_null() {
+                Self::leaf_links(prev).next = next;
+            }
+            if !next.is_null() {
+                Self::leaf_links(next).prev = prev;
+            }
+        }
+    }
+
+    pub fn leaf_fences(&self) -> FenceData {
         unsafe {
-            let leaf = Self::alloc();
-            if cfg!(feature = "leaf_hash") || cfg!(feature = "leaf_adapt") {
-                (*leaf).hash_leaf = ManuallyDrop::new(HashLeaf::new())
-            } else if cfg!(feature = "leaf_basic") {
-                (*leaf).basic = BasicNode::new_leaf();
-            } else {
-                panic!();
+            match self.tag() {
+                BTreeNodeTag::BasicLeaf => InnerConversionSource::fences(&self.basic),
+                BTreeNodeTag::HashLeaf => self.hash_leaf.fences(),
+                BTreeNodeTag::IntLeaf32 => self.int_leaf32.fences(),
+                BTreeNodeTag::IntLeaf64 => self.int_leaf64.fences(),
+                _ => unreachable!(),
+            }
+        }
+    }
+
+    pub fn new_leaf(layout: NodeLayout) -> *mut BTreeNode {
+        unsafe {
+            let leaf = Self::alloc(layout);
+            match layout.leaf {
+                LeafLayout::Hash | LeafLayout::Adapt => (*leaf).hash_leaf = ManuallyDrop::new(HashLeaf::new()),
+                LeafLayout::Basic => (*leaf).basic = BasicNode::new_leaf(),
             }
             leaf
         }
     }
 
+    /// writes an empty leaf of the given layout with the given full length fences
+    pub fn init_leaf(&mut self, layout: LeafLayout, lower: &[u8], upper: &[u8]) {
+        let fences = FenceData {
+            prefix_len: 0,
+            lower_fence: FenceRef(lower),
+            upper_fence: FenceRef(upper),
+        }.restrip();
+        match layout {
+            LeafLayout::Hash | LeafLayout::Adapt => {
+                let mut leaf = HashLeaf::new();
+                leaf.set_fences(fences);
+                self.hash_leaf = ManuallyDrop::new(leaf);
+            }
+            LeafLayout::Basic => {
+                let mut leaf = BasicNode::new_leaf();
+                leaf.set_fences(fences);
+                self.basic = leaf;
+            }
+        }
+    }
+
     pub fn new_inner(child: *mut BTreeNode) -> *mut BTreeNode {
         struct RootSource {
             child: *mut BTreeNode,
@@ -276,6 +524,11 @@ impl BTreeNode {
                 self.child
             }
 
+            fn get_child_count(&self, index: usize) -> u64 {
+                debug_assert_eq!(index, 0);
+                unsafe { BTreeNode::entry_count(self.child) }
+            }
+
             fn get_key(&self, _index: usize, _dst: &mut [u8], _strip_prefix: usize) -> Result<usize, ()> {
                 panic!()
             }
@@ -289,8 +542,9 @@ impl BTreeNode {
             }
         }
         unsafe {
-            let node = Self::alloc();
-            DefaultInnerNodeConversionSink::create(&mut *node, &RootSource { child }).unwrap();
+            let layout = Self::layout(child);
+            let node = Self::alloc_inner(layout);
+            layout.inner.create(&mut *node, &RootSource { child }).unwrap();
             node
         }
     }
@@ -306,7 +560,12 @@ impl BTreeNode {
         if right.tag().is_leaf() {
             debug_assert!(right.is_underfull());
         }
-        match (self.tag(), right.tag()) {
+        for node in [&mut *self, &mut *right] {
+            if is_int_leaf(node.tag()) {
+                int_leaf_to_basic(node)?;
+            }
+        }
+        let result = match (self.tag(), right.tag()) {
             (BTreeNodeTag::BasicLeaf, BTreeNodeTag::BasicLeaf) => self.basic.merge_right(false, &mut *right, separator),
             (lt, rt) => {
                 if lt.is_leaf() {
@@ -324,6 +583,10 @@ impl BTreeNode {
                     merge_to_right::<BasicNode>(self, right, separator)
                 }
             }
+        };
+        if result.is_ok() && right.tag().is_leaf() {
+            Self::unlink_leaf(self);
         }
+        result
     }
 }
@@ -0,0 +1,226 @@
+use crate::{BTreeNode, PAGE_SIZE, PrefixTruncatedKey};
+use crate::btree_node::LEAF_LINKS;
+use crate::layout::NodeLayout;
+use crate::node_traits::{FenceData, FenceRef, InnerConversionSource};
+use crate::util::get_key_from_slice;
+use std::ops::Range;
+use std::ptr;
+
+/// builds a tree bottom up from entries in strictly ascending key order and returns its root.
+/// leaves are filled until the next entry does not fit, inner nodes hold as many children as the inner node layout permits.
+/// the upper fence of each leaf is its largest key.
+pub fn bulk_load<'a>(layout: NodeLayout, entries: impl Iterator<Item=(&'a [u8], &'a [u8])>) -> *mut BTreeNode {
+    let mut builder = LeafBuilder::new(layout);
+    for (key, payload) in entries {
+        builder.push(key, payload);
+    }
+    let (mut children, mut separators) = builder.finish();
+    while children.len() > 1 {
+        let (c, s) = unsafe { build_inner_level(layout, &children, &separators) };
+        children = c;
+        separators = s;
+    }
+    children[0]
+}
+
+struct LeafBuilder {
+    layout: NodeLayout,
+    /// entries of the current leaf, which has an unbounded upper fence until it is sealed
+    leaf: BTreeNode,
+    lower_fence: Vec<u8>,
+    pending_data: Vec<u8>,
+    /// offset, key length, payload length
+    pending: Vec<(usize, usize, usize)>,
+    leaves: Vec<*mut BTreeNode>,
+    separators: Vec<Vec<u8>>,
+}
+
+impl LeafBuilder {
+    fn new(layout: NodeLayout) -> Self {
+        let mut leaf = unsafe { BTreeNode::new_uninit() };
+        leaf.init_leaf(layout.leaf, &[], &[]);
+        LeafBuilder {
+            layout,
+            leaf,
+            lower_fence: Vec::new(),
+            pending_data: Vec::new(),
+            pending: Vec::new(),
+            leaves: Vec::new(),
+            separators: Vec::new(),
+        }
+    }
+
+    fn pending_entry(&self, index: usize) -> (&[u8], &[u8]) {
+        let (offset, key_len, payload_len) = self.pending[index];
+        (&self.pending_data[offset..][..key_len], &self.pending_data[offset + key_len..][..payload_len])
+    }
+
+    fn push(&mut self, key: &[u8], payload: &[u8]) {
+        assert!(key.len() + payload.len() <= PAGE_SIZE / 4);
+        debug_assert!(self.pending.is_empty() || self.pending_entry(self.pending.len() - 1).0 < key, "bulk load input must be sorted");
+        while self.leaf.to_leaf_mut().insert(key, payload).is_err() {
+            self.seal();
+        }
+        self.pending.push((self.pending_data.len(), key.len(), payload.len()));
+        self.pending_data.extend_from_slice(key);
+        self.pending_data.extend_from_slice(payload);
+    }
+
+    /// moves as many pending entries as possible into a leaf bounded by the last of them, the rest start the next leaf.
+    fn seal(&mut self) {
+        let mut count = self.pending.len();
+        assert!(count > 0);
+        unsafe {
+            loop {
+                // the upper fence takes space, so fewer entries may fit
+                let separator = self.pending_entry(count - 1).0.to_vec();
+                let node = BTreeNode::alloc(self.layout);
+                (*node).init_leaf(self.layout.leaf, &self.lower_fence, &separator);
+                let fit = (0..count).take_while(|&i| {
+                    let (key, payload) = self.pending_entry(i);
+                    (*node).to_leaf_mut().insert(key, payload).is_ok()
+                }).count();
+                if fit == count {
+                    self.push_leaf(node, Some(separator));
+                    break;
+                }
+                BTreeNode::dealloc(node);
+                count = fit;
+            }
+        }
+        self.leaf.init_leaf(self.layout.leaf, self.separators.last().unwrap(), &[]);
+        self.lower_fence.clone_from(self.separators.last().unwrap());
+        let remaining = self.pending.split_off(count);
+        let remaining_start = remaining.first().map(|e| e.0).unwrap_or(self.pending_data.len());
+        let remaining_data = self.pending_data.split_off(remaining_start);
+        self.pending_data = remaining_data;
+        self.pending.clear();
+        for (offset, key_len, payload_len) in remaining {
+            let offset = offset - remaining_start;
+            let key = &self.pending_data[offset..][..key_len];
+            let payload = &self.pending_data[offset + key_len..][..payload_len];
+            self.leaf.to_leaf_mut().insert(key, payload).unwrap();
+            self.pending.push((offset, key_len, payload_len));
+        }
+    }
+
+    unsafe fn push_leaf(&mut self, node: *mut BTreeNode, separator: Option<Vec<u8>>) {
+        if LEAF_LINKS {
+            if let Some(&prev) = self.leaves.last() {
+                BTreeNode::leaf_links(prev).next = node;
+                BTreeNode::leaf_links(node).prev = prev;
+            }
+        }
+        self.leaves.push(node);
+        self.separators.extend(separator);
+    }
+
+    /// returns leaves and the separators between them
+    fn finish(mut self) -> (Vec<*mut BTreeNode>, Vec<Vec<u8>>) {
+        unsafe {
+            let node = BTreeNode::alloc(self.layout);
+            ptr::copy_nonoverlapping(&self.leaf, node, 1);
+            self.push_leaf(node, None);
+        }
+        (self.leaves, self.separators)
+    }
+}
+
+/// a range of nodes of one level viewed as the children of a new inner node
+pub(crate) struct LevelSlice<'a> {
+    children: &'a [*mut BTreeNode],
+    keys: &'a [Vec<u8>],
+    fences: FenceData<'a>,
+}
+
+impl<'a> LevelSlice<'a> {
+    fn new(children: &'a [*mut BTreeNode], separators: &'a [Vec<u8>], range: Range<usize>) -> Self {
+        let lower: &[u8] = if range.start == 0 { &[] } else { &separators[range.start - 1] };
+        let upper: &[u8] = if range.end == children.len() { &[] } else { &separators[range.end - 1] };
+        Self::with_fences(&children[range.clone()], &separators[range.start..range.end - 1], lower, upper)
+    }
+
+    /// children with full length separators between them, bounded by the full length fences lower and upper
+    pub(crate) fn with_fences(children: &'a [*mut BTreeNode], keys: &'a [Vec<u8>], lower: &'a [u8], upper: &'a [u8]) -> Self {
+        debug_assert_eq!(children.len(), keys.len() + 1);
+        LevelSlice {
+            children,
+            keys,
+            fences: FenceData {
+                prefix_len: 0,
+                lower_fence: FenceRef(lower),
+                upper_fence: FenceRef(upper),
+            }.restrip(),
+        }
+    }
+}
+
+impl InnerConversionSource for LevelSlice<'_> {
+    fn fences(&self) -> FenceData {
+        self.fences
+    }
+
+    fn key_count(&self) -> usize {
+        self.keys.len()
+    }
+
+    fn get_child(&self, index: usize) -> *mut BTreeNode {
+        self.children[index]
+    }
+
+    fn get_child_count(&self, index: usize) -> u64 {
+        unsafe { BTreeNode::entry_count(self.children[index]) }
+    }
+
+    fn get_key(&self, index: usize, dst: &mut [u8], strip_prefix: usize) -> Result<usize, ()> {
+        get_key_from_slice(PrefixTruncatedKey(&self.keys[index][self.fences.prefix_len..]), dst, strip_prefix)
+    }
+
+    fn get_key_length_sum(&self, range: Range<usize>) -> usize {
+        self.keys[range].iter().map(|k| k.len() - self.fences.prefix_len).sum()
+    }
+
+    fn get_key_length_max(&self, range: Range<usize>) -> usize {
+        self.keys[range].iter().map(|k| k.len() - self.fences.prefix_len).max().unwrap_or(0)
+    }
+}
+
+/// groups `children` into inner nodes, returns the new nodes and the separators between them
+unsafe fn build_inner_level(layout: NodeLayout, children: &[*mut BTreeNode], separators: &[Vec<u8>]) -> (Vec<*mut BTreeNode>, Vec<Vec<u8>>) {
+    debug_assert_eq!(children.len(), separators.len() + 1);
+    let mut nodes = Vec::new();
+    let mut upper_separators = Vec::new();
+    let mut tmp = BTreeNode::new_uninit();
+    let mut start = 0;
+    while start < children.len() {
+        let fits = |tmp: &mut BTreeNode, count: usize| {
+            layout.inner.create(tmp, &LevelSlice::new(children, separators, start..start + count)).is_ok()
+        };
+        // largest child count that fits, any inner node fits two children
+        let remaining = children.len() - start;
+        let mut low = remaining.min(2);
+        let mut high = remaining;
+        while low < high {
+            let mid = (low + high + 1) / 2;
+            if fits(&mut tmp, mid) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+        let mut count = low;
+        if remaining - count == 1 && count > 2 {
+            // avoid a final node with a single child
+            count -= 1;
+        }
+        assert!(fits(&mut tmp, count));
+        let node = BTreeNode::alloc_inner(layout);
+        ptr::copy_nonoverlapping(&tmp, node, 1);
+        nodes.push(node);
+        if start + count < children.len() {
+            upper_separators.push(separators[start + count - 1].clone());
+        }
+        start += count;
+    }
+    (nodes, upper_separators)
+}
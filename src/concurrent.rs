@@ -0,0 +1,548 @@
+use crate::{BTreeNode, op_count, PAGE_SIZE};
+use crate::b_tree::{next_leaf_start_asc, next_leaf_start_desc};
+use crate::btree_node::LEAF_LINKS;
+use crate::bulk_load::bulk_load;
+use crate::layout::NodeLayout;
+use crate::node_pool;
+use crate::node_stats::TreeStats;
+use crate::overflow::{self, OVERFLOW};
+use crate::branch_cache::BranchCacheAccessor;
+use crate::cursor::{BatchWriter, Cursor};
+use crate::page_state::PageState;
+use crate::wal::{self, LogOp, LogRecord};
+use op_count::count_op;
+use std::hint::spin_loop;
+use std::ptr;
+use std::sync::atomic::{AtomicPtr, Ordering};
+use std::thread;
+
+/// B-Tree that may be shared between threads.
+/// readers couple shared latches from the root down, writers latch the leaf exclusively.
+/// structural changes re-descend and upgrade the latches on the affected node and its parent.
+/// no thread ever waits for a latch while holding another one, on contention all latches are released and the operation restarts at the root after a backoff.
+/// inner node adaption on descent is skipped.
+/// leaves are notified of operations only while latched exclusively, so lookups, which latch leaves shared, do not steer leaf adaption.
+pub struct ConcurrentBTree {
+    root: AtomicPtr<BTreeNode>,
+    /// if set, modifications are appended to the redo log under this id while their leaf is latched exclusively
+    pub wal_id: Option<u32>,
+}
+
+unsafe impl Send for ConcurrentBTree {}
+
+unsafe impl Sync for ConcurrentBTree {}
+
+#[derive(Clone, Copy, Eq, PartialEq, Debug)]
+enum LeafLatch {
+    Shared,
+    Exclusive,
+}
+
+enum StructureLatch {
+    /// target and parent are latched exclusively, parent is null if target is the root
+    Latched(*mut BTreeNode, usize),
+    /// a latch could not be acquired, no latches are held
+    Contended,
+    /// target is no longer on the path to the key or has been modified, no latches are held
+    Gone,
+}
+
+unsafe fn try_latch_s(node: *mut BTreeNode) -> bool {
+    let latch = BTreeNode::latch(node);
+    latch.try_lock_s(latch.load())
+}
+
+unsafe fn try_latch_x(node: *mut BTreeNode) -> bool {
+    let latch = BTreeNode::latch(node);
+    latch.try_lock_x(latch.load())
+}
+
+/// releases a shared latch, node may be null
+unsafe fn unlatch_s(node: *mut BTreeNode) {
+    if !node.is_null() {
+        BTreeNode::latch(node).unlock_s();
+    }
+}
+
+unsafe fn unlatch_x(node: *mut BTreeNode) -> u64 {
+    BTreeNode::latch(node).unlock_x()
+}
+
+/// waits before an operation restarts, like `yield` in `tpcc/newbm.cpp`.
+/// spins exponentially longer with the number of restarts so far and yields the thread once that exceeds a bound.
+fn backoff(restarts: u32) {
+    const MAX_SPIN_SHIFT: u32 = 8;
+    if restarts < MAX_SPIN_SHIFT {
+        for _ in 0..1u32 << restarts {
+            spin_loop();
+        }
+    } else {
+        thread::yield_now();
+    }
+}
+
+impl Drop for ConcurrentBTree {
+    fn drop(&mut self) {
+        if OVERFLOW {
+            let mut key_buffer = [0u8; PAGE_SIZE / 4];
+            self.range_lookup_stored(&[], key_buffer.as_mut_ptr(), &mut |_, stored| {
+                unsafe { overflow::free(stored) };
+                true
+            });
+        }
+        unsafe { BTreeNode::dealloc_tree(*self.root.get_mut()) }
+    }
+}
+
+impl ConcurrentBTree {
+    pub fn new() -> Self {
+        Self::with_layout(NodeLayout::DEFAULT)
+    }
+
+    pub fn with_layout(layout: NodeLayout) -> Self {
+        count_op();
+        assert!(!cfg!(feature = "dynamic-prefix_true"), "dynamic prefix modifies inner nodes on lookup");
+        assert!(!LEAF_LINKS, "leaf links are updated without latching the neighbours");
+        ConcurrentBTree {
+            root: AtomicPtr::new(BTreeNode::new_leaf(layout)),
+            wal_id: None,
+        }
+    }
+
+    /// records the root in `slot` of the page file, see `BTreeNode::map_page_file`.
+    /// the tree must not be modified until the next `node_pool::sync_file`.
+    pub fn checkpoint(&self, slot: usize) {
+        node_pool::set_file_root(slot, self.root.load(Ordering::Acquire) as *mut u8);
+    }
+
+    /// reopens the tree recorded in `slot` of the page file, the tree must be opened at most once
+    pub fn open(slot: usize) -> Option<Self> {
+        let root = node_pool::file_root(slot) as *mut BTreeNode;
+        if root.is_null() {
+            return None;
+        }
+        Some(ConcurrentBTree {
+            root: AtomicPtr::new(root),
+            wal_id: None,
+        })
+    }
+
+    /// must not run concurrently with modifications
+    pub unsafe fn stats(&self) -> TreeStats {
+        TreeStats::collect(self.root.load(Ordering::Acquire))
+    }
+
+    /// entries must be in strictly ascending key order
+    pub fn bulk_load<'a>(layout: NodeLayout, entries: impl Iterator<Item=(&'a [u8], &'a [u8])>) -> Self {
+        let tree = Self::with_layout(layout);
+        let root = if OVERFLOW {
+            let mut buffer = [0u8; PAGE_SIZE / 4];
+            // bulk_load copies each entry before requesting the next
+            bulk_load(layout, entries.map(move |(key, payload)| {
+                let stored = overflow::encode(key, payload, &mut buffer);
+                (key, unsafe { &*(stored as *const [u8]) })
+            }))
+        } else {
+            bulk_load(layout, entries)
+        };
+        unsafe { BTreeNode::dealloc(tree.root.swap(root, Ordering::Relaxed)) };
+        tree
+    }
+
+    /// returns the root latched shared
+    unsafe fn try_latch_root(&self) -> Option<*mut BTreeNode> {
+        let root = self.root.load(Ordering::Acquire);
+        if !try_latch_s(root) {
+            return None;
+        }
+        if self.root.load(Ordering::Acquire) != root {
+            unlatch_s(root);
+            return None;
+        }
+        Some(root)
+    }
+
+    /// descends to the leaf responsible for key.
+    /// returns leaf, parent, and index within parent.
+    /// the leaf is latched according to `leaf_latch`, the parent is latched shared if `keep_parent` is set and null otherwise.
+    unsafe fn try_descend(&self, key: &[u8], leaf_latch: LeafLatch, keep_parent: bool) -> Option<(*mut BTreeNode, *mut BTreeNode, usize)> {
+        let mut node = self.try_latch_root()?;
+        let mut parent = ptr::null_mut();
+        let mut index = 0;
+        let mut bc = BranchCacheAccessor::new();
+        while (*node).tag().is_inner() {
+            index = (*node).to_inner_mut().find_child_index(key, &mut bc);
+            let child = (*node).to_inner().get_child(index);
+            if !try_latch_s(child) {
+                unlatch_s(node);
+                unlatch_s(parent);
+                return None;
+            }
+            unlatch_s(parent);
+            parent = node;
+            node = child;
+        }
+        if leaf_latch == LeafLatch::Exclusive && !BTreeNode::latch(node).try_upgrade() {
+            unlatch_s(node);
+            unlatch_s(parent);
+            return None;
+        }
+        if !keep_parent {
+            unlatch_s(parent);
+            parent = ptr::null_mut();
+        }
+        Some((node, parent, index))
+    }
+
+    fn descend(&self, key: &[u8], leaf_latch: LeafLatch, keep_parent: bool) -> (*mut BTreeNode, *mut BTreeNode, usize) {
+        let mut restarts = 0;
+        loop {
+            if let Some(x) = unsafe { self.try_descend(key, leaf_latch, keep_parent) } {
+                return x;
+            }
+            backoff(restarts);
+            restarts += 1;
+        }
+    }
+
+    /// latches `target` and its parent exclusively if `target` is still on the path to `key` and unmodified since `expected_version`
+    unsafe fn try_latch_structure(&self, key: &[u8], target: *mut BTreeNode, expected_version: u64) -> StructureLatch {
+        let mut node = match self.try_latch_root() {
+            Some(root) => root,
+            None => return StructureLatch::Contended,
+        };
+        let mut parent = ptr::null_mut();
+        let mut index = 0;
+        let mut bc = BranchCacheAccessor::new();
+        while node != target {
+            if (*node).tag().is_leaf() {
+                unlatch_s(node);
+                unlatch_s(parent);
+                return StructureLatch::Gone;
+            }
+            index = (*node).to_inner_mut().find_child_index(key, &mut bc);
+            let child = (*node).to_inner().get_child(index);
+            if !try_latch_s(child) {
+                unlatch_s(node);
+                unlatch_s(parent);
+                return StructureLatch::Contended;
+            }
+            unlatch_s(parent);
+            parent = node;
+            node = child;
+        }
+        if PageState::version(BTreeNode::latch(node).load()) != PageState::version(expected_version) {
+            unlatch_s(node);
+            unlatch_s(parent);
+            return StructureLatch::Gone;
+        }
+        if !BTreeNode::latch(node).try_upgrade() {
+            unlatch_s(node);
+            unlatch_s(parent);
+            return StructureLatch::Contended;
+        }
+        if !parent.is_null() && !BTreeNode::latch(parent).try_upgrade() {
+            unlatch_x(node);
+            unlatch_s(parent);
+            return StructureLatch::Contended;
+        }
+        StructureLatch::Latched(parent, index)
+    }
+
+    pub fn insert(&self, key: &[u8], payload: &[u8]) {
+        count_op();
+        let mut buffer = [0u8; PAGE_SIZE / 4];
+        let stored = if OVERFLOW {
+            overflow::encode(key, payload, &mut buffer)
+        } else {
+            assert!((key.len() + payload.len()) as usize <= PAGE_SIZE / 4);
+            payload
+        };
+        // the replaced payload is only freed once the insert succeeded, it stays referenced by the leaf otherwise
+        let mut old_buffer = [0u8; PAGE_SIZE / 4];
+        let mut restarts = 0;
+        unsafe {
+            loop {
+                let (node, _, _) = self.descend(key, LeafLatch::Exclusive, false);
+                (*node).leave_notify_point_op();
+                let old_len = if OVERFLOW {
+                    (*node).to_leaf_mut().lookup(key).map(|old| {
+                        old_buffer[..old.len()].copy_from_slice(old);
+                        old.len()
+                    })
+                } else {
+                    None
+                };
+                if (*node).to_leaf_mut().insert(key, stored).is_ok() {
+                    if let Some(old_len) = old_len {
+                        overflow::free(&old_buffer[..old_len]);
+                    }
+                    self.log(LogOp::Put, key, payload);
+                    unlatch_x(node);
+                    return;
+                }
+                let version = unlatch_x(node);
+                self.split_node(node, version, key);
+                backoff(restarts);
+                restarts += 1;
+            }
+        }
+    }
+
+    /// applies a record of the redo log, `wal_id` should be unset during replay
+    pub fn redo(&self, record: &LogRecord) {
+        match record.op {
+            LogOp::Put => self.insert(record.key, record.payload),
+            LogOp::Remove => {
+                self.remove(record.key);
+            }
+            LogOp::RemoveRange | LogOp::RemoveFrom => unreachable!("range removal is not supported by concurrent trees"),
+        }
+    }
+
+    /// must be called while holding the exclusive latch on the modified leaf, so log order matches the order of modifications per key
+    fn log(&self, op: LogOp, key: &[u8], payload: &[u8]) {
+        if let Some(id) = self.wal_id {
+            wal::append(id, op, key, payload);
+        }
+    }
+
+    /// splits `node` unless it was modified since `version`.
+    /// splits parents recursively if they lack space for the separator.
+    unsafe fn split_node(&self, node: *mut BTreeNode, version: u64, key: &[u8]) {
+        let mut restarts = 0;
+        loop {
+            match self.try_latch_structure(key, node, version) {
+                StructureLatch::Contended => {
+                    backoff(restarts);
+                    restarts += 1;
+                }
+                StructureLatch::Gone => return,
+                StructureLatch::Latched(mut parent, index) => {
+                    let is_root = parent.is_null();
+                    if is_root {
+                        // not reachable by other threads until root is updated
+                        parent = BTreeNode::new_inner(node);
+                    }
+                    let success = (*node).split_node((&mut *parent).to_inner_mut(), index, key);
+                    let parent_version = if is_root {
+                        self.root.store(parent, Ordering::Release);
+                        BTreeNode::latch(parent).load()
+                    } else {
+                        unlatch_x(parent)
+                    };
+                    unlatch_x(node);
+                    if success.is_err() {
+                        self.split_node(parent, parent_version, key);
+                    }
+                    return;
+                }
+            }
+        }
+    }
+
+    /// calls `f` with the payload of key while holding a shared latch on the leaf
+    pub fn lookup<R>(&self, key: &[u8], f: impl FnOnce(&[u8]) -> R) -> Option<R> {
+        count_op();
+        unsafe {
+            let (node, _, _) = self.descend(key, LeafLatch::Shared, false);
+            let result = (*node).to_leaf_mut().lookup(key).map(|payload| f(overflow::decode(payload)));
+            unlatch_s(node);
+            result
+        }
+    }
+
+    /// calls `f` with the payload of key while holding an exclusive latch on the leaf
+    pub fn update<R>(&self, key: &[u8], f: impl FnOnce(&mut [u8]) -> R) -> Option<R> {
+        count_op();
+        unsafe {
+            let (node, _, _) = self.descend(key, LeafLatch::Exclusive, false);
+            (*node).leave_notify_point_op();
+            let result = (*node).to_leaf_mut().lookup(key).map(|payload| {
+                let payload = overflow::decode_mut(payload);
+                let result = f(&mut *payload);
+                self.log(LogOp::Put, key, payload);
+                result
+            });
+            unlatch_x(node);
+            result
+        }
+    }
+
+    pub fn remove(&self, key: &[u8]) -> bool {
+        count_op();
+        unsafe {
+            let (node, _, _) = self.descend(key, LeafLatch::Exclusive, false);
+            (*node).leave_notify_point_op();
+            if OVERFLOW {
+                if let Some(old) = (*node).to_leaf_mut().lookup(key) {
+                    overflow::free(old);
+                }
+            }
+            let found = (*node).to_leaf_mut().remove(key).is_some();
+            if found {
+                self.log(LogOp::Remove, key, &[]);
+            }
+            let underfull = found && (*node).is_underfull();
+            let version = unlatch_x(node);
+            if underfull {
+                self.merge(node, version, key);
+            }
+            found
+        }
+    }
+
+    /// merges the underfull `node` with a sibling, cascading to parents that become underfull.
+    /// merging is opportunistic, it is skipped on contention.
+    unsafe fn merge(&self, mut node: *mut BTreeNode, mut version: u64, key: &[u8]) {
+        loop {
+            let (parent, index) = match self.try_latch_structure(key, node, version) {
+                StructureLatch::Latched(parent, index) => (parent, index),
+                StructureLatch::Contended | StructureLatch::Gone => return,
+            };
+            if parent.is_null() {
+                unlatch_x(node);
+                return;
+            }
+            // same sibling choice as merge_children_check
+            let key_count = (*parent).to_inner().key_count();
+            let (left, right) = if index == key_count {
+                if index == 0 {
+                    unlatch_x(node);
+                    unlatch_x(parent);
+                    return;
+                }
+                ((*parent).to_inner().get_child(index - 1), node)
+            } else {
+                (node, (*parent).to_inner().get_child(index + 1))
+            };
+            let sibling = if left == node { right } else { left };
+            if !try_latch_x(sibling) {
+                unlatch_x(node);
+                unlatch_x(parent);
+                return;
+            }
+            let merged = (*parent).to_inner_mut().merge_children_check(index).is_ok();
+            if merged {
+                // left has been deallocated
+                unlatch_x(right);
+            } else {
+                unlatch_x(left);
+                unlatch_x(right);
+            }
+            let parent_underfull = merged && (*parent).is_underfull();
+            if parent_underfull {
+                (&mut *parent).adaption_state().set_adapted(false);
+            }
+            let parent_version = unlatch_x(parent);
+            if !parent_underfull {
+                return;
+            }
+            node = parent;
+            version = parent_version;
+        }
+    }
+
+    /// callback is invoked while holding latches and must not access the tree
+    pub fn range_lookup(&self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
+        if OVERFLOW {
+            self.range_lookup_stored(initial_start, key_out, &mut |key_len, stored| callback(key_len, overflow::decode(stored)))
+        } else {
+            self.range_lookup_stored(initial_start, key_out, callback)
+        }
+    }
+
+    /// callback is invoked while holding latches and must not access the tree
+    pub fn range_lookup_desc(&self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
+        if OVERFLOW {
+            self.range_lookup_desc_stored(initial_start, key_out, &mut |key_len, stored| callback(key_len, overflow::decode(stored)))
+        } else {
+            self.range_lookup_desc_stored(initial_start, key_out, callback)
+        }
+    }
+
+    /// like `range_lookup`, but passes payloads as stored in the leaves
+    fn range_lookup_stored(&self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
+        count_op();
+        let mut start_key_buffer = [0u8; PAGE_SIZE / 4];
+        start_key_buffer[..initial_start.len()].copy_from_slice(initial_start);
+        let mut start_key_len = initial_start.len();
+        loop {
+            unsafe {
+                // range lookups may reorder leaves, so they need exclusive latches
+                let (node, parent, index) = self.descend(&start_key_buffer[..start_key_len], LeafLatch::Exclusive, true);
+                (*node).leave_notify_range_op();
+                let next = if (*node).to_leaf_mut().range_lookup(&start_key_buffer[..start_key_len], key_out, callback) && !parent.is_null() {
+                    next_leaf_start_asc((*parent).to_inner(), index, &mut start_key_buffer)
+                } else {
+                    None
+                };
+                unlatch_x(node);
+                unlatch_s(parent);
+                match next {
+                    Some(len) => start_key_len = len,
+                    None => return,
+                }
+            }
+        }
+    }
+
+    /// number of keys in [lower, upper), an absent upper bound is unbounded.
+    /// subtree counts are not maintained, so this scans the range.
+    pub fn count_range(&self, lower: &[u8], upper: Option<&[u8]>) -> u64 {
+        let mut key_buffer = [0u8; PAGE_SIZE / 4];
+        let key_out = key_buffer.as_mut_ptr();
+        let mut count = 0;
+        self.range_lookup_stored(lower, key_out, &mut |key_len, _| {
+            if upper.map_or(false, |upper| unsafe { std::slice::from_raw_parts(key_out, key_len) } >= upper) {
+                return false;
+            }
+            count += 1;
+            true
+        });
+        count
+    }
+
+    /// fills batch with the entries following the position of cursor.
+    /// descends once per batch and leaf, entries are copied while the leaf is latched.
+    pub fn cursor_next_batch(&self, cursor: &mut Cursor, batch: &mut BatchWriter) -> usize {
+        unsafe {
+            while !cursor.done {
+                // range lookups may reorder leaves, so they need exclusive latches
+                let (node, _, _) = self.descend(cursor.start(), LeafLatch::Exclusive, false);
+                (*node).leave_notify_range_op();
+                let more = cursor.scan_leaf(&mut *node, batch, OVERFLOW) && cursor.advance_past(&*node);
+                unlatch_x(node);
+                if !more {
+                    break;
+                }
+            }
+        }
+        batch.count()
+    }
+
+    /// like `range_lookup_desc`, but passes payloads as stored in the leaves
+    fn range_lookup_desc_stored(&self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
+        count_op();
+        let mut start_key_buffer = [0u8; PAGE_SIZE / 4];
+        start_key_buffer[..initial_start.len()].copy_from_slice(initial_start);
+        let mut start_key_len = initial_start.len();
+        loop {
+            unsafe {
+                let (node, parent, index) = self.descend(&start_key_buffer[..start_key_len], LeafLatch::Exclusive, true);
+                (*node).leave_notify_range_op();
+                let next = if (*node).to_leaf_mut().range_lookup_desc(&start_key_buffer[..start_key_len], key_out, callback) && !parent.is_null() {
+                    next_leaf_start_desc((*parent).to_inner(), index, &mut start_key_buffer)
+                } else {
+                    None
+                };
+                unlatch_x(node);
+                unlatch_s(parent);
+                match next {
+                    Some(len) => start_key_len = len,
+                    None => return,
+                }
+            }
+        }
+    }
+}
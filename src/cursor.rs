@@ -0,0 +1,145 @@
+use crate::{BTreeNode, PAGE_SIZE};
+use crate::b_tree::leaf_start_after;
+use crate::overflow;
+use std::{ptr, slice};
+
+/// one entry of a batch, key and payload point into the data buffer passed to `next_batch`
+#[derive(Clone, Copy, Debug)]
+#[repr(C)]
+pub struct CursorEntry {
+    pub key: *const u8,
+    pub key_len: u64,
+    pub payload: *const u8,
+    pub payload_len: u64,
+}
+
+/// copies entries into caller provided buffers
+pub struct BatchWriter<'a> {
+    entries: &'a mut [CursorEntry],
+    data: &'a mut [u8],
+    count: usize,
+    used: usize,
+}
+
+impl<'a> BatchWriter<'a> {
+    pub fn new(entries: &'a mut [CursorEntry], data: &'a mut [u8]) -> Self {
+        BatchWriter { entries, data, count: 0, used: 0 }
+    }
+
+    /// returns false if the entry does not fit
+    fn push(&mut self, key: &[u8], payload: &[u8]) -> bool {
+        let len = key.len() + payload.len();
+        if self.count == self.entries.len() || self.used + len > self.data.len() {
+            assert!(self.count > 0, "cursor data buffer cannot hold a single entry");
+            return false;
+        }
+        let dst = &mut self.data[self.used..][..len];
+        dst[..key.len()].copy_from_slice(key);
+        dst[key.len()..].copy_from_slice(payload);
+        self.entries[self.count] = CursorEntry {
+            key: dst.as_ptr(),
+            key_len: key.len() as u64,
+            payload: dst[key.len()..].as_ptr(),
+            payload_len: payload.len() as u64,
+        };
+        self.count += 1;
+        self.used += len;
+        true
+    }
+
+    pub fn count(&self) -> usize {
+        self.count
+    }
+}
+
+/// ascending scan that returns entries in batches.
+/// the cursor is not bound to a tree, but batches must be requested from the tree it was last positioned in.
+pub struct Cursor {
+    /// the next entry is the smallest key greater than or equal to start
+    start: [u8; PAGE_SIZE / 4],
+    start_len: usize,
+    /// exclusive
+    end: Option<Vec<u8>>,
+    /// hint for `BTree`, the leaf responsible for start or null
+    pub(crate) leaf: *mut BTreeNode,
+    pub(crate) done: bool,
+    key_out: [u8; PAGE_SIZE / 4],
+}
+
+impl Cursor {
+    pub fn new() -> Self {
+        Cursor {
+            start: [0; PAGE_SIZE / 4],
+            start_len: 0,
+            end: None,
+            leaf: ptr::null_mut(),
+            done: true,
+            key_out: [0; PAGE_SIZE / 4],
+        }
+    }
+
+    pub fn seek(&mut self, start: &[u8], end: Option<&[u8]>) {
+        self.start[..start.len()].copy_from_slice(start);
+        self.start_len = start.len();
+        self.end = end.map(|e| e.to_vec());
+        self.leaf = ptr::null_mut();
+        self.done = false;
+    }
+
+    pub fn start(&self) -> &[u8] {
+        &self.start[..self.start_len]
+    }
+
+    /// copies the entries of leaf starting at start into batch.
+    /// returns true if leaf is exhausted, false if the batch is full or the end was reached.
+    pub(crate) unsafe fn scan_leaf(&mut self, leaf: &mut BTreeNode, batch: &mut BatchWriter, decode_payloads: bool) -> bool {
+        let key_out = self.key_out.as_mut_ptr();
+        let end = &self.end;
+        let done = &mut self.done;
+        let mut resume_len = None;
+        let exhausted = leaf.to_leaf_mut().range_lookup(&self.start[..self.start_len], key_out, &mut |key_len, payload| {
+            let key = slice::from_raw_parts(key_out, key_len);
+            if end.as_ref().map_or(false, |end| key >= &end[..]) {
+                *done = true;
+                return false;
+            }
+            let payload = if decode_payloads { overflow::decode(payload) } else { payload };
+            if batch.push(key, payload) {
+                true
+            } else {
+                resume_len = Some(key_len);
+                false
+            }
+        });
+        if let Some(len) = resume_len {
+            // continue with the entry that did not fit
+            self.start[..len].copy_from_slice(&self.key_out[..len]);
+            self.start_len = len;
+        }
+        exhausted
+    }
+
+    /// continues at start after the cursor reached the end of a tree whose keys are all less than start.
+    /// returns false and stays done if the end of the cursor is not beyond start.
+    pub(crate) fn continue_at(&mut self, start: &[u8]) -> bool {
+        if self.end.as_ref().map_or(false, |end| &end[..] <= start) {
+            return false;
+        }
+        self.start[..start.len()].copy_from_slice(start);
+        self.start_len = start.len();
+        self.leaf = ptr::null_mut();
+        self.done = false;
+        true
+    }
+
+    /// moves start to the leaf following `leaf`, returns false if `leaf` is the last one
+    pub(crate) fn advance_past(&mut self, leaf: &BTreeNode) -> bool {
+        let fences = leaf.leaf_fences();
+        if fences.upper_fence.0.is_empty() && fences.prefix_len == 0 {
+            self.done = true;
+            return false;
+        }
+        self.start_len = leaf_start_after(leaf, &mut self.start);
+        true
+    }
+}
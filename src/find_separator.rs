@@ -1,5 +1,6 @@
 use crate::util::common_prefix_len;
 use crate::PrefixTruncatedKey;
+use crate::btree_node::APPEND;
 
 impl<'a> KeyRef<'a> for PrefixTruncatedKey<'a> {
     fn common_prefix_len(self, b: Self) -> usize {
@@ -48,7 +49,28 @@ pub fn find_separator<'a, K: KeyRef<'a>, F: FnMut(usize) -> K>(
     } else {
         (count - 1) / 2
     };
+    truncate_separator(count, best_slot, k)
+}
+
+/// like `find_separator` for leaves.
+/// if `append` is set, the key causing the split sorts after all keys in the node and the lower range receives about 90% of the keys.
+pub fn find_leaf_separator<'a, K: KeyRef<'a>, F: FnMut(usize) -> K>(
+    count: usize,
+    append: bool,
+    k: F,
+) -> (usize, K) {
+    if !APPEND || !append {
+        return find_separator(count, true, k);
+    }
+    debug_assert!(count > 1);
+    truncate_separator(count, (count * 9 / 10).min(count - 2), k)
+}
 
+fn truncate_separator<'a, K: KeyRef<'a>, F: FnMut(usize) -> K>(
+    count: usize,
+    best_slot: usize,
+    mut k: F,
+) -> (usize, K) {
     // try to truncate separator
     if best_slot + 1 < count {
         let common = k(best_slot).common_prefix_len(k(best_slot + 1));
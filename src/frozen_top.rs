@@ -0,0 +1,179 @@
+use crate::{BTreeNode, PAGE_SIZE};
+use crate::btree_node::FROZEN_LEVELS;
+use crate::util::{prefetch, trailing_bytes};
+use std::slice;
+
+/// a cache line of separator heads
+#[derive(Clone, Copy)]
+#[repr(align(64))]
+struct HeadLine([u64; 8]);
+
+/// read optimized copy of the separators in the top `FROZEN_LEVELS` inner levels of a `BTree`.
+/// maps a key directly to the node below those levels that is responsible for it.
+/// only nodes that are inner nodes themselves are indexed, so descents from them still report the parent of the leaf.
+/// the index is dropped whenever an inner node is split or merged and rebuilt once enough descents went through the tree.
+pub struct FrozenTop {
+    /// separator heads in eytzinger order starting at index 1, padded with u64::MAX
+    heads: Vec<HeadLine>,
+    /// rank of the separator at each eytzinger index
+    ranks: Vec<u32>,
+    /// full length separators in ascending order with their heads
+    separators: Vec<(u64, Box<[u8]>)>,
+    /// the node responsible for keys between separator i-1 and i
+    targets: Vec<*mut BTreeNode>,
+    valid: bool,
+    /// descents since the index was dropped
+    stale_descents: usize,
+}
+
+/// the first 8 bytes of key in big endian, zero padded.
+/// if the heads of two keys differ, they are ordered like the keys.
+fn key_head(key: &[u8]) -> u64 {
+    let mut bytes = [0u8; 8];
+    let len = key.len().min(8);
+    bytes[..len].copy_from_slice(&key[..len]);
+    u64::from_be_bytes(bytes)
+}
+
+impl FrozenTop {
+    pub fn new() -> Self {
+        FrozenTop {
+            heads: Vec::new(),
+            ranks: Vec::new(),
+            separators: Vec::new(),
+            targets: Vec::new(),
+            valid: false,
+            stale_descents: 0,
+        }
+    }
+
+    /// must be called before an inner node of the tree is split, merged, or freed
+    pub fn invalidate(&mut self) {
+        self.valid = false;
+        self.stale_descents = 0;
+    }
+
+    /// returns the indexed node responsible for key, or None if there is no index.
+    /// rebuilds the index if it was invalidated at least as many descents ago as it has targets, which amortizes the rebuild.
+    pub unsafe fn find(&mut self, root: *mut BTreeNode, key: &[u8]) -> Option<*mut BTreeNode> {
+        if FROZEN_LEVELS == 0 {
+            return None;
+        }
+        if !self.valid {
+            self.stale_descents += 1;
+            if self.stale_descents < self.targets.len().max(64) {
+                return None;
+            }
+            self.rebuild(root);
+            if !self.valid {
+                return None;
+            }
+        }
+        Some(self.targets[self.child_index(key)])
+    }
+
+    /// like `find` for every key, writes the start node of each key to nodes.
+    /// either all or none of them are indexed nodes, so they are on the same level.
+    pub unsafe fn find_batch(&mut self, root: *mut BTreeNode, keys: &[&[u8]], nodes: &mut [*mut BTreeNode]) {
+        debug_assert_eq!(keys.len(), nodes.len());
+        if keys.is_empty() {
+            return;
+        }
+        if let Some(first) = self.find(root, keys[0]) {
+            nodes[0] = first;
+            for (key, node) in keys[1..].iter().zip(nodes[1..].iter_mut()) {
+                *node = self.targets[self.child_index(key)];
+            }
+        } else {
+            nodes.fill(root);
+        }
+    }
+
+    /// number of separators less than key
+    fn child_index(&self, key: &[u8]) -> usize {
+        let head = key_head(key);
+        let heads = unsafe { slice::from_raw_parts(self.heads.as_ptr() as *const u64, self.heads.len() * 8) };
+        let n = self.separators.len();
+        let mut k = 1;
+        while k <= n {
+            // the descendants three levels down share a cache line
+            prefetch(heads.as_ptr().wrapping_add(8 * k));
+            k = 2 * k + (heads[k] < head) as usize;
+        }
+        // undo the right turns after the last left turn, which was at the first head not less than head
+        k >>= k.trailing_ones() + 1;
+        let mut rank = if k == 0 { n } else { self.ranks[k] as usize };
+        // separators with the same head have to be compared in full
+        while rank < n && self.separators[rank].0 == head && &self.separators[rank].1[..] < key {
+            rank += 1;
+        }
+        rank
+    }
+
+    unsafe fn rebuild(&mut self, root: *mut BTreeNode) {
+        self.stale_descents = 0;
+        self.separators.clear();
+        self.targets.clear();
+        let mut height = 0;
+        let mut node = root;
+        while (*node).tag().is_inner() {
+            node = (*node).to_inner().get_child(0);
+            height += 1;
+        }
+        // indexed nodes must be above the leaves
+        let levels = FROZEN_LEVELS.min(height.saturating_sub(1));
+        if levels == 0 {
+            return;
+        }
+        collect(root, &[], &[], levels, &mut self.separators, &mut self.targets);
+        let n = self.separators.len();
+        let line_count = (n + 1 + 7) / 8;
+        self.heads.clear();
+        self.heads.resize(line_count, HeadLine([u64::MAX; 8]));
+        self.ranks.clear();
+        self.ranks.resize(n + 1, 0);
+        let heads = slice::from_raw_parts_mut(self.heads.as_mut_ptr() as *mut u64, line_count * 8);
+        fill_eytzinger(&self.separators, heads, &mut self.ranks, 0, 1);
+        self.valid = true;
+    }
+}
+
+/// appends the full length separators of the top `levels` levels below node to separators and the nodes below them to targets.
+/// node has the full length fences lower and upper.
+unsafe fn collect(node: *mut BTreeNode, lower: &[u8], upper: &[u8], levels: usize, separators: &mut Vec<(u64, Box<[u8]>)>, targets: &mut Vec<*mut BTreeNode>) {
+    if levels == 0 {
+        targets.push(node);
+        return;
+    }
+    let inner = (*node).to_inner();
+    let key_count = inner.key_count();
+    let prefix_len = inner.fences().prefix_len;
+    let prefix = if lower.is_empty() { &upper[..prefix_len] } else { &lower[..prefix_len] };
+    let mut key_buffer = [0u8; PAGE_SIZE / 4];
+    let mut child_lower: Box<[u8]> = lower.into();
+    for i in 0..=key_count {
+        let child_upper: Box<[u8]> = if i < key_count {
+            let len = inner.get_key(i, &mut key_buffer, 0).unwrap();
+            [prefix, trailing_bytes(&key_buffer, len)].concat().into_boxed_slice()
+        } else {
+            upper.into()
+        };
+        collect(inner.get_child(i), &child_lower, &child_upper, levels - 1, separators, targets);
+        if i < key_count {
+            separators.push((key_head(&child_upper), child_upper.clone()));
+        }
+        child_lower = child_upper;
+    }
+}
+
+/// writes the heads of sorted to the eytzinger subtree rooted at k, starting with the element at rank.
+/// returns the rank following the subtree.
+fn fill_eytzinger(sorted: &[(u64, Box<[u8]>)], heads: &mut [u64], ranks: &mut [u32], mut rank: usize, k: usize) -> usize {
+    if k <= sorted.len() {
+        rank = fill_eytzinger(sorted, heads, ranks, rank, 2 * k);
+        heads[k] = sorted[rank].0;
+        ranks[k] = rank as u32;
+        rank = fill_eytzinger(sorted, heads, ranks, rank + 1, 2 * k + 1);
+    }
+    rank
+}
@@ -1,6 +1,6 @@
-use crate::find_separator::find_separator;
+use crate::find_separator::find_leaf_separator;
 use crate::node_traits::{FenceData, FenceRef, InnerConversionSource, InnerNode, LeafNode, Node};
-use crate::util::{head, MergeFences, partial_restore, reinterpret_mut, short_slice, SplitFences};
+use crate::util::{entry_lengths, head, MergeFences, partial_restore, reinterpret_mut, short_slice, SplitFences};
 use crate::{BTreeNode, FatTruncatedKey, PAGE_SIZE, PrefixTruncatedKey};
 use std::io::Write;
 use std::mem::{align_of, ManuallyDrop, MaybeUninit, size_of, transmute};
@@ -70,23 +70,15 @@ const SIMD_ALIGN: usize = 64;
 impl HashLeaf {
     pub fn space_needed(&self, key_length: usize, payload_length: usize) -> usize {
         assert!(SLOTS_FIRST);
-        let head_growth = if USE_SIMD {
-            SIMD_ALIGN.max(size_of::<HashSlot>()) + 1
-        } else {
-            size_of::<HashSlot>() + 1
-        };
+        let head_growth = size_of::<HashSlot>() + 1;
         key_length - self.head.prefix_len as usize + payload_length + head_growth
     }
 
     fn layout(count: usize) -> LayoutInfo {
         debug_assert!(SLOTS_FIRST);
         let slots_start = size_of::<HashLeafHead>();
+        // unaligned, find_simd uses unaligned loads
         let hash_start = slots_start + size_of::<HashSlot>() * count;
-        let hash_start = if USE_SIMD {
-            hash_start.next_multiple_of(SIMD_ALIGN)
-        } else {
-            hash_start
-        };
         let data_start = hash_start + count;
         LayoutInfo {
             slots_start,
@@ -105,6 +97,15 @@ impl HashLeaf {
             - self.head.space_used as usize
     }
 
+    pub fn entry_count(&self) -> usize {
+        self.head.count as usize
+    }
+
+    /// entry count, total stored key length, and total payload length
+    pub fn entry_lengths(&self) -> (usize, usize, usize) {
+        entry_lengths(self.slots().iter().map(|s| (s.key_len, s.val_len)))
+    }
+
     pub fn as_bytes(&self) -> &[u8; PAGE_SIZE] {
         assert_eq!(PAGE_SIZE, size_of::<Self>());
         unsafe { transmute(self as *const Self) }
@@ -277,7 +278,7 @@ impl HashLeaf {
         );
     }
 
-    fn set_fences(
+    pub fn set_fences(
         &mut self,
         fences @ FenceData {
             lower_fence,
@@ -372,38 +373,34 @@ impl HashLeaf {
     }
 
     fn find_simd(&self, key: PrefixTruncatedKey, needle_hash: u8) -> Option<usize> {
-        unsafe {
-            use std::simd::ToBitMask;
-            type SimdDtype = std::simd::Simd<u8, SIMD_WIDTH>;
-            let count = self.head.count as usize;
-            let mut hash_ptr = (self as *const Self as *const u8)
-                .offset(Self::layout(count).hash_start as isize)
-                as *const SimdDtype;
-            let needle = SimdDtype::splat(needle_hash);
-            debug_assert!(hash_ptr.is_aligned());
-            let mut shift = 0;
-            while shift < count {
-                let candidates = *(hash_ptr);
-                let mut matches = candidates.simd_eq(needle).to_bitmask();
-                loop {
-                    let trailing_zeros = matches.trailing_zeros();
-                    if trailing_zeros == SIMD_WIDTH as u32 {
-                        shift = shift - shift % SIMD_WIDTH + SIMD_WIDTH;
-                        hash_ptr = hash_ptr.offset(1);
-                        break;
-                    } else {
-                        shift += trailing_zeros as usize;
-                        matches >>= trailing_zeros;
-                        matches = matches & !1;
-                        if shift >= count {
-                            return None;
-                        }
-                        if self.slots()[shift].key(self.as_bytes()) == key {
-                            return Some(shift);
-                        }
-                    }
+        use std::simd::ToBitMask;
+        type SimdDtype = std::simd::Simd<u8, SIMD_WIDTH>;
+        let count = self.head.count as usize;
+        let hash_start = Self::layout(count).hash_start;
+        let needle = SimdDtype::splat(needle_hash);
+        let mut base = 0;
+        while base < count {
+            let remaining = count - base;
+            let candidates = if hash_start + base + SIMD_WIDTH <= PAGE_SIZE {
+                // may read past the hash array, those lanes are masked below
+                unsafe { ptr::read_unaligned(self.as_bytes().as_ptr().add(hash_start + base) as *const SimdDtype) }
+            } else {
+                let mut tail = [0u8; SIMD_WIDTH];
+                tail[..remaining].copy_from_slice(&self.as_bytes()[hash_start + base..][..remaining]);
+                SimdDtype::from_array(tail)
+            };
+            let mut matches = candidates.simd_eq(needle).to_bitmask() as u64;
+            if remaining < SIMD_WIDTH {
+                matches &= (1u64 << remaining) - 1;
+            }
+            while matches != 0 {
+                let index = base + matches.trailing_zeros() as usize;
+                if self.slots()[index].key(self.as_bytes()) == key {
+                    return Some(index);
                 }
+                matches &= matches - 1;
             }
+            base += SIMD_WIDTH;
         }
         None
     }
@@ -630,15 +627,17 @@ unsafe impl Node for HashLeaf {
         self.sort();
 
         // split
+        let count = self.head.count as usize;
+        let append = &key_in_self[self.head.prefix_len as usize..] > self.slots()[count - 1].key(self.as_bytes()).0;
         let (sep_slot, truncated_sep_key) =
-            find_separator(self.head.count as usize, true, |i: usize| {
+            find_leaf_separator(count, append, |i: usize| {
                 self.slots()[i].key(self.as_bytes())
             });
         let full_sep_key_len = truncated_sep_key.0.len() + self.head.prefix_len as usize;
         let parent_prefix_len = parent.request_space_for_child(full_sep_key_len)?;
         let node_left_raw;
         let node_left = unsafe {
-            node_left_raw = BTreeNode::alloc();
+            node_left_raw = BTreeNode::alloc(BTreeNode::layout(self as *const Self as *const BTreeNode));
             (*node_left_raw).hash_leaf = ManuallyDrop::new(Self::new());
             &mut (*node_left_raw).hash_leaf
         };
@@ -654,6 +653,7 @@ unsafe impl Node for HashLeaf {
                 BTreeNode::dealloc(node_left_raw);
                 return Err(());
             }
+            BTreeNode::link_leaf_before(node_left_raw, self as *mut Self as *mut BTreeNode);
         }
         self.copy_key_value_range(&self.slots()[..=sep_slot], node_left);
         self.copy_key_value_range(&self.slots()[sep_slot + 1..], &mut node_right);
@@ -771,8 +771,10 @@ unsafe impl LeafNode for HashLeaf {
         self.sort();
         debug_assert!(!key_out.is_null());
         key_out.copy_from_nonoverlapping(start.as_ptr(), self.head.prefix_len as usize);
-        let start_index = self.lower_bound(self.truncate(start)).0.min(self.head.count as usize - 1);
-        for s in self.slots()[..=start_index].iter().rev() {
+        // largest key less than or equal to start
+        let (lower_bound, found) = self.lower_bound(self.truncate(start));
+        let end_index = if found { lower_bound + 1 } else { lower_bound };
+        for s in self.slots()[..end_index].iter().rev() {
             let k = s.key(self.as_bytes());
             key_out.offset(self.head.prefix_len as isize).copy_from_nonoverlapping(k.0.as_ptr(), k.0.len());
             if !callback((s.key_len + self.head.prefix_len) as usize, s.value(self.as_bytes())) {
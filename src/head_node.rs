@@ -1,4 +1,4 @@
-use crate::basic_node::BasicNode;
+use crate::basic_node::{BasicNode, inner_value, INNER_VALUE_LEN};
 use crate::find_separator::{find_separator, KeyRef};
 use crate::node_traits::{FenceData, FenceRef, InnerConversionSink, InnerConversionSource, InnerNode, merge, Node, SeparableInnerConversionSource, split_in_place};
 use crate::util::{
@@ -13,7 +13,7 @@ use std::{mem, ptr};
 use std::ops::Range;
 use bytemuck::{bytes_of, bytes_of_mut, Pod};
 use crate::branch_cache::BranchCacheAccessor;
-use crate::btree_node::{AdaptionState, BTreeNodeHead};
+use crate::btree_node::{AdaptionState, BTreeNodeHead, SUBTREE_COUNTS};
 use crate::vtables::BTreeNodeTag;
 
 pub type U64ExplicitHeadNode = HeadNode<ExplicitLengthHead<u64>>;
@@ -27,6 +27,9 @@ const HEAD_EARLY_ABORT_CREATE: bool = true;
 #[cfg(feature = "head-early-abort-create_false")]
 const HEAD_EARLY_ABORT_CREATE: bool = false;
 
+/// rank needles among integer heads using simd comparisons instead of binary search
+const HEAD_SIMD: bool = cfg!(feature = "head-simd_true");
+
 pub trait FullKeyHeadNoTag: Ord + Sized + Copy + KeyRef<'static> + Debug + 'static {
     const HINT_COUNT: usize;
     const MAX_LEN: usize;
@@ -34,6 +37,10 @@ pub trait FullKeyHeadNoTag: Ord + Sized + Copy + KeyRef<'static> + Debug + 'stat
     fn make_fence_head(key: PrefixTruncatedKey) -> Option<Self>;
     fn make_needle_head(key: PrefixTruncatedKey) -> Self;
     fn restore(self) -> SmallVec<[u8; 16]>;
+    /// number of heads less than needle, heads must be sorted
+    fn rank(heads: &[Self], needle: Self) -> usize {
+        heads.partition_point(|&h| h < needle)
+    }
     fn strip_prefix(self, prefix_len: usize) -> Self {
         let mut v = self.restore();
         v.drain(..prefix_len);
@@ -52,11 +59,36 @@ pub unsafe trait UnsignedInt: Debug + Copy + Ord + Pod + 'static {
     fn swap_big_native_endian(self) -> Self;
     #[must_use]
     fn inc(self) -> Self;
+    /// number of elements less than needle, haystack must be sorted
+    fn rank(haystack: &[Self], needle: Self) -> usize;
+}
+
+/// compares one 64 byte vector at a time, stops at the first vector not entirely less than needle
+macro_rules! simd_rank {
+    ($t:ty) => {
+        fn rank(haystack: &[Self], needle: Self) -> usize {
+            use std::simd::{Simd, SimdPartialOrd, ToBitMask};
+            const LANES: usize = 64 / size_of::<$t>();
+            let needle_vector = Simd::<$t, LANES>::splat(needle);
+            let mut chunks = haystack.chunks_exact(LANES);
+            let mut rank = 0;
+            for chunk in &mut chunks {
+                let less = Simd::<$t, LANES>::from_slice(chunk).simd_lt(needle_vector).to_bitmask().count_ones() as usize;
+                rank += less;
+                if less < LANES {
+                    return rank;
+                }
+            }
+            rank + chunks.remainder().iter().take_while(|&&x| x < needle).count()
+        }
+    };
 }
 
 unsafe impl UnsignedInt for u64 {
     const BYTE_LEN: usize = 8;
 
+    simd_rank!(u64);
+
     fn swap_big_native_endian(self) -> Self {
         self.to_be()
     }
@@ -69,6 +101,8 @@ unsafe impl UnsignedInt for u64 {
 unsafe impl UnsignedInt for u32 {
     const BYTE_LEN: usize = 4;
 
+    simd_rank!(u32);
+
     fn swap_big_native_endian(self) -> Self {
         self.to_be()
     }
@@ -175,6 +209,11 @@ impl<T: UnsignedInt> FullKeyHeadNoTag for ExplicitLengthHead<T> {
     const HINT_COUNT: usize = 16;
     const MAX_LEN: usize = T::BYTE_LEN - 1;
 
+    fn rank(heads: &[Self], needle: Self) -> usize {
+        // repr(transparent)
+        T::rank(unsafe { std::slice::from_raw_parts(heads.as_ptr() as *const T, heads.len()) }, needle.0)
+    }
+
     fn make_fence_head(key: PrefixTruncatedKey) -> Option<Self> {
         let mut ret = T::zeroed();
         let bytes = bytes_of_mut(&mut ret);
@@ -216,6 +255,11 @@ impl<T: UnsignedInt> FullKeyHeadNoTag for ZeroPaddedHead<T> {
     const HINT_COUNT: usize = 16;
     const MAX_LEN: usize = T::BYTE_LEN;
 
+    fn rank(heads: &[Self], needle: Self) -> usize {
+        // repr(transparent)
+        T::rank(unsafe { std::slice::from_raw_parts(heads.as_ptr() as *const T, heads.len()) }, needle.0)
+    }
+
     fn make_fence_head(key: PrefixTruncatedKey) -> Option<Self> {
         let mut ret = T::zeroed();
         let bytes = bytes_of_mut(&mut ret);
@@ -421,15 +465,15 @@ impl<Head: FullKeyHead> HeadNode<Head> {
 
         let child_end = lower_fence_offset - lower_fence_offset % child_align;
         let available_size = child_end - Self::KEY_OFFSET;
-        let key_capacity = (available_size - size_of::<*mut BTreeNode>())
-            / (size_of::<Head>() + size_of::<*mut BTreeNode>());
-        let child_offset = child_end - size_of::<*mut BTreeNode>() * (key_capacity + 1);
+        let key_capacity = (available_size - Self::CHILD_SIZE)
+            / (size_of::<Head>() + Self::CHILD_SIZE);
+        let child_offset = child_end - Self::CHILD_SIZE * (key_capacity + 1);
 
         debug_assert!(child_offset % child_align == 0);
         debug_assert!(self as *const Self as usize % child_align == 0);
         debug_assert!(Self::KEY_OFFSET + key_capacity * size_of::<Head>() <= child_offset);
         debug_assert!(
-            child_offset + (key_capacity + 1) * size_of::<*mut BTreeNode>() <= lower_fence_offset
+            child_offset + (key_capacity + 1) * Self::CHILD_SIZE <= lower_fence_offset
         );
 
         self.head.key_capacity = key_capacity as u16;
@@ -438,6 +482,30 @@ impl<Head: FullKeyHead> HeadNode<Head> {
 
     const KEY_OFFSET: usize = { Self::HINT_OFFSET + Head::HINT_COUNT * size_of::<Head>() };
 
+    /// space per child, the subtree counts follow the child pointers if SUBTREE_COUNTS is set
+    const CHILD_SIZE: usize = size_of::<*mut BTreeNode>() + if SUBTREE_COUNTS { size_of::<u64>() } else { 0 };
+
+    /// parallel to the children, empty unless SUBTREE_COUNTS is set
+    fn child_counts(&self) -> &[u64] {
+        let len = if SUBTREE_COUNTS { self.head.key_capacity as usize + 1 } else { 0 };
+        unsafe {
+            let counts = (self as *const Self as *const u8)
+                .offset(self.head.child_offset as isize + (size_of::<*mut BTreeNode>() * (self.head.key_capacity as usize + 1)) as isize)
+                as *const u64;
+            std::slice::from_raw_parts(counts, len)
+        }
+    }
+
+    fn child_counts_mut(&mut self) -> &mut [u64] {
+        let len = if SUBTREE_COUNTS { self.head.key_capacity as usize + 1 } else { 0 };
+        unsafe {
+            let counts = (self as *mut Self as *mut u8)
+                .offset(self.head.child_offset as isize + (size_of::<*mut BTreeNode>() * (self.head.key_capacity as usize + 1)) as isize)
+                as *mut u64;
+            std::slice::from_raw_parts_mut(counts, len)
+        }
+    }
+
     const HINT_OFFSET: usize = {
         let key_align = align_of::<Head>();
         size_of::<HeadNodeHead>().next_multiple_of(key_align)
@@ -510,8 +578,8 @@ impl<Head: FullKeyHead> HeadNode<Head> {
         child: *mut BTreeNode,
     ) -> Result<(), ()> {
         let prefix_len = dst.fences().prefix_len;
-        dst.request_space(dst.space_needed(key.len() + prefix_len, size_of::<*mut BTreeNode>()))?;
-        dst.raw_insert(slot, key, &(child as usize).to_ne_bytes());
+        dst.request_space(dst.space_needed(key.len() + prefix_len, INNER_VALUE_LEN))?;
+        dst.raw_insert(slot, key, &inner_value(child, 0)[..INNER_VALUE_LEN]);
         Ok(())
     }
 
@@ -525,6 +593,10 @@ impl<Head: FullKeyHead> HeadNode<Head> {
     }
 
     pub fn remove_slot(&mut self, index: usize) {
+        let key_count = self.head.key_count as usize;
+        if SUBTREE_COUNTS {
+            self.child_counts_mut().copy_within(index + 1..key_count + 1, index);
+        }
         let (head, keys, children, _) = self.as_parts_mut();
         keys.copy_within(index + 1..head.key_count as usize, index);
         children.copy_within(index + 1..head.key_count as usize + 1, index);
@@ -575,6 +647,12 @@ unsafe impl<Head: FullKeyHead> InnerConversionSink for HeadNode<Head> {
         for i in 0..len + 1 {
             children[i] = src.get_child(i);
         }
+        if SUBTREE_COUNTS {
+            let counts = this.child_counts_mut();
+            for i in 0..len + 1 {
+                counts[i] = src.get_child_count(i);
+            }
+        }
         this.update_hint(0);
         Ok(())
     }
@@ -603,6 +681,11 @@ impl<Head: FullKeyHead> InnerConversionSource for HeadNode<Head> {
         self.as_parts().2[index]
     }
 
+    fn get_child_count(&self, index: usize) -> u64 {
+        debug_assert!(index < self.head.key_count as usize + 1);
+        if SUBTREE_COUNTS { self.child_counts()[index] } else { 0 }
+    }
+
     fn get_key(&self, index: usize, dst: &mut [u8], strip_prefix: usize) -> Result<usize, ()> {
         debug_assert!(index < self.head.key_count as usize);
         //TODO avoidable copy
@@ -702,8 +785,12 @@ impl<Head: FullKeyHead> InnerNode for HeadNode<Head> {
         })
             .unwrap_or_else(|| {
                 let (lower, upper) = self.search_hint(needle_head);
-                match self.as_parts().1[lower..upper].binary_search(&needle_head) {
-                    Ok(i) | Err(i) => lower + i,
+                if HEAD_SIMD {
+                    lower + Head::rank(&self.as_parts().1[lower..upper], needle_head)
+                } else {
+                    match self.as_parts().1[lower..upper].binary_search(&needle_head) {
+                        Ok(i) | Err(i) => lower + i,
+                    }
                 }
             });
         bc.store(index);
@@ -758,6 +845,12 @@ impl<Head: FullKeyHead> InnerNode for HeadNode<Head> {
     ) -> Result<(), ()> {
         debug_assert!(self.head.key_count < self.head.key_capacity);
         if let Some(key) = Head::make_fence_head(key) {
+            if SUBTREE_COUNTS {
+                let key_count = self.head.key_count as usize;
+                let counts = self.child_counts_mut();
+                counts[..key_count + 2].copy_within(index..key_count + 1, index + 1);
+                counts[index] = 0;
+            }
             let (head, keys, children, _) = self.as_parts_mut();
             keys[..head.key_count as usize + 1]
                 .copy_within(index..head.key_count as usize, index + 1);
@@ -786,4 +879,11 @@ impl<Head: FullKeyHead> InnerNode for HeadNode<Head> {
             Err(())
         }
     }
+
+    fn set_child_count(&mut self, index: usize, count: u64) {
+        debug_assert!(index < self.head.key_count as usize + 1);
+        if SUBTREE_COUNTS {
+            self.child_counts_mut()[index] = count;
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,587 @@
+use crate::basic_node::{BasicNode, BasicNodeHead, BasicSlot, FenceKeySlot};
+use crate::btree_node::{AdaptionState, BTreeNodeHead};
+use crate::find_separator::find_leaf_separator;
+use crate::head_node::UnsignedInt;
+use crate::node_traits::{FenceData, FenceRef, InnerConversionSource, InnerNode, LeafNode, Node};
+use crate::util::{reinterpret_mut, short_slice, SplitFences};
+use crate::vtables::BTreeNodeTag;
+use crate::{BTreeNode, PAGE_SIZE, PrefixTruncatedKey};
+use bytemuck::{bytes_of, bytes_of_mut};
+use std::marker::PhantomData;
+use std::mem::{size_of, transmute};
+use std::ops::Range;
+use std::ptr;
+
+/// leaves may be converted to int leaves by leaf adaption
+pub const INT_LEAF: bool = cfg!(feature = "int-leaf_true");
+
+#[derive(Clone, Copy, Debug)]
+pub struct PayloadSlot {
+    offset: u16,
+    len: u16,
+}
+
+#[derive(Clone, Copy, Debug)]
+#[repr(C)]
+struct IntLeafHead {
+    head: BTreeNodeHead,
+    count: u16,
+    /// length of every key after the prefix
+    key_len: u16,
+    lower_fence: FenceKeySlot,
+    upper_fence: FenceKeySlot,
+    space_used: u16,
+    data_offset: u16,
+    prefix_len: u16,
+}
+
+const DATA_SIZE: usize = PAGE_SIZE - size_of::<IntLeafHead>();
+const KEYS_START: usize = (size_of::<IntLeafHead>() + 7) / 8 * 8;
+
+/// leaf for keys that have the same length of at most `K::BYTE_LEN` bytes after the prefix.
+/// keys are stored as a dense sorted array of zero padded big endian integers, which is searched with `UnsignedInt::rank`.
+/// the payload slots follow the keys, payloads and fences are stored at the end of the page.
+#[derive(Clone, Copy)]
+#[repr(C)]
+#[repr(align(8))]
+pub struct IntLeaf<K: UnsignedInt> {
+    head: IntLeafHead,
+    data: [u8; DATA_SIZE],
+    _key: PhantomData<K>,
+}
+
+pub type IntLeaf32 = IntLeaf<u32>;
+pub type IntLeaf64 = IntLeaf<u64>;
+
+pub fn is_int_leaf(tag: BTreeNodeTag) -> bool {
+    tag == BTreeNodeTag::IntLeaf32 || tag == BTreeNodeTag::IntLeaf64
+}
+
+/// rewrites an int leaf of either width as a basic leaf
+pub fn int_leaf_to_basic(node: &mut BTreeNode) -> Result<(), ()> {
+    match node.tag() {
+        BTreeNodeTag::IntLeaf32 => IntLeaf32::to_basic(node),
+        BTreeNodeTag::IntLeaf64 => IntLeaf64::to_basic(node),
+        _ => unreachable!(),
+    }
+}
+
+/// rewrites a basic leaf as the narrowest int leaf its keys fit into, returns false if they do not
+pub fn basic_to_int_leaf(node: &mut BTreeNode) -> bool {
+    IntLeaf32::try_from_basic(node) || IntLeaf64::try_from_basic(node)
+}
+
+struct LayoutInfo {
+    slots_start: usize,
+    data_start: usize,
+}
+
+impl<K: UnsignedInt> IntLeaf<K> {
+    fn tag() -> BTreeNodeTag {
+        match K::BYTE_LEN {
+            4 => BTreeNodeTag::IntLeaf32,
+            8 => BTreeNodeTag::IntLeaf64,
+            _ => unreachable!(),
+        }
+    }
+
+    pub fn new(key_len: usize) -> Self {
+        assert_eq!(size_of::<Self>(), PAGE_SIZE);
+        debug_assert!(key_len <= K::BYTE_LEN);
+        IntLeaf {
+            head: IntLeafHead {
+                head: BTreeNodeHead { tag: Self::tag(), adaption_state: AdaptionState::new() },
+                count: 0,
+                key_len: key_len as u16,
+                lower_fence: FenceKeySlot { offset: 0, len: 0 },
+                upper_fence: FenceKeySlot { offset: 0, len: 0 },
+                space_used: 0,
+                data_offset: PAGE_SIZE as u16,
+                prefix_len: 0,
+            },
+            data: [0u8; DATA_SIZE],
+            _key: PhantomData,
+        }
+    }
+
+    fn layout(count: usize) -> LayoutInfo {
+        let slots_start = KEYS_START + count * size_of::<K>();
+        LayoutInfo {
+            slots_start,
+            data_start: slots_start + count * size_of::<PayloadSlot>(),
+        }
+    }
+
+    pub fn as_bytes(&self) -> &[u8; PAGE_SIZE] {
+        unsafe { transmute(self as *const Self) }
+    }
+
+    unsafe fn as_bytes_mut(&mut self) -> &mut [u8; PAGE_SIZE] {
+        transmute(self as *mut Self)
+    }
+
+    pub fn keys(&self) -> &[K] {
+        unsafe {
+            std::slice::from_raw_parts(
+                (self as *const Self as *const u8).add(KEYS_START) as *const K,
+                self.head.count as usize,
+            )
+        }
+    }
+
+    fn keys_mut(&mut self) -> &mut [K] {
+        unsafe {
+            std::slice::from_raw_parts_mut(
+                (self as *mut Self as *mut u8).add(KEYS_START) as *mut K,
+                self.head.count as usize,
+            )
+        }
+    }
+
+    fn slots(&self) -> &[PayloadSlot] {
+        let count = self.head.count as usize;
+        unsafe {
+            std::slice::from_raw_parts(
+                (self as *const Self as *const u8).add(Self::layout(count).slots_start) as *const PayloadSlot,
+                count,
+            )
+        }
+    }
+
+    fn slots_mut(&mut self) -> &mut [PayloadSlot] {
+        let count = self.head.count as usize;
+        unsafe {
+            std::slice::from_raw_parts_mut(
+                (self as *mut Self as *mut u8).add(Self::layout(count).slots_start) as *mut PayloadSlot,
+                count,
+            )
+        }
+    }
+
+    fn payload(&self, index: usize) -> &[u8] {
+        let slot = self.slots()[index];
+        short_slice(self.as_bytes(), slot.offset, slot.len)
+    }
+
+    pub fn entry_count(&self) -> usize {
+        self.head.count as usize
+    }
+
+    /// entry count, total stored key length, and total payload length
+    pub fn entry_lengths(&self) -> (usize, usize, usize) {
+        let count = self.head.count as usize;
+        (count, count * self.head.key_len as usize, self.slots().iter().map(|s| s.len as usize).sum())
+    }
+
+    fn free_space(&self) -> usize {
+        self.head.data_offset as usize - Self::layout(self.head.count as usize).data_start
+    }
+
+    pub fn free_space_after_compaction(&self) -> usize {
+        PAGE_SIZE
+            - Self::layout(self.head.count as usize).data_start
+            - self.head.space_used as usize
+    }
+
+    fn request_space(&mut self, space: usize) -> Result<(), ()> {
+        if space <= self.free_space() {
+            Ok(())
+        } else if space <= self.free_space_after_compaction() {
+            self.compactify();
+            Ok(())
+        } else {
+            Err(())
+        }
+    }
+
+    /// fences are written first, so they stay at the end of the page
+    fn compactify(&mut self) {
+        let mut buffer = [0u8; PAGE_SIZE];
+        let fences_len = self.head.lower_fence.len as usize + self.head.upper_fence.len as usize;
+        let new_data_offset = PAGE_SIZE - self.head.space_used as usize;
+        let mut write = PAGE_SIZE - fences_len;
+        for i in 0..self.head.count as usize {
+            let payload = self.payload(i);
+            write -= payload.len();
+            buffer[write..][..payload.len()].copy_from_slice(payload);
+            self.slots_mut()[i].offset = write as u16;
+        }
+        debug_assert_eq!(write, new_data_offset);
+        let range = new_data_offset..PAGE_SIZE - fences_len;
+        unsafe { self.as_bytes_mut()[range.clone()].copy_from_slice(&buffer[range]) };
+        self.head.data_offset = new_data_offset as u16;
+    }
+
+    fn write_data(&mut self, d: &[u8]) -> u16 {
+        self.head.data_offset -= d.len() as u16;
+        self.head.space_used += d.len() as u16;
+        self.assert_no_collide();
+        let offset = self.head.data_offset;
+        unsafe {
+            self.as_bytes_mut()[offset as usize..][..d.len()].copy_from_slice(d);
+        }
+        offset
+    }
+
+    fn assert_no_collide(&self) {
+        debug_assert!(
+            Self::layout(self.head.count as usize).data_start <= self.head.data_offset as usize
+        );
+    }
+
+    pub fn set_fences(
+        &mut self,
+        fences @ FenceData {
+            lower_fence,
+            upper_fence,
+            prefix_len,
+        }: FenceData,
+    ) {
+        fences.validate();
+        self.head.prefix_len = prefix_len as u16;
+        self.head.lower_fence = FenceKeySlot {
+            offset: self.write_data(lower_fence.0),
+            len: (lower_fence.0.len()) as u16,
+        };
+        self.head.upper_fence = FenceKeySlot {
+            offset: self.write_data(upper_fence.0),
+            len: (upper_fence.0.len()) as u16,
+        };
+    }
+
+    pub fn fences(&self) -> FenceData {
+        FenceData {
+            lower_fence: FenceRef(short_slice(
+                self.as_bytes(),
+                self.head.lower_fence.offset,
+                self.head.lower_fence.len,
+            )),
+            upper_fence: FenceRef(short_slice(
+                self.as_bytes(),
+                self.head.upper_fence.offset,
+                self.head.upper_fence.len,
+            )),
+            prefix_len: self.head.prefix_len as usize,
+        }
+    }
+
+    fn prefix<'a>(&self, key_in_node: &'a [u8]) -> &'a [u8] {
+        &key_in_node[..self.head.prefix_len as usize]
+    }
+
+    pub fn truncate<'a>(&self, key: &'a [u8]) -> PrefixTruncatedKey<'a> {
+        PrefixTruncatedKey(&key[self.head.prefix_len as usize..])
+    }
+
+    /// bytes zero padded to `K::BYTE_LEN` as a big endian integer
+    fn needle(bytes: &[u8]) -> K {
+        let mut x = K::zeroed();
+        bytes_of_mut(&mut x)[..bytes.len()].copy_from_slice(bytes);
+        x.swap_big_native_endian()
+    }
+
+    /// writes the truncated key at index to dst
+    unsafe fn write_key(&self, index: usize, dst: *mut u8) {
+        let x = self.keys()[index].swap_big_native_endian();
+        dst.copy_from_nonoverlapping(bytes_of(&x).as_ptr(), self.head.key_len as usize);
+    }
+
+    /// number of keys less than or equal to needle
+    fn count_le(&self, needle: K) -> usize {
+        let keys = self.keys();
+        let rank = K::rank(keys, needle);
+        rank + (rank < keys.len() && keys[rank] == needle) as usize
+    }
+
+    fn find_index(&self, key: PrefixTruncatedKey) -> Option<usize> {
+        if key.0.len() != self.head.key_len as usize {
+            return None;
+        }
+        let needle = Self::needle(key.0);
+        let index = K::rank(self.keys(), needle);
+        if index < self.head.count as usize && self.keys()[index] == needle {
+            Some(index)
+        } else {
+            None
+        }
+    }
+
+    /// number of keys less than key, which may have any length
+    fn lower_bound(&self, key: PrefixTruncatedKey) -> usize {
+        let key_len = self.head.key_len as usize;
+        if key.0.len() <= key_len {
+            // keys starting with a shorter key are greater than it, but not less than it zero padded
+            K::rank(self.keys(), Self::needle(key.0))
+        } else {
+            // keys equal to the start of a longer key are less than it
+            self.count_le(Self::needle(&key.0[..key_len]))
+        }
+    }
+
+    /// number of keys less than or equal to key, which may have any length
+    fn upper_bound(&self, key: PrefixTruncatedKey) -> usize {
+        let key_len = self.head.key_len as usize;
+        if key.0.len() >= key_len {
+            self.count_le(Self::needle(&key.0[..key_len]))
+        } else {
+            K::rank(self.keys(), Self::needle(key.0))
+        }
+    }
+
+    /// space must have been requested
+    fn insert_at(&mut self, index: usize, key: K, payload: &[u8]) {
+        let count = self.head.count as usize;
+        let old = Self::layout(count);
+        let new = Self::layout(count + 1);
+        let slot_size = size_of::<PayloadSlot>();
+        let key_size = size_of::<K>();
+        unsafe {
+            let bytes = self.as_bytes_mut();
+            bytes.copy_within(old.slots_start + index * slot_size..old.data_start, new.slots_start + (index + 1) * slot_size);
+            bytes.copy_within(old.slots_start..old.slots_start + index * slot_size, new.slots_start);
+            bytes.copy_within(KEYS_START + index * key_size..old.slots_start, KEYS_START + (index + 1) * key_size);
+        }
+        self.head.count += 1;
+        let offset = self.write_data(payload);
+        self.keys_mut()[index] = key;
+        self.slots_mut()[index] = PayloadSlot { offset, len: payload.len() as u16 };
+    }
+
+    fn remove_at(&mut self, index: usize) {
+        let count = self.head.count as usize;
+        let old = Self::layout(count);
+        let new = Self::layout(count - 1);
+        let slot_size = size_of::<PayloadSlot>();
+        let key_size = size_of::<K>();
+        self.head.space_used -= self.slots()[index].len;
+        unsafe {
+            let bytes = self.as_bytes_mut();
+            bytes.copy_within(KEYS_START + (index + 1) * key_size..old.slots_start, KEYS_START + index * key_size);
+            bytes.copy_within(old.slots_start..old.slots_start + index * slot_size, new.slots_start);
+            bytes.copy_within(old.slots_start + (index + 1) * slot_size..old.data_start, new.slots_start + index * slot_size);
+        }
+        self.head.count -= 1;
+    }
+
+    /// a node with the entries of range from self and the given fences.
+    /// keys_bytes holds the truncated keys of self back to back.
+    fn copy_range(&self, range: Range<usize>, fences: FenceData, key_bytes: &[u8]) -> Self {
+        let key_len = self.head.key_len as usize;
+        let prefix_growth = fences.prefix_len - self.head.prefix_len as usize;
+        let mut dst = Self::new(key_len - prefix_growth);
+        dst.head.head.adaption_state = self.head.head.adaption_state;
+        dst.set_fences(fences);
+        dst.head.count = range.len() as u16;
+        for (dst_index, i) in range.enumerate() {
+            let offset = dst.write_data(self.payload(i));
+            dst.keys_mut()[dst_index] = Self::needle(&key_bytes[i * key_len + prefix_growth..(i + 1) * key_len]);
+            dst.slots_mut()[dst_index] = PayloadSlot { offset, len: self.slots()[i].len };
+        }
+        dst.validate();
+        dst
+    }
+
+    pub fn validate(&self) {
+        if cfg!(debug_assertions) {
+            self.assert_no_collide();
+            self.fences().validate();
+            assert!(self.head.key_len as usize <= K::BYTE_LEN);
+            assert!(self.keys().windows(2).all(|w| w[0] < w[1]));
+            for s in self.slots() {
+                assert!(s.offset >= self.head.data_offset);
+            }
+            assert_eq!(
+                self.head.space_used as usize,
+                self.head.lower_fence.len as usize
+                    + self.head.upper_fence.len as usize
+                    + self.slots().iter().map(|s| s.len as usize).sum::<usize>()
+            );
+        }
+    }
+
+    /// rewrites node, which must be of this type, as a basic leaf, fails if the entries do not fit
+    pub fn to_basic(node: &mut BTreeNode) -> Result<(), ()> {
+        let src = unsafe { reinterpret_mut::<BTreeNode, Self>(node) };
+        let count = src.head.count as usize;
+        let key_len = src.head.key_len as usize;
+        let (_, _, payload_len) = src.entry_lengths();
+        let fences_len = src.head.lower_fence.len as usize + src.head.upper_fence.len as usize;
+        let space_needed = size_of::<BasicNodeHead>() + fences_len + count * (size_of::<BasicSlot>() + key_len) + payload_len;
+        if space_needed > PAGE_SIZE {
+            return Err(());
+        }
+        let mut basic = BasicNode::new_leaf();
+        basic.head.head.adaption_state = src.head.head.adaption_state;
+        basic.set_fences(src.fences());
+        let mut key = [0u8; 8];
+        for i in 0..count {
+            unsafe { src.write_key(i, key.as_mut_ptr()) };
+            basic.raw_insert(i, PrefixTruncatedKey(&key[..key_len]), src.payload(i));
+        }
+        basic.make_hint();
+        node.basic = basic;
+        Ok(())
+    }
+
+    /// rewrites node, which must be a basic leaf, as an int leaf.
+    /// returns false if the keys are not all of the same length, are too long, or do not fit.
+    pub fn try_from_basic(node: &mut BTreeNode) -> bool {
+        let src = unsafe { &node.basic };
+        let slots = src.slots();
+        let key_len = match slots.first() {
+            Some(s) => s.key_len as usize,
+            None => return false,
+        };
+        if key_len > K::BYTE_LEN || slots.iter().any(|s| s.key_len as usize != key_len) {
+            return false;
+        }
+        let (_, _, payload_len) = src.entry_lengths();
+        let fences = src.fences();
+        let fences_len = fences.lower_fence.0.len() + fences.upper_fence.0.len();
+        if Self::layout(slots.len()).data_start + fences_len + payload_len > PAGE_SIZE {
+            return false;
+        }
+        let mut dst = Self::new(key_len);
+        dst.head.head.adaption_state = src.head.head.adaption_state;
+        dst.set_fences(fences);
+        dst.head.count = slots.len() as u16;
+        for (i, s) in slots.iter().enumerate() {
+            let offset = dst.write_data(s.value(src.as_bytes()));
+            dst.keys_mut()[i] = Self::needle(s.key(src.as_bytes()).0);
+            dst.slots_mut()[i] = PayloadSlot { offset, len: s.val_len };
+        }
+        dst.validate();
+        unsafe { ptr::write(node as *mut BTreeNode as *mut Self, dst) };
+        true
+    }
+}
+
+unsafe impl<K: UnsignedInt> Node for IntLeaf<K> {
+    fn split_node(
+        &mut self,
+        parent: &mut dyn InnerNode,
+        index_in_parent: usize,
+        key_in_node: &[u8],
+    ) -> Result<(), ()> {
+        let count = self.head.count as usize;
+        let key_len = self.head.key_len as usize;
+        let mut key_bytes = vec![0u8; count * key_len];
+        for i in 0..count {
+            unsafe { self.write_key(i, key_bytes.as_mut_ptr().add(i * key_len)) };
+        }
+        let key = |i: usize| PrefixTruncatedKey(&key_bytes[i * key_len..][..key_len]);
+        let append = &key_in_node[self.head.prefix_len as usize..] > key(count - 1).0;
+        let (sep_slot, truncated_sep_key) = find_leaf_separator(count, append, key);
+        let full_sep_key_len = truncated_sep_key.0.len() + self.head.prefix_len as usize;
+        let parent_prefix_len = parent.request_space_for_child(full_sep_key_len)?;
+
+        let mut split_fences = SplitFences::new(self.fences(), truncated_sep_key, parent_prefix_len, self.prefix(key_in_node));
+        let node_left = self.copy_range(0..sep_slot + 1, split_fences.lower(), &key_bytes);
+        let node_right = self.copy_range(sep_slot + 1..count, split_fences.upper(), &key_bytes);
+        unsafe {
+            let node_left_raw = BTreeNode::alloc(BTreeNode::layout(self as *const Self as *const BTreeNode));
+            ptr::write(node_left_raw as *mut Self, node_left);
+            if let Err(()) = parent.insert_child(index_in_parent, split_fences.separator(), node_left_raw) {
+                BTreeNode::dealloc(node_left_raw);
+                return Err(());
+            }
+            BTreeNode::link_leaf_before(node_left_raw, self as *mut Self as *mut BTreeNode);
+        }
+        *self = node_right;
+        Ok(())
+    }
+
+    fn is_underfull(&self) -> bool {
+        self.free_space_after_compaction() >= PAGE_SIZE * 3 / 4
+    }
+
+    fn print(&self) {
+        eprintln!("IntLeaf {:?}: {:?}", self as *const Self, self.fences());
+        for (i, k) in self.keys().iter().enumerate() {
+            eprintln!("{:4}|{:?}|{:3?}", i, k, self.payload(i).len());
+        }
+    }
+
+    fn validate_tree(&self, lower: &[u8], upper: &[u8]) {
+        debug_assert_eq!(self.fences(), FenceData {
+            prefix_len: 0,
+            lower_fence: FenceRef(lower),
+            upper_fence: FenceRef(upper),
+        }.restrip());
+    }
+}
+
+unsafe impl<K: UnsignedInt> LeafNode for IntLeaf<K> {
+    fn insert(&mut self, key: &[u8], payload: &[u8]) -> Result<(), ()> {
+        let truncated = self.truncate(key);
+        if self.head.count == 0 && truncated.0.len() <= K::BYTE_LEN {
+            self.head.key_len = truncated.0.len() as u16;
+        }
+        if truncated.0.len() != self.head.key_len as usize {
+            // if the node is too full to become a basic leaf, it is split and the insert retried
+            let node = unsafe { reinterpret_mut::<Self, BTreeNode>(self) };
+            Self::to_basic(node)?;
+            return node.to_leaf_mut().insert(key, payload);
+        }
+        let needle = Self::needle(truncated.0);
+        let index = K::rank(self.keys(), needle);
+        if index < self.head.count as usize && self.keys()[index] == needle {
+            let old_len = self.slots()[index].len as usize;
+            if payload.len() > self.free_space_after_compaction() + old_len {
+                return Err(());
+            }
+            self.head.space_used -= old_len as u16;
+            self.slots_mut()[index].len = 0;
+            self.request_space(payload.len()).unwrap();
+            let offset = self.write_data(payload);
+            self.slots_mut()[index] = PayloadSlot { offset, len: payload.len() as u16 };
+        } else {
+            self.request_space(size_of::<K>() + size_of::<PayloadSlot>() + payload.len())?;
+            self.insert_at(index, needle, payload);
+        }
+        self.validate();
+        Ok(())
+    }
+
+    fn lookup(&mut self, key: &[u8]) -> Option<&mut [u8]> {
+        let index = self.find_index(self.truncate(key))?;
+        let slot = self.slots()[index];
+        unsafe { Some(&mut self.as_bytes_mut()[slot.offset as usize..][..slot.len as usize]) }
+    }
+
+    fn remove(&mut self, key: &[u8]) -> Option<()> {
+        let index = self.find_index(self.truncate(key))?;
+        self.remove_at(index);
+        self.validate();
+        Some(())
+    }
+
+    unsafe fn range_lookup(&mut self, start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) -> bool {
+        debug_assert!(!key_out.is_null());
+        let prefix_len = self.head.prefix_len as usize;
+        key_out.copy_from_nonoverlapping(start.as_ptr(), prefix_len);
+        let start_index = self.lower_bound(self.truncate(start));
+        for i in start_index..self.head.count as usize {
+            self.write_key(i, key_out.add(prefix_len));
+            if !callback(prefix_len + self.head.key_len as usize, self.payload(i)) {
+                return false;
+            }
+        }
+        true
+    }
+
+    unsafe fn range_lookup_desc(&mut self, start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) -> bool {
+        debug_assert!(!key_out.is_null());
+        let prefix_len = self.head.prefix_len as usize;
+        key_out.copy_from_nonoverlapping(start.as_ptr(), prefix_len);
+        // largest key less than or equal to start
+        let end_index = self.upper_bound(self.truncate(start));
+        for i in (0..end_index).rev() {
+            self.write_key(i, key_out.add(prefix_len));
+            if !callback(prefix_len + self.head.key_len as usize, self.payload(i)) {
+                return false;
+            }
+        }
+        true
+    }
+}
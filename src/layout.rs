@@ -0,0 +1,126 @@
+use crate::btree_node::BTreeNode;
+
+/// node layouts of one tree, chosen when the tree is created.
+/// the cargo features `leaf_*` and `inner_*` select `NodeLayout::DEFAULT`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[repr(C)]
+pub struct NodeLayout {
+    pub leaf: LeafLayout,
+    pub inner: InnerLayout,
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[repr(u8)]
+pub enum LeafLayout {
+    Basic = 0,
+    Hash = 1,
+    /// hash leaves that convert to basic leaves and back depending on the access pattern
+    Adapt = 2,
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[repr(u8)]
+pub enum InnerLayout {
+    Basic = 0,
+    Padded = 1,
+    ExplicitLength = 2,
+    Ascii = 3,
+    Art = 4,
+}
+
+#[allow(unused_imports)]
+pub mod sinks {
+    use crate::basic_node::BasicNode;
+    use crate::head_node::{AsciiHeadNode, U32ExplicitHeadNode, U32ZeroPaddedHeadNode, U64ExplicitHeadNode, U64ZeroPaddedHeadNode};
+    use crate::node_traits::FallbackInnerConversionSink;
+
+    pub type PaddedInnerSink = FallbackInnerConversionSink<FallbackInnerConversionSink<U32ZeroPaddedHeadNode, U64ZeroPaddedHeadNode>, BasicNode>;
+    pub type ExplicitLengthInnerSink = FallbackInnerConversionSink<FallbackInnerConversionSink<U32ExplicitHeadNode, U64ExplicitHeadNode>, BasicNode>;
+    pub type AsciiInnerSink = FallbackInnerConversionSink<AsciiHeadNode, BasicNode>;
+}
+
+/// evaluates `$body` with `$sink` being the `InnerConversionSink` of the given `InnerLayout`
+#[macro_export]
+macro_rules! with_inner_sink {
+    ($layout:expr, $sink:ident => $body:expr) => {
+        match $layout {
+            $crate::layout::InnerLayout::Basic => {
+                type $sink = $crate::basic_node::BasicNode;
+                $body
+            }
+            $crate::layout::InnerLayout::Padded => {
+                type $sink = $crate::layout::sinks::PaddedInnerSink;
+                $body
+            }
+            $crate::layout::InnerLayout::ExplicitLength => {
+                type $sink = $crate::layout::sinks::ExplicitLengthInnerSink;
+                $body
+            }
+            $crate::layout::InnerLayout::Ascii => {
+                type $sink = $crate::layout::sinks::AsciiInnerSink;
+                $body
+            }
+            $crate::layout::InnerLayout::Art => {
+                type $sink = $crate::art_node::ArtNode;
+                $body
+            }
+        }
+    };
+}
+
+impl NodeLayout {
+    pub const DEFAULT: NodeLayout = NodeLayout {
+        leaf: if cfg!(feature = "leaf_adapt") {
+            LeafLayout::Adapt
+        } else if cfg!(feature = "leaf_hash") {
+            LeafLayout::Hash
+        } else if cfg!(feature = "leaf_basic") {
+            LeafLayout::Basic
+        } else {
+            panic!()
+        },
+        inner: if cfg!(feature = "inner_basic") {
+            InnerLayout::Basic
+        } else if cfg!(feature = "inner_padded") {
+            InnerLayout::Padded
+        } else if cfg!(feature = "inner_explicit_length") {
+            InnerLayout::ExplicitLength
+        } else if cfg!(feature = "inner_ascii") {
+            InnerLayout::Ascii
+        } else if cfg!(feature = "inner_art") {
+            InnerLayout::Art
+        } else {
+            panic!()
+        },
+    };
+
+    /// decodes the layout passed through the C ABI, u8::MAX selects the default
+    pub fn from_raw(leaf: u8, inner: u8) -> Self {
+        NodeLayout {
+            leaf: match leaf {
+                0 => LeafLayout::Basic,
+                1 => LeafLayout::Hash,
+                2 => LeafLayout::Adapt,
+                u8::MAX => Self::DEFAULT.leaf,
+                _ => panic!("invalid leaf layout {leaf}"),
+            },
+            inner: match inner {
+                0 => InnerLayout::Basic,
+                1 => InnerLayout::Padded,
+                2 => InnerLayout::ExplicitLength,
+                3 => InnerLayout::Ascii,
+                4 => InnerLayout::Art,
+                u8::MAX => Self::DEFAULT.inner,
+                _ => panic!("invalid inner layout {inner}"),
+            },
+        }
+    }
+}
+
+impl InnerLayout {
+    /// on error, state of dst is unspecified
+    pub fn create(self, dst: &mut BTreeNode, src: &(impl crate::node_traits::InnerConversionSource + ?Sized)) -> Result<(), ()> {
+        use crate::node_traits::InnerConversionSink;
+        with_inner_sink!(self, Sink => Sink::create(dst, src))
+    }
+}
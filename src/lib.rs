@@ -8,13 +8,18 @@
 extern crate core;
 
 use crate::btree_node::{BTreeNode, PAGE_SIZE};
+use crate::layout::NodeLayout;
 use crate::vtables::init_vtables;
 use b_tree::BTree;
+use concurrent::ConcurrentBTree;
+use partitioned::PartitionedBTree;
+use smallvec::SmallVec;
+use std::ffi::{c_char, c_void, CString};
 use std::ops::Deref;
-use std::slice;
-use std::sync::atomic::{AtomicBool, Ordering};
+use std::{ptr, slice};
 use std::sync::Once;
-use crate::node_stats::print_stats;
+use crate::node_stats::{print_node_accounting, print_stats, TreeStats};
+use crate::cursor::{BatchWriter, Cursor, CursorEntry};
 
 
 pub mod b_tree;
@@ -27,6 +32,7 @@ pub mod hash_leaf;
 #[path = "alloc_hash.rs"]
 pub mod hash_leaf;
 pub mod head_node;
+pub mod int_leaf;
 pub mod node_traits;
 pub mod op_count;
 pub mod util;
@@ -36,8 +42,16 @@ pub mod art_node;
 pub mod adaptive;
 pub mod branch_cache;
 pub mod bench;
-
-static MEASUREMENT_COMPLETE: AtomicBool = AtomicBool::new(false);
+pub mod page_state;
+pub mod concurrent;
+mod node_pool;
+pub mod bulk_load;
+pub mod layout;
+pub mod overflow;
+pub mod cursor;
+pub mod wal;
+pub mod frozen_top;
+pub mod partitioned;
 
 pub fn ensure_init() {
     static INIT: Once = Once::new();
@@ -52,6 +66,19 @@ pub extern "C" fn btree_new() -> *mut BTree {
     Box::leak(Box::new(BTree::new()))
 }
 
+/// see `NodeLayout::from_raw`
+#[no_mangle]
+pub extern "C" fn btree_new_with_layout(leaf_layout: u8, inner_layout: u8) -> *mut BTree {
+    ensure_init();
+    Box::leak(Box::new(BTree::with_layout(NodeLayout::from_raw(leaf_layout, inner_layout))))
+}
+
+/// node page size selected by the page-size feature
+#[no_mangle]
+pub extern "C" fn btree_page_size() -> u64 {
+    PAGE_SIZE as u64
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn btree_insert(
     b_tree: *mut BTree,
@@ -67,6 +94,52 @@ pub unsafe extern "C" fn btree_insert(
     )
 }
 
+/// called with context, payload, and payload length.
+/// may modify the payload in place or write a replacement payload and its length to the last two arguments.
+pub type UpsertCallback = unsafe extern "C" fn(*mut c_void, *mut u8, u64, *mut *const u8, *mut u64);
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_upsert(
+    b_tree: *mut BTree,
+    key: *const u8,
+    key_len: u64,
+    payload: *const u8,
+    payload_len: u64,
+    update_callback: UpsertCallback,
+    ctx: *mut c_void,
+) {
+    (*b_tree).upsert(
+        slice::from_raw_parts(key, key_len as usize),
+        slice::from_raw_parts(payload, payload_len as usize),
+        |old| {
+            let mut replacement = ptr::null();
+            let mut replacement_len = 0;
+            update_callback(ctx, old.as_mut_ptr(), old.len() as u64, &mut replacement, &mut replacement_len);
+            if replacement.is_null() {
+                None
+            } else {
+                Some(slice::from_raw_parts(replacement, replacement_len as usize))
+            }
+        },
+    )
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_insert_if_absent(
+    b_tree: *mut BTree,
+    key: *const u8,
+    key_len: u64,
+    payload: *const u8,
+    payload_len: u64,
+    payload_len_out: *mut u64,
+) -> *mut u8 {
+    (*b_tree).insert_if_absent(
+        slice::from_raw_parts(key, key_len as usize),
+        slice::from_raw_parts(payload, payload_len as usize),
+        payload_len_out,
+    )
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn btree_lookup(
     b_tree: *mut BTree,
@@ -79,6 +152,24 @@ pub unsafe extern "C" fn btree_lookup(
     b_tree.lookup(payload_len_out, key)
 }
 
+/// payloads_out is set to null for missing keys
+#[no_mangle]
+pub unsafe extern "C" fn btree_lookup_batch(
+    b_tree: *mut BTree,
+    keys: *const *const u8,
+    key_lens: *const u64,
+    count: u64,
+    payloads_out: *mut *mut u8,
+    payload_lens_out: *mut u64,
+) {
+    let count = count as usize;
+    let keys: SmallVec<[&[u8]; 64]> = slice::from_raw_parts(keys, count).iter()
+        .zip(slice::from_raw_parts(key_lens, count))
+        .map(|(&k, &l)| slice::from_raw_parts(k, l as usize))
+        .collect();
+    (*b_tree).lookup_batch(&keys, slice::from_raw_parts_mut(payloads_out, count), slice::from_raw_parts_mut(payload_lens_out, count))
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn btree_remove(b_tree: *mut BTree, key: *const u8, key_len: u64) -> bool {
     let key = slice::from_raw_parts(key, key_len as usize);
@@ -86,10 +177,14 @@ pub unsafe extern "C" fn btree_remove(b_tree: *mut BTree, key: *const u8, key_le
     b_tree.remove(key)
 }
 
+/// removes keys in [lower, upper), upper may be null
+#[no_mangle]
+pub unsafe extern "C" fn btree_remove_range(b_tree: *mut BTree, lower: *const u8, lower_len: u64, upper: *const u8, upper_len: u64) {
+    (*b_tree).remove_range(slice::from_raw_parts(lower, lower_len as usize), optional_slice(upper, upper_len))
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn btree_destroy(b_tree: *mut BTree) {
-    assert!(MEASUREMENT_COMPLETE.load(Ordering::Relaxed), "B-Tree destructor not implemented");
-    // incomplete, leaks memory
     drop(Box::<BTree>::from_raw(b_tree));
 }
 
@@ -98,6 +193,28 @@ pub unsafe extern "C" fn btree_print_info(b_tree: *mut BTree) {
     if cfg!( debug_assertions ) {
         print_stats(&*b_tree);
     }
+    print_node_accounting();
+}
+
+/// returns a nul terminated string that must be freed using `btree_free_string`
+#[no_mangle]
+pub unsafe extern "C" fn btree_stats_json(b_tree: *mut BTree) -> *mut c_char {
+    stats_string(TreeStats::collect((*b_tree).root))
+}
+
+/// must not run concurrently with modifications
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_stats_json(b_tree: *mut ConcurrentBTree) -> *mut c_char {
+    stats_string((*b_tree).stats())
+}
+
+fn stats_string(stats: TreeStats) -> *mut c_char {
+    CString::new(stats.to_json().to_string()).unwrap().into_raw()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_free_string(s: *mut c_char) {
+    drop(CString::from_raw(s));
 }
 
 #[no_mangle]
@@ -105,6 +222,54 @@ pub unsafe extern "C" fn print_tpcc_result(time: f64, tx_count: u64, warehouses:
     bench::print_tpcc_result(time, tx_count, warehouses)
 }
 
+/// must be called on the thread that records transactions
+#[no_mangle]
+pub extern "C" fn tpcc_recorder_new(sample_interval: u64, hardware_counters: bool) -> *mut bench::TxRecorder {
+    Box::into_raw(Box::new(bench::TxRecorder::new(sample_interval, hardware_counters)))
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn tpcc_recorder_begin(recorder: *mut bench::TxRecorder) {
+    (*recorder).begin()
+}
+
+/// tx_type is the code returned by `TPCCWorkload::tx`
+#[no_mangle]
+pub unsafe extern "C" fn tpcc_recorder_end(recorder: *mut bench::TxRecorder, tx_type: u64) {
+    (*recorder).end(tx_type as usize)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn tpcc_recorder_destroy(recorder: *mut bench::TxRecorder) {
+    drop(Box::from_raw(recorder));
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn print_tpcc_tx_stats(recorders: *const *const bench::TxRecorder, recorder_count: u64, run_time: f64, load_time: f64, warehouses: u64) {
+    let recorders: Vec<&bench::TxRecorder> = slice::from_raw_parts(recorders, recorder_count as usize).iter().map(|&r| &*r).collect();
+    bench::print_tpcc_tx_stats(&recorders, run_time, load_time, warehouses)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn print_ycsb_result(time: f64, op_count: u64, record_count: u64, workload: u8, threads: u64) {
+    bench::print_ycsb_result(time, op_count, record_count, workload, threads)
+}
+
+#[no_mangle]
+pub extern "C" fn zipf_generator_new(n: u64, exponent: f64, seed: u64) -> *mut bench::ZipfGenerator {
+    Box::into_raw(Box::new(bench::ZipfGenerator::new(n, exponent, seed)))
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zipf_generator_sample(generator: *mut bench::ZipfGenerator) -> u64 {
+    (*generator).sample()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zipf_generator_destroy(generator: *mut bench::ZipfGenerator) {
+    drop(Box::from_raw(generator));
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn btree_scan_asc(b_tree: *mut BTree, key: *const u8, key_len: u64, key_buffer: *mut u8, continue_callback: extern "C" fn(*const u8) -> bool) {
     let b_tree = &mut *b_tree;
@@ -122,6 +287,405 @@ pub unsafe extern "C" fn btree_scan_desc(b_tree: *mut BTree, key: *const u8, key
 }
 
 
+/// called with context, key length, payload, and payload length; returns false to end the scan.
+/// the key is written to the key buffer passed to the scan.
+pub type ScanCallback = unsafe extern "C" fn(*mut c_void, u64, *const u8, u64) -> bool;
+
+/// null denotes an absent bound
+unsafe fn optional_slice<'a>(ptr: *const u8, len: u64) -> Option<&'a [u8]> {
+    if ptr.is_null() {
+        None
+    } else {
+        Some(slice::from_raw_parts(ptr, len as usize))
+    }
+}
+
+/// scans keys starting at key up to, but excluding, end_key
+#[no_mangle]
+pub unsafe extern "C" fn btree_scan_asc_ctx(b_tree: *mut BTree, key: *const u8, key_len: u64, end_key: *const u8, end_key_len: u64, key_buffer: *mut u8, continue_callback: ScanCallback, ctx: *mut c_void) {
+    let b_tree = &mut *b_tree;
+    let end_key = optional_slice(end_key, end_key_len);
+    b_tree.range_lookup(slice::from_raw_parts(key, key_len as usize), key_buffer, &mut |found_len, payload| {
+        end_key.map_or(true, |end| slice::from_raw_parts(key_buffer, found_len) < end)
+            && continue_callback(ctx, found_len as u64, payload.as_ptr(), payload.len() as u64)
+    })
+}
+
+/// scans keys starting at key down to, but excluding, end_key
+#[no_mangle]
+pub unsafe extern "C" fn btree_scan_desc_ctx(b_tree: *mut BTree, key: *const u8, key_len: u64, end_key: *const u8, end_key_len: u64, key_buffer: *mut u8, continue_callback: ScanCallback, ctx: *mut c_void) {
+    let b_tree = &mut *b_tree;
+    let end_key = optional_slice(end_key, end_key_len);
+    b_tree.range_lookup_desc(slice::from_raw_parts(key, key_len as usize), key_buffer, &mut |found_len, payload| {
+        end_key.map_or(true, |end| slice::from_raw_parts(key_buffer, found_len) > end)
+            && continue_callback(ctx, found_len as u64, payload.as_ptr(), payload.len() as u64)
+    })
+}
+
+/// counts keys in [lower, upper), upper may be null
+#[no_mangle]
+pub unsafe extern "C" fn btree_count_range(b_tree: *mut BTree, lower: *const u8, lower_len: u64, upper: *const u8, upper_len: u64) -> u64 {
+    (*b_tree).count_range(slice::from_raw_parts(lower, lower_len as usize), optional_slice(upper, upper_len))
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_count_range(b_tree: *const ConcurrentBTree, lower: *const u8, lower_len: u64, upper: *const u8, upper_len: u64) -> u64 {
+    (*b_tree).count_range(slice::from_raw_parts(lower, lower_len as usize), optional_slice(upper, upper_len))
+}
+
+#[no_mangle]
+pub extern "C" fn btree_cursor_open() -> *mut Cursor {
+    Box::into_raw(Box::new(Cursor::new()))
+}
+
+/// positions cursor at the first key greater than or equal to key, end_key is exclusive and may be null
+#[no_mangle]
+pub unsafe extern "C" fn btree_cursor_seek(cursor: *mut Cursor, key: *const u8, key_len: u64, end_key: *const u8, end_key_len: u64) {
+    op_count::count_op();
+    (*cursor).seek(slice::from_raw_parts(key, key_len as usize), optional_slice(end_key, end_key_len));
+}
+
+/// writes up to max_entries entries, whose keys and payloads are copied to buffer.
+/// returns the number of entries, zero at the end of the scan.
+#[no_mangle]
+pub unsafe extern "C" fn btree_cursor_next_batch(b_tree: *mut BTree, cursor: *mut Cursor, entries: *mut CursorEntry, max_entries: u64, buffer: *mut u8, buffer_len: u64) -> u64 {
+    let mut batch = BatchWriter::new(slice::from_raw_parts_mut(entries, max_entries as usize), slice::from_raw_parts_mut(buffer, buffer_len as usize));
+    (*b_tree).cursor_next_batch(&mut *cursor, &mut batch) as u64
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_cursor_next_batch(b_tree: *const ConcurrentBTree, cursor: *mut Cursor, entries: *mut CursorEntry, max_entries: u64, buffer: *mut u8, buffer_len: u64) -> u64 {
+    let mut batch = BatchWriter::new(slice::from_raw_parts_mut(entries, max_entries as usize), slice::from_raw_parts_mut(buffer, buffer_len as usize));
+    (*b_tree).cursor_next_batch(&mut *cursor, &mut batch) as u64
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_cursor_close(cursor: *mut Cursor) {
+    drop(Box::from_raw(cursor));
+}
+
+/// produces the next entry of a bulk load, returns false at the end of the input.
+/// the returned key and payload must remain valid until the next call.
+pub type BulkLoadNext = unsafe extern "C" fn(*mut c_void, *mut *const u8, *mut u64, *mut *const u8, *mut u64) -> bool;
+
+/// adapts a bulk load callback to an iterator.
+/// the yielded slices are only valid until the next call, which is sufficient for `bulk_load`.
+unsafe fn bulk_load_entries<'a>(next: BulkLoadNext, ctx: *mut c_void) -> impl Iterator<Item=(&'a [u8], &'a [u8])> {
+    std::iter::from_fn(move || {
+        let mut key = ptr::null();
+        let mut key_len = 0;
+        let mut payload = ptr::null();
+        let mut payload_len = 0;
+        if next(ctx, &mut key, &mut key_len, &mut payload, &mut payload_len) {
+            Some((slice::from_raw_parts(key, key_len as usize), slice::from_raw_parts(payload, payload_len as usize)))
+        } else {
+            None
+        }
+    })
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_bulk_load(next: BulkLoadNext, ctx: *mut c_void) -> *mut BTree {
+    ensure_init();
+    Box::leak(Box::new(BTree::bulk_load(NodeLayout::DEFAULT, bulk_load_entries(next, ctx))))
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_bulk_load(next: BulkLoadNext, ctx: *mut c_void) -> *mut ConcurrentBTree {
+    ensure_init();
+    Box::leak(Box::new(ConcurrentBTree::bulk_load(NodeLayout::DEFAULT, bulk_load_entries(next, ctx))))
+}
+
+#[no_mangle]
+pub extern "C" fn btree_concurrent_new() -> *mut ConcurrentBTree {
+    ensure_init();
+    Box::leak(Box::new(ConcurrentBTree::new()))
+}
+
+/// see `NodeLayout::from_raw`
+#[no_mangle]
+pub extern "C" fn btree_concurrent_new_with_layout(leaf_layout: u8, inner_layout: u8) -> *mut ConcurrentBTree {
+    ensure_init();
+    Box::leak(Box::new(ConcurrentBTree::with_layout(NodeLayout::from_raw(leaf_layout, inner_layout))))
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_insert(
+    b_tree: *const ConcurrentBTree,
+    key: *const u8,
+    key_len: u64,
+    payload: *const u8,
+    payload_len: u64,
+) {
+    (*b_tree).insert(
+        slice::from_raw_parts(key, key_len as usize),
+        slice::from_raw_parts(payload, payload_len as usize),
+    )
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_lookup(
+    b_tree: *const ConcurrentBTree,
+    key: *const u8,
+    key_len: u64,
+    callback: extern "C" fn(*mut c_void, *const u8, u64),
+    ctx: *mut c_void,
+) -> bool {
+    let key = slice::from_raw_parts(key, key_len as usize);
+    (*b_tree).lookup(key, |payload| callback(ctx, payload.as_ptr(), payload.len() as u64)).is_some()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_update(
+    b_tree: *const ConcurrentBTree,
+    key: *const u8,
+    key_len: u64,
+    callback: extern "C" fn(*mut c_void, *mut u8, u64),
+    ctx: *mut c_void,
+) -> bool {
+    let key = slice::from_raw_parts(key, key_len as usize);
+    (*b_tree).update(key, |payload| callback(ctx, payload.as_mut_ptr(), payload.len() as u64)).is_some()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_remove(b_tree: *const ConcurrentBTree, key: *const u8, key_len: u64) -> bool {
+    let key = slice::from_raw_parts(key, key_len as usize);
+    (*b_tree).remove(key)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_scan_asc(b_tree: *const ConcurrentBTree, key: *const u8, key_len: u64, end_key: *const u8, end_key_len: u64, key_buffer: *mut u8, continue_callback: ScanCallback, ctx: *mut c_void) {
+    let end_key = optional_slice(end_key, end_key_len);
+    (*b_tree).range_lookup(slice::from_raw_parts(key, key_len as usize), key_buffer, &mut |found_len, payload| {
+        end_key.map_or(true, |end| slice::from_raw_parts(key_buffer, found_len) < end)
+            && continue_callback(ctx, found_len as u64, payload.as_ptr(), payload.len() as u64)
+    })
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_scan_desc(b_tree: *const ConcurrentBTree, key: *const u8, key_len: u64, end_key: *const u8, end_key_len: u64, key_buffer: *mut u8, continue_callback: ScanCallback, ctx: *mut c_void) {
+    let end_key = optional_slice(end_key, end_key_len);
+    (*b_tree).range_lookup_desc(slice::from_raw_parts(key, key_len as usize), key_buffer, &mut |found_len, payload| {
+        end_key.map_or(true, |end| slice::from_raw_parts(key_buffer, found_len) > end)
+            && continue_callback(ctx, found_len as u64, payload.as_ptr(), payload.len() as u64)
+    })
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_destroy(b_tree: *mut ConcurrentBTree) {
+    drop(Box::<ConcurrentBTree>::from_raw(b_tree));
+}
+
+/// creates one partition more than there are split points, see `NodeLayout::from_raw` for the layouts.
+/// split points must be strictly ascending.
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_new(leaf_layout: u8, inner_layout: u8, split_points: *const *const u8, split_point_lens: *const u64, split_point_count: u64) -> *mut PartitionedBTree {
+    ensure_init();
+    let split_points = (0..split_point_count as usize).map(|i| {
+        slice::from_raw_parts(*split_points.add(i), *split_point_lens.add(i) as usize).to_vec()
+    }).collect();
+    Box::leak(Box::new(PartitionedBTree::new(NodeLayout::from_raw(leaf_layout, inner_layout), split_points)))
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_insert(b_tree: *const PartitionedBTree, key: *const u8, key_len: u64, payload: *const u8, payload_len: u64) {
+    (*b_tree).insert(
+        slice::from_raw_parts(key, key_len as usize),
+        slice::from_raw_parts(payload, payload_len as usize),
+    )
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_lookup(
+    b_tree: *const PartitionedBTree,
+    key: *const u8,
+    key_len: u64,
+    callback: extern "C" fn(*mut c_void, *const u8, u64),
+    ctx: *mut c_void,
+) -> bool {
+    let key = slice::from_raw_parts(key, key_len as usize);
+    (*b_tree).lookup(key, |payload| callback(ctx, payload.as_ptr(), payload.len() as u64)).is_some()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_update(
+    b_tree: *const PartitionedBTree,
+    key: *const u8,
+    key_len: u64,
+    callback: extern "C" fn(*mut c_void, *mut u8, u64),
+    ctx: *mut c_void,
+) -> bool {
+    let key = slice::from_raw_parts(key, key_len as usize);
+    (*b_tree).update(key, |payload| callback(ctx, payload.as_mut_ptr(), payload.len() as u64)).is_some()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_remove(b_tree: *const PartitionedBTree, key: *const u8, key_len: u64) -> bool {
+    (*b_tree).remove(slice::from_raw_parts(key, key_len as usize))
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_scan_asc(b_tree: *const PartitionedBTree, key: *const u8, key_len: u64, end_key: *const u8, end_key_len: u64, key_buffer: *mut u8, continue_callback: ScanCallback, ctx: *mut c_void) {
+    let end_key = optional_slice(end_key, end_key_len);
+    (*b_tree).range_lookup(slice::from_raw_parts(key, key_len as usize), key_buffer, &mut |found_len, payload| {
+        end_key.map_or(true, |end| slice::from_raw_parts(key_buffer, found_len) < end)
+            && continue_callback(ctx, found_len as u64, payload.as_ptr(), payload.len() as u64)
+    })
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_scan_desc(b_tree: *const PartitionedBTree, key: *const u8, key_len: u64, end_key: *const u8, end_key_len: u64, key_buffer: *mut u8, continue_callback: ScanCallback, ctx: *mut c_void) {
+    let end_key = optional_slice(end_key, end_key_len);
+    (*b_tree).range_lookup_desc(slice::from_raw_parts(key, key_len as usize), key_buffer, &mut |found_len, payload| {
+        end_key.map_or(true, |end| slice::from_raw_parts(key_buffer, found_len) > end)
+            && continue_callback(ctx, found_len as u64, payload.as_ptr(), payload.len() as u64)
+    })
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_count_range(b_tree: *const PartitionedBTree, lower: *const u8, lower_len: u64, upper: *const u8, upper_len: u64) -> u64 {
+    (*b_tree).count_range(slice::from_raw_parts(lower, lower_len as usize), optional_slice(upper, upper_len))
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_cursor_next_batch(b_tree: *const PartitionedBTree, cursor: *mut Cursor, entries: *mut CursorEntry, max_entries: u64, buffer: *mut u8, buffer_len: u64) -> u64 {
+    let mut batch = BatchWriter::new(slice::from_raw_parts_mut(entries, max_entries as usize), slice::from_raw_parts_mut(buffer, buffer_len as usize));
+    (*b_tree).cursor_next_batch(&mut *cursor, &mut batch) as u64
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_partitioned_destroy(b_tree: *mut PartitionedBTree) {
+    drop(Box::<PartitionedBTree>::from_raw(b_tree));
+}
+
+/// nodes allocated after this call live in a private mapping of the page file at path, capacity bounds its size.
+/// must be called before any tree is created, returns true if an existing page file was mapped.
+#[no_mangle]
+pub unsafe extern "C" fn btree_page_file_map(path: *const c_char, capacity: u64) -> bool {
+    ensure_init();
+    let path = std::ffi::CStr::from_ptr(path).to_str().unwrap();
+    BTreeNode::map_page_file(std::path::Path::new(path), capacity as usize)
+}
+
+/// atomically writes all roots recorded by the checkpoint functions and the nodes they reference to the page file.
+/// trees in the page file must not be modified between their checkpoint and the end of this call.
+#[no_mangle]
+pub unsafe extern "C" fn btree_page_file_sync() {
+    node_pool::sync_file(wal::next_lsn());
+}
+
+/// the first redo log record not reflected in the mapped page file
+#[no_mangle]
+pub extern "C" fn btree_page_file_log_lsn() -> u64 {
+    node_pool::file_log_lsn()
+}
+
+/// nodes allocated after this call live in a shared mapping of a scratch file at path, which is truncated to capacity.
+/// the kernel page cache evicts cold nodes to the file, a writeback_interval_ms of 0 disables the background writer.
+/// must be called before any tree is created and excludes `btree_page_file_map`.
+#[no_mangle]
+pub unsafe extern "C" fn btree_page_cache_file_map(path: *const c_char, capacity: u64, writeback_interval_ms: u64) {
+    ensure_init();
+    let path = std::ffi::CStr::from_ptr(path).to_str().unwrap();
+    let interval = if writeback_interval_ms == 0 { None } else { Some(std::time::Duration::from_millis(writeback_interval_ms)) };
+    BTreeNode::map_page_cache_file(std::path::Path::new(path), capacity as usize, interval);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_checkpoint(b_tree: *const BTree, slot: u64) {
+    (*b_tree).checkpoint(slot as usize);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_checkpoint(b_tree: *const ConcurrentBTree, slot: u64) {
+    (*b_tree).checkpoint(slot as usize);
+}
+
+/// returns the tree recorded in slot of the mapped page file, or null if there is none
+#[no_mangle]
+pub extern "C" fn btree_open(slot: u64) -> *mut BTree {
+    ensure_init();
+    BTree::open(slot as usize).map_or(ptr::null_mut(), |t| Box::leak(Box::new(t)))
+}
+
+#[no_mangle]
+pub extern "C" fn btree_concurrent_open(slot: u64) -> *mut ConcurrentBTree {
+    ensure_init();
+    ConcurrentBTree::open(slot as usize).map_or(ptr::null_mut(), |t| Box::leak(Box::new(t)))
+}
+
+/// opens the redo log at path, a group of records is written at least every group_commit_us.
+/// the log is emptied if truncate is set, otherwise records are appended.
+#[no_mangle]
+pub unsafe extern "C" fn btree_wal_open(path: *const c_char, group_commit_us: u64, truncate: bool) {
+    let path = std::ffi::CStr::from_ptr(path).to_str().unwrap();
+    wal::open(std::path::Path::new(path), std::time::Duration::from_micros(group_commit_us), truncate);
+}
+
+/// modifications of the tree are logged under id from now on
+#[no_mangle]
+pub unsafe extern "C" fn btree_wal_attach(b_tree: *mut BTree, id: u32) {
+    (*b_tree).wal_id = Some(id);
+}
+
+/// must be called before the tree is shared between threads
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_wal_attach(b_tree: *mut ConcurrentBTree, id: u32) {
+    (*b_tree).wal_id = Some(id);
+}
+
+/// the lsn of the last record logged by the calling thread, 0 if there is none
+#[no_mangle]
+pub extern "C" fn btree_wal_thread_lsn() -> u64 {
+    wal::thread_lsn()
+}
+
+/// blocks until all records up to lsn are durable
+#[no_mangle]
+pub extern "C" fn btree_wal_wait(lsn: u64) {
+    wal::wait_durable(lsn);
+}
+
+/// applies all records with an lsn not less than from_lsn to trees[id], trees must not be attached to the log yet
+#[no_mangle]
+pub unsafe extern "C" fn btree_wal_replay(path: *const c_char, from_lsn: u64, trees: *const *mut BTree, tree_count: u64) {
+    let path = std::ffi::CStr::from_ptr(path).to_str().unwrap();
+    let trees = slice::from_raw_parts(trees, tree_count as usize);
+    wal::replay(std::path::Path::new(path), from_lsn, |record| (*trees[record.tree as usize]).redo(&record));
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn btree_concurrent_wal_replay(path: *const c_char, from_lsn: u64, trees: *const *mut ConcurrentBTree, tree_count: u64) {
+    let path = std::ffi::CStr::from_ptr(path).to_str().unwrap();
+    let trees = slice::from_raw_parts(trees, tree_count as usize);
+    wal::replay(std::path::Path::new(path), from_lsn, |record| (*trees[record.tree as usize]).redo(&record));
+}
+
+/// places leaves on the NUMA node of the allocating thread and interleaves inner nodes, returns the number of nodes.
+/// must be called before any tree is created.
+#[no_mangle]
+pub extern "C" fn btree_numa_enable() -> u64 {
+    ensure_init();
+    BTreeNode::enable_numa() as u64
+}
+
+/// pins the calling thread to cpu and makes its NUMA node the home node for its allocations, returns that node
+#[no_mangle]
+pub extern "C" fn btree_pin_thread(cpu: u64) -> u64 {
+    assert!(core_affinity::set_for_current(core_affinity::CoreId { id: cpu as usize }), "cannot pin thread to cpu {cpu}");
+    let mut node: libc::c_uint = 0;
+    let r = unsafe { libc::syscall(libc::SYS_getcpu, ptr::null_mut::<libc::c_uint>(), &mut node as *mut libc::c_uint, ptr::null_mut::<libc::c_void>()) };
+    assert_eq!(r, 0, "getcpu failed");
+    node_pool::set_home_node(node as usize);
+    node as u64
+}
+
+/// nodes allocated by the calling thread are placed on node, without pinning it
+#[no_mangle]
+pub extern "C" fn btree_set_home_node(node: u64) {
+    node_pool::set_home_node(node as usize);
+}
+
 #[derive(Ord, PartialOrd, Eq, PartialEq, Copy, Clone, Debug)]
 pub struct PrefixTruncatedKey<'a>(pub &'a [u8]);
 
@@ -0,0 +1,352 @@
+use once_cell::sync::OnceCell;
+use std::cell::Cell;
+use std::ffi::OsString;
+use std::fs::{self, File};
+use std::io::Write;
+use std::os::unix::io::AsRawFd;
+use std::path::{Path, PathBuf};
+use std::{ptr, slice};
+use std::sync::Mutex;
+use std::thread;
+use std::time::Duration;
+
+/// size of the regions requested from the os, a multiple of the huge page size
+const REGION_SIZE: usize = 64 << 20;
+/// transparent huge pages on x86-64
+const HUGE_PAGE_SIZE: usize = 2 << 20;
+
+/// freed slots form an intrusive list
+struct FreeSlot {
+    next: *mut FreeSlot,
+}
+
+struct Pool {
+    free_list: *mut FreeSlot,
+    region_next: *mut u8,
+    region_end: *mut u8,
+    /// if set, all slots are carved from the page file mapping
+    file: Option<PageFile>,
+    /// set if the current region is a file mapping that must not be replaced
+    bounded: bool,
+}
+
+/// the page file is mapped at a fixed address, so node pointers stored in it remain valid when it is mapped again
+const FILE_BASE: usize = 0x6000_0000_0000;
+
+/// the first page of the file holds the header, slots follow
+const FILE_HEADER_SIZE: usize = 4096;
+
+const FILE_MAGIC: u64 = u64::from_ne_bytes(*b"btreepf1");
+
+pub const ROOT_SLOTS: usize = 32;
+
+#[repr(C)]
+struct FileHeader {
+    magic: u64,
+    page_size: u64,
+    slot_size: u64,
+    free_list: *mut FreeSlot,
+    region_next: *mut u8,
+    /// the redo log position the last sync corresponds to
+    log_lsn: u64,
+    roots: [*mut u8; ROOT_SLOTS],
+}
+
+const _: () = assert!(std::mem::size_of::<FileHeader>() <= FILE_HEADER_SIZE);
+
+struct PageFile {
+    path: PathBuf,
+    header: *mut FileHeader,
+}
+
+unsafe impl Send for Pool {}
+
+static POOL: Mutex<Pool> = Mutex::new(Pool {
+    free_list: ptr::null_mut(),
+    region_next: ptr::null_mut(),
+    region_end: ptr::null_mut(),
+    file: None,
+    bounded: false,
+});
+
+const MPOL_PREFERRED: libc::c_ulong = 1;
+const MPOL_INTERLEAVE: libc::c_ulong = 3;
+
+/// NUMA nodes are identified by bits of a single mask
+const MAX_NUMA_NODES: usize = 64;
+
+/// one pool per NUMA node followed by a pool interleaved across all nodes.
+/// regions are aligned to their size and start with a header, so the pool of a slot is found without locking.
+struct Numa {
+    node_count: usize,
+    pools: Vec<Mutex<Pool>>,
+}
+
+/// precedes the slots of a NUMA region, its size keeps the slot alignment
+#[repr(C, align(4096))]
+struct RegionHeader {
+    pool_index: usize,
+}
+
+static NUMA: OnceCell<Numa> = OnceCell::new();
+
+thread_local! {
+    static HOME_NODE: Cell<usize> = Cell::new(0);
+}
+
+impl Numa {
+    /// returns the start and end of the slot space of a new region
+    unsafe fn alloc_region(&self, pool_index: usize) -> (*mut u8, *mut u8) {
+        // over allocate to align the region to its size
+        let p = libc::mmap(ptr::null_mut(), 2 * REGION_SIZE, libc::PROT_READ | libc::PROT_WRITE, libc::MAP_PRIVATE | libc::MAP_ANONYMOUS, -1, 0);
+        assert!(p != libc::MAP_FAILED, "mmap failed");
+        let start = p as usize;
+        let region = (start + REGION_SIZE - 1) / REGION_SIZE * REGION_SIZE;
+        if region > start {
+            libc::munmap(p, region - start);
+        }
+        libc::munmap((region + REGION_SIZE) as *mut libc::c_void, start + REGION_SIZE - region);
+        libc::madvise(region as *mut libc::c_void, REGION_SIZE, libc::MADV_HUGEPAGE);
+        let (mode, mask) = if pool_index == self.node_count {
+            (MPOL_INTERLEAVE, if self.node_count == MAX_NUMA_NODES { !0u64 } else { (1u64 << self.node_count) - 1 })
+        } else {
+            // falls back to other nodes if the home node is full
+            (MPOL_PREFERRED, 1u64 << pool_index)
+        };
+        // binds pages on first touch, nothing has been touched yet
+        let r = libc::syscall(libc::SYS_mbind, region, REGION_SIZE, mode, &mask as *const u64, MAX_NUMA_NODES + 1, 0 as libc::c_uint);
+        assert_eq!(r, 0, "mbind failed");
+        let header = region as *mut RegionHeader;
+        header.write(RegionHeader { pool_index });
+        (header.add(1) as *mut u8, (region + REGION_SIZE) as *mut u8)
+    }
+
+    /// the header is written before any slot of the region is handed out
+    unsafe fn region_pool(&self, slot: *mut u8) -> usize {
+        (*((slot as usize / REGION_SIZE * REGION_SIZE) as *const RegionHeader)).pool_index
+    }
+}
+
+/// number of NUMA nodes of the machine, 1 if it cannot be determined
+pub fn numa_node_count() -> usize {
+    // a range like "0-1" or a single node
+    fs::read_to_string("/sys/devices/system/node/online").ok()
+        .and_then(|s| s.trim().rsplit(|c| c == '-' || c == ',').next().and_then(|n| n.parse::<usize>().ok()))
+        .map_or(1, |max| max + 1)
+}
+
+/// allocates future slots from per node pools, see `alloc`.
+/// must be called before the first `alloc` and excludes file backed pools.
+pub fn enable_numa() -> usize {
+    let node_count = numa_node_count().min(MAX_NUMA_NODES);
+    let pool = POOL.lock().unwrap();
+    assert!(pool.region_next.is_null() && !pool.bounded, "NUMA placement must be enabled before nodes are allocated");
+    let numa = Numa {
+        node_count,
+        pools: (0..node_count + 1).map(|_| Mutex::new(Pool {
+            free_list: ptr::null_mut(),
+            region_next: ptr::null_mut(),
+            region_end: ptr::null_mut(),
+            file: None,
+            bounded: false,
+        })).collect(),
+    };
+    assert!(NUMA.set(numa).is_ok(), "NUMA placement is already enabled");
+    node_count
+}
+
+/// slots allocated by the calling thread are placed on node
+pub fn set_home_node(node: usize) {
+    if let Some(numa) = NUMA.get() {
+        assert!(node < numa.node_count);
+    }
+    HOME_NODE.with(|n| n.set(node));
+}
+
+/// like `allocHuge` in `tpcc/newbm.cpp`, but aligned to the huge page size so the whole mapping can be backed by huge pages.
+/// `size` must be a multiple of the huge page size.
+unsafe fn alloc_huge(size: usize) -> *mut u8 {
+    debug_assert!(size % HUGE_PAGE_SIZE == 0);
+    // over allocate and trim to the aligned range
+    let p = libc::mmap(ptr::null_mut(), size + HUGE_PAGE_SIZE, libc::PROT_READ | libc::PROT_WRITE, libc::MAP_PRIVATE | libc::MAP_ANONYMOUS, -1, 0);
+    assert!(p != libc::MAP_FAILED, "mmap failed");
+    let start = p as usize;
+    let aligned = (start + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if aligned > start {
+        libc::munmap(p, aligned - start);
+    }
+    libc::munmap((aligned + size) as *mut libc::c_void, start + HUGE_PAGE_SIZE - aligned);
+    libc::madvise(aligned as *mut libc::c_void, size, libc::MADV_HUGEPAGE);
+    aligned as *mut u8
+}
+
+/// returns uninitialized memory of `slot_size` bytes, aligned to the largest power of two dividing `slot_size`, up to 4096.
+/// all calls must use the same `slot_size`.
+/// with NUMA placement, shared slots are interleaved across nodes and others are placed on the home node of the calling thread.
+pub unsafe fn alloc(slot_size: usize, shared: bool) -> *mut u8 {
+    debug_assert!(slot_size >= std::mem::size_of::<FreeSlot>());
+    if let Some(numa) = NUMA.get() {
+        let pool_index = if shared { numa.node_count } else { HOME_NODE.with(|n| n.get()) };
+        let mut pool = numa.pools[pool_index].lock().unwrap();
+        return alloc_in(&mut pool, slot_size, || numa.alloc_region(pool_index));
+    }
+    let mut pool = POOL.lock().unwrap();
+    alloc_in(&mut pool, slot_size, || {
+        let region = alloc_huge(REGION_SIZE);
+        (region, region.add(REGION_SIZE))
+    })
+}
+
+/// new_region returns the start and end of the slot space of a fresh region
+unsafe fn alloc_in(pool: &mut Pool, slot_size: usize, new_region: impl FnOnce() -> (*mut u8, *mut u8)) -> *mut u8 {
+    if !pool.free_list.is_null() {
+        let slot = pool.free_list;
+        pool.free_list = (*slot).next;
+        return slot as *mut u8;
+    }
+    if (pool.region_end as usize) - (pool.region_next as usize) < slot_size {
+        assert!(!pool.bounded, "file capacity exhausted");
+        // the remainder of the previous region is abandoned
+        (pool.region_next, pool.region_end) = new_region();
+    }
+    let slot = pool.region_next;
+    pool.region_next = slot.add(slot_size);
+    slot
+}
+
+/// slot must have been returned by `alloc`, memory is never returned to the os
+pub unsafe fn dealloc(slot: *mut u8) {
+    let pool = match NUMA.get() {
+        // slots return to the pool of their region, so they keep their placement
+        Some(numa) => &numa.pools[numa.region_pool(slot)],
+        None => &POOL,
+    };
+    let slot = slot as *mut FreeSlot;
+    let mut pool = pool.lock().unwrap();
+    (*slot).next = pool.free_list;
+    pool.free_list = slot;
+}
+
+/// places all future slots in a private mapping of the file at path, which is created by the next `sync_file` if it does not exist.
+/// capacity bounds the file size and is reserved up front.
+/// must be called before the first `alloc`, returns true if an existing file was mapped.
+pub unsafe fn map_file(path: &Path, capacity: usize, slot_size: usize) -> bool {
+    assert!(NUMA.get().is_none(), "page files do not support NUMA placement");
+    let mut pool = POOL.lock().unwrap();
+    assert!(pool.region_next.is_null() && !pool.bounded, "page file must be mapped before nodes are allocated");
+    let base = FILE_BASE as *mut libc::c_void;
+    let p = libc::mmap(base, capacity, libc::PROT_READ | libc::PROT_WRITE, libc::MAP_PRIVATE | libc::MAP_ANONYMOUS | libc::MAP_NORESERVE | libc::MAP_FIXED_NOREPLACE, -1, 0);
+    assert!(p == base, "could not reserve page file address range");
+    let header = base as *mut FileHeader;
+    let loaded = match File::open(path) {
+        Ok(file) => {
+            let len = file.metadata().unwrap().len() as usize;
+            assert!(len >= FILE_HEADER_SIZE && len <= capacity, "page file size out of range");
+            // pages are read on first access, modifications stay private until the next sync
+            let p = libc::mmap(base, len, libc::PROT_READ | libc::PROT_WRITE, libc::MAP_PRIVATE | libc::MAP_FIXED, file.as_raw_fd(), 0);
+            assert!(p == base, "mmap failed");
+            assert!((*header).magic == FILE_MAGIC, "not a page file");
+            assert!((*header).page_size == crate::PAGE_SIZE as u64 && (*header).slot_size == slot_size as u64, "page file was written by an incompatible build");
+            pool.free_list = (*header).free_list;
+            pool.region_next = (*header).region_next;
+            true
+        }
+        Err(_) => {
+            header.write(FileHeader {
+                magic: FILE_MAGIC,
+                page_size: crate::PAGE_SIZE as u64,
+                slot_size: slot_size as u64,
+                free_list: ptr::null_mut(),
+                region_next: ptr::null_mut(),
+                log_lsn: 0,
+                roots: [ptr::null_mut(); ROOT_SLOTS],
+            });
+            pool.region_next = (base as *mut u8).add(FILE_HEADER_SIZE);
+            false
+        }
+    };
+    pool.region_end = (base as *mut u8).add(capacity);
+    pool.file = Some(PageFile { path: path.to_owned(), header });
+    pool.bounded = true;
+    loaded
+}
+
+fn file_header(pool: &Pool) -> *mut FileHeader {
+    pool.file.as_ref().expect("no page file mapped").header
+}
+
+/// the root recorded in slot, null if there is none
+pub fn file_root(slot: usize) -> *mut u8 {
+    let pool = POOL.lock().unwrap();
+    unsafe { (*file_header(&pool)).roots[slot] }
+}
+
+/// records root in slot, it becomes persistent with the next `sync_file`
+pub fn set_file_root(slot: usize, root: *mut u8) {
+    let pool = POOL.lock().unwrap();
+    unsafe { (*file_header(&pool)).roots[slot] = root }
+}
+
+/// the log_lsn passed to the last `sync_file`
+pub fn file_log_lsn() -> u64 {
+    let pool = POOL.lock().unwrap();
+    unsafe { (*file_header(&pool)).log_lsn }
+}
+
+/// atomically replaces the page file with the current mapping contents.
+/// trees in the file must not be modified concurrently.
+/// log_lsn is the first redo log record not reflected in the file.
+pub unsafe fn sync_file(log_lsn: u64) {
+    let pool = POOL.lock().unwrap();
+    let header = file_header(&pool);
+    (*header).free_list = pool.free_list;
+    (*header).region_next = pool.region_next;
+    (*header).log_lsn = log_lsn;
+    let path = &pool.file.as_ref().unwrap().path;
+    let mut tmp_path = OsString::from(path);
+    tmp_path.push(".tmp");
+    let mut tmp = File::create(&tmp_path).unwrap();
+    let len = pool.region_next as usize - header as usize;
+    tmp.write_all(slice::from_raw_parts(header as *const u8, len)).unwrap();
+    tmp.sync_all().unwrap();
+    fs::rename(&tmp_path, path).unwrap();
+}
+
+/// places all future slots in a shared mapping of a scratch file at path, which is truncated to capacity.
+/// eviction is left to the kernel page cache: it writes cold pages back to the file and drops them, so resident memory follows the working set.
+/// this is not a buffer manager, pages are faulted in on access and there is no residency check or eviction policy of our own.
+/// if writeback_interval is set, a background thread starts writeback of dirty pages at that interval, so eviction rarely waits for writes.
+/// the file contents are not usable after the process exits.
+/// must be called before the first `alloc`.
+pub unsafe fn map_page_cache_file(path: &Path, capacity: usize, writeback_interval: Option<Duration>) {
+    assert!(NUMA.get().is_none(), "page cache files do not support NUMA placement");
+    let mut pool = POOL.lock().unwrap();
+    assert!(pool.region_next.is_null() && !pool.bounded, "page cache file must be mapped before nodes are allocated");
+    let file = fs::OpenOptions::new().read(true).write(true).create(true).truncate(true).open(path).unwrap();
+    file.set_len(capacity as u64).unwrap();
+    let p = libc::mmap(ptr::null_mut(), capacity, libc::PROT_READ | libc::PROT_WRITE, libc::MAP_SHARED | libc::MAP_NORESERVE, file.as_raw_fd(), 0);
+    assert!(p != libc::MAP_FAILED, "mmap failed");
+    // node accesses have no locality beyond a page
+    libc::madvise(p, capacity, libc::MADV_RANDOM);
+    pool.region_next = p as *mut u8;
+    pool.region_end = (p as *mut u8).add(capacity);
+    pool.bounded = true;
+    if let Some(interval) = writeback_interval {
+        thread::spawn(move || loop {
+            thread::sleep(interval);
+            libc::sync_file_range(file.as_raw_fd(), 0, 0, libc::SYNC_FILE_RANGE_WRITE);
+        });
+    }
+}
+
+/// where slots live, reported with benchmark results
+pub fn backing() -> &'static str {
+    let pool = POOL.lock().unwrap();
+    if pool.file.is_some() {
+        "page-file"
+    } else if pool.bounded {
+        "kernel-page-cache"
+    } else {
+        "memory"
+    }
+}
@@ -1,6 +1,9 @@
 use counter::Counter;
-use crate::{BTree, BTreeNode};
+use crate::{BTree, BTreeNode, PAGE_SIZE};
 use crate::vtables::BTreeNodeTag;
+use crate::btree_node::{ALLOCATED_NODES, FREED_NODES};
+use serde_json::json;
+use std::sync::atomic::Ordering;
 
 pub struct InnerNodeData {
     pub depth: usize,
@@ -21,7 +24,7 @@ fn total_node_count(stats: &[InnerNodeData]) -> usize {
 pub fn btree_to_inner_node_stats(b_tree: &BTree) -> Vec<InnerNodeData> {
     let mut ret = Vec::new();
     fn visit(node: &BTreeNode, depth: usize, out: &mut Vec<InnerNodeData>) {
-        let mut buffer = [0u8; 1 << 12];
+        let mut buffer = [0u8; PAGE_SIZE];
         if node.tag().is_leaf() {
             return;
         }
@@ -65,4 +68,95 @@ pub fn print_stats(b_tree: &BTree) {
         eprintln!("\t{:3}: {:5.2}%", l, c as f64 / total_inner_keys as f64 * 100.0)
     };
     eprintln!("node count: {}", total_node_count(&nodes));
-}
\ No newline at end of file
+}
+
+pub fn print_node_accounting() {
+    let allocated = ALLOCATED_NODES.load(Ordering::Relaxed);
+    let freed = FREED_NODES.load(Ordering::Relaxed);
+    eprintln!("nodes allocated: {}, freed: {}, live: {}", allocated, freed, allocated.saturating_sub(freed));
+}
+
+/// totals over all nodes of a tree, gathered without copying keys
+#[derive(Default)]
+pub struct TreeStats {
+    pub height: usize,
+    pub tag_counts: Counter<BTreeNodeTag>,
+    pub leaf_count: usize,
+    pub entry_count: usize,
+    pub key_bytes: usize,
+    pub payload_bytes: usize,
+    pub leaf_free_bytes: usize,
+    pub leaf_prefix_bytes: usize,
+    pub inner_count: usize,
+    pub inner_key_count: usize,
+    pub inner_prefix_bytes: usize,
+}
+
+impl TreeStats {
+    /// tree must not be modified concurrently
+    pub unsafe fn collect(root: *const BTreeNode) -> Self {
+        fn visit(node: &BTreeNode, depth: usize, stats: &mut TreeStats) {
+            stats.height = stats.height.max(depth + 1);
+            *stats.tag_counts.entry(node.tag()).or_insert(0) += 1;
+            let (entries, key_bytes, payload_bytes, free) = unsafe {
+                match node.tag() {
+                    BTreeNodeTag::BasicLeaf => {
+                        let (e, k, p) = node.basic.entry_lengths();
+                        (e, k, p, node.basic.free_space_after_compaction())
+                    }
+                    BTreeNodeTag::HashLeaf => {
+                        let (e, k, p) = node.hash_leaf.entry_lengths();
+                        (e, k, p, node.hash_leaf.free_space_after_compaction())
+                    }
+                    BTreeNodeTag::IntLeaf32 => {
+                        let (e, k, p) = node.int_leaf32.entry_lengths();
+                        (e, k, p, node.int_leaf32.free_space_after_compaction())
+                    }
+                    BTreeNodeTag::IntLeaf64 => {
+                        let (e, k, p) = node.int_leaf64.entry_lengths();
+                        (e, k, p, node.int_leaf64.free_space_after_compaction())
+                    }
+                    _ => {
+                        let inner = node.to_inner();
+                        stats.inner_count += 1;
+                        stats.inner_key_count += inner.key_count();
+                        stats.inner_prefix_bytes += inner.fences().prefix_len;
+                        for i in 0..inner.key_count() + 1 {
+                            visit(&*inner.get_child(i), depth + 1, stats);
+                        }
+                        return;
+                    }
+                }
+            };
+            stats.leaf_count += 1;
+            stats.entry_count += entries;
+            stats.key_bytes += key_bytes;
+            stats.payload_bytes += payload_bytes;
+            stats.leaf_free_bytes += free;
+            stats.leaf_prefix_bytes += node.leaf_fences().prefix_len;
+        }
+        let mut stats = TreeStats::default();
+        visit(&*root, 0, &mut stats);
+        stats
+    }
+
+    pub fn to_json(&self) -> serde_json::Value {
+        let node_count = self.leaf_count + self.inner_count;
+        let tag_counts: serde_json::Map<_, _> = self.tag_counts.iter().map(|(t, c)| (format!("{t:?}"), (*c).into())).collect();
+        json!({
+            "height": self.height,
+            "node_count": node_count,
+            "tag_counts": tag_counts,
+            "leaf_count": self.leaf_count,
+            "inner_count": self.inner_count,
+            "entry_count": self.entry_count,
+            "inner_key_count": self.inner_key_count,
+            "leaf_fill": 1.0 - self.leaf_free_bytes as f64 / (self.leaf_count * PAGE_SIZE) as f64,
+            "average_leaf_prefix_len": self.leaf_prefix_bytes as f64 / self.leaf_count as f64,
+            "average_inner_prefix_len": self.inner_prefix_bytes as f64 / self.inner_count as f64,
+            "average_key_len": self.key_bytes as f64 / self.entry_count as f64,
+            "average_payload_len": self.payload_bytes as f64 / self.entry_count as f64,
+            "bytes_per_entry": (node_count * PAGE_SIZE) as f64 / self.entry_count as f64,
+        })
+    }
+}
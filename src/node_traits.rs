@@ -21,6 +21,9 @@ pub trait InnerNode: InnerConversionSource + Node {
     fn request_space_for_child(&mut self, key_length: usize) -> Result<usize, ()>;
 
     fn find_child_index(&mut self, key: &[u8], branch_cache: &mut BranchCacheAccessor) -> usize;
+
+    /// see `InnerConversionSource::get_child_count`
+    fn set_child_count(&mut self, index: usize, count: u64);
 }
 
 pub trait SeparableInnerConversionSource: InnerConversionSource {
@@ -57,6 +60,8 @@ pub trait InnerConversionSource {
     fn fences(&self) -> FenceData;
     fn key_count(&self) -> usize;
     fn get_child(&self, index: usize) -> *mut BTreeNode;
+    /// number of entries in the subtree of the child at index, only stored if SUBTREE_COUNTS is set
+    fn get_child_count(&self, index: usize) -> u64;
 
     /// key will be written to end of dst
     /// returns length of stripped key
@@ -143,6 +148,20 @@ impl FenceData<'_> {
         }
     }
 
+    /// prefix is the prefix of the node, it is only compared if STRIP_PREFIX is set
+    pub fn contains(&self, prefix: &[u8], key: &[u8]) -> bool {
+        let key = if STRIP_PREFIX {
+            debug_assert_eq!(prefix.len(), self.prefix_len);
+            match key.strip_prefix(prefix) {
+                Some(k) => k,
+                None => return false,
+            }
+        } else {
+            key
+        };
+        self.lower_fence.0 < key && (key <= self.upper_fence.0 || self.upper_fence.0.is_empty() && self.prefix_len == 0)
+    }
+
     pub fn debug_assert_contains(&self, key: &[u8]) {
         if cfg!(debug_assertions) {
             if STRIP_PREFIX {
@@ -197,6 +216,14 @@ pub fn merge<Dst: InnerConversionSink, Left: InnerConversionSource + ?Sized, Rig
             }
         }
 
+        fn get_child_count(&self, index: usize) -> u64 {
+            if index <= self.left_count {
+                self.left.get_child_count(index)
+            } else {
+                self.right.get_child_count(index - (self.left_count + 1))
+            }
+        }
+
         fn get_key(&self, index: usize, dst: &mut [u8], strip_prefix: usize) -> Result<usize, ()> {
             debug_assert!(strip_prefix == 0);
             let dst_len = dst.len();
@@ -319,6 +346,11 @@ pub fn split_at<
             self.src.get_child(self.offset + index)
         }
 
+        fn get_child_count(&self, index: usize) -> u64 {
+            debug_assert!(index < self.len + 1);
+            self.src.get_child_count(self.offset + index)
+        }
+
         fn get_key(&self, index: usize, dst: &mut [u8], strip_prefix: usize) -> Result<usize, ()> {
             debug_assert!(strip_prefix == 0);
             debug_assert!(index < self.len + 1);
@@ -377,6 +409,7 @@ pub fn split_in_place<
     key_in_node: &[u8],
 ) -> Result<(), ()> {
     unsafe {
+        let layout = BTreeNode::layout(node);
         let mut right;
         {
             let src: &Src = reinterpret(node);
@@ -384,7 +417,7 @@ pub fn split_in_place<
             let separator = &*separator;
             let parent_prefix_len =
                 parent.request_space_for_child(separator.len() + src.fences().prefix_len)?;
-            let left = BTreeNode::alloc();
+            let left = BTreeNode::alloc_inner(layout);
             right = BTreeNode::new_uninit();
             split_at::<Src, Left, Right>(
                 src,
@@ -458,6 +491,17 @@ impl<'a, T: InnerConversionSource> InnerConversionSource for InnerInsertSource<'
         }
     }
 
+    /// the inserted child counts as empty until the caller sets its count
+    fn get_child_count(&self, index: usize) -> u64 {
+        if index < self.index {
+            self.src.get_child_count(index)
+        } else if index == self.index {
+            0
+        } else {
+            self.src.get_child_count(index - 1)
+        }
+    }
+
     fn get_key(&self, index: usize, dst: &mut [u8], strip_prefix: usize) -> Result<usize, ()> {
         if index < self.index {
             self.src.get_key(index, dst, strip_prefix)
@@ -0,0 +1,76 @@
+use crate::PAGE_SIZE;
+use std::slice;
+
+/// if set, `BTree` and `ConcurrentBTree` prefix every stored payload with a tag byte.
+/// payloads that do not fit into a leaf beside their key are moved to a separate allocation and the leaf holds a reference.
+pub const OVERFLOW: bool = cfg!(feature = "overflow_true");
+
+const INLINE: u8 = 0;
+const EXTERNAL: u8 = 1;
+
+/// tag, pointer, and length
+const REFERENCE_LEN: usize = 17;
+
+pub type EncodeBuffer = [u8; PAGE_SIZE / 4];
+
+/// returns the representation of payload stored in the leaf, which is valid until buffer is reused.
+/// large payloads are copied to a new allocation that must be released using `free`.
+pub fn encode<'b>(key: &[u8], payload: &[u8], buffer: &'b mut EncodeBuffer) -> &'b [u8] {
+    if key.len() + 1 + payload.len() <= PAGE_SIZE / 4 {
+        buffer[0] = INLINE;
+        buffer[1..][..payload.len()].copy_from_slice(payload);
+        &buffer[..1 + payload.len()]
+    } else {
+        assert!(key.len() + REFERENCE_LEN <= PAGE_SIZE / 4);
+        let external = Box::into_raw(payload.to_vec().into_boxed_slice()) as *mut u8;
+        buffer[0] = EXTERNAL;
+        buffer[1..9].copy_from_slice(&(external as u64).to_ne_bytes());
+        buffer[9..17].copy_from_slice(&(payload.len() as u64).to_ne_bytes());
+        &buffer[..REFERENCE_LEN]
+    }
+}
+
+fn reference(stored: &[u8]) -> (*mut u8, usize) {
+    debug_assert_eq!(stored.len(), REFERENCE_LEN);
+    let ptr = u64::from_ne_bytes(stored[1..9].try_into().unwrap()) as *mut u8;
+    let len = u64::from_ne_bytes(stored[9..17].try_into().unwrap()) as usize;
+    (ptr, len)
+}
+
+/// returns the payload for its stored representation, large payloads are contiguous as well
+pub fn decode(stored: &[u8]) -> &[u8] {
+    if !OVERFLOW {
+        return stored;
+    }
+    match stored[0] {
+        INLINE => &stored[1..],
+        EXTERNAL => {
+            let (ptr, len) = reference(stored);
+            unsafe { slice::from_raw_parts(ptr, len) }
+        }
+        _ => unreachable!(),
+    }
+}
+
+pub fn decode_mut(stored: &mut [u8]) -> &mut [u8] {
+    if !OVERFLOW {
+        return stored;
+    }
+    match stored[0] {
+        INLINE => &mut stored[1..],
+        EXTERNAL => {
+            let (ptr, len) = reference(stored);
+            unsafe { slice::from_raw_parts_mut(ptr, len) }
+        }
+        _ => unreachable!(),
+    }
+}
+
+/// releases the allocation referenced by a stored payload, if any.
+/// must be called exactly once before the stored payload is replaced or removed.
+pub unsafe fn free(stored: &[u8]) {
+    if OVERFLOW && stored[0] == EXTERNAL {
+        let (ptr, len) = reference(stored);
+        drop(Box::from_raw(slice::from_raw_parts_mut(ptr, len) as *mut [u8]));
+    }
+}
@@ -0,0 +1,91 @@
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// version and latch word of a node, port of `PageState` in `tpcc/newbm.cpp`.
+/// the upper 8 bits hold the state, the lower 56 bits hold a version that is incremented on every exclusive unlock.
+pub struct PageState(AtomicU64);
+
+impl PageState {
+    pub const UNLOCKED: u64 = 0;
+    pub const MAX_SHARED: u64 = 252;
+    pub const LOCKED: u64 = 253;
+    pub const MARKED: u64 = 254;
+    pub const EVICTED: u64 = 255;
+
+    pub const fn new() -> Self {
+        PageState(AtomicU64::new(0))
+    }
+
+    #[inline]
+    pub fn load(&self) -> u64 {
+        self.0.load(Ordering::Acquire)
+    }
+
+    #[inline]
+    pub fn state(state_and_version: u64) -> u64 {
+        state_and_version >> 56
+    }
+
+    #[inline]
+    pub fn version(state_and_version: u64) -> u64 {
+        (state_and_version << 8) >> 8
+    }
+
+    #[inline]
+    fn same_version(old_state_and_version: u64, new_state: u64) -> u64 {
+        ((old_state_and_version << 8) >> 8) | new_state << 56
+    }
+
+    #[inline]
+    fn next_version(old_state_and_version: u64, new_state: u64) -> u64 {
+        (((old_state_and_version << 8) >> 8) + 1) | new_state << 56
+    }
+
+    #[inline]
+    fn cas(&self, old: u64, new: u64) -> bool {
+        self.0.compare_exchange(old, new, Ordering::Acquire, Ordering::Relaxed).is_ok()
+    }
+
+    #[inline]
+    pub fn try_lock_x(&self, old_state_and_version: u64) -> bool {
+        match Self::state(old_state_and_version) {
+            Self::UNLOCKED | Self::MARKED => self.cas(old_state_and_version, Self::same_version(old_state_and_version, Self::LOCKED)),
+            _ => false,
+        }
+    }
+
+    /// returns the new state and version
+    #[inline]
+    pub fn unlock_x(&self) -> u64 {
+        let old = self.0.load(Ordering::Relaxed);
+        debug_assert_eq!(Self::state(old), Self::LOCKED);
+        let new = Self::next_version(old, Self::UNLOCKED);
+        self.0.store(new, Ordering::Release);
+        new
+    }
+
+    #[inline]
+    pub fn try_lock_s(&self, old_state_and_version: u64) -> bool {
+        let s = Self::state(old_state_and_version);
+        if s < Self::MAX_SHARED {
+            return self.cas(old_state_and_version, Self::same_version(old_state_and_version, s + 1));
+        }
+        if s == Self::MARKED {
+            return self.cas(old_state_and_version, Self::same_version(old_state_and_version, 1));
+        }
+        false
+    }
+
+    #[inline]
+    pub fn unlock_s(&self) {
+        let _old = self.0.fetch_sub(1 << 56, Ordering::Release);
+        debug_assert!(Self::state(_old) > 0 && Self::state(_old) <= Self::MAX_SHARED);
+    }
+
+    /// upgrades a shared latch to an exclusive one.
+    /// fails if any other thread holds the latch shared.
+    #[inline]
+    pub fn try_upgrade(&self) -> bool {
+        let old = self.0.load(Ordering::Relaxed);
+        Self::state(old) == 1 && self.cas(old, Self::same_version(old, Self::LOCKED))
+    }
+}
@@ -0,0 +1,166 @@
+use crate::b_tree::BTree;
+use crate::layout::NodeLayout;
+use crate::cursor::{BatchWriter, Cursor};
+use crate::page_state::PageState;
+use crate::op_count::count_op;
+use std::cell::UnsafeCell;
+use std::hint::spin_loop;
+use std::ptr;
+
+/// a `BTree` behind an exclusive latch on its own cache line
+#[repr(align(64))]
+struct Partition {
+    latch: PageState,
+    tree: UnsafeCell<BTree>,
+}
+
+/// unlatches the partition when dropped
+struct PartitionGuard<'a>(&'a Partition);
+
+impl Drop for PartitionGuard<'_> {
+    fn drop(&mut self) {
+        self.0.latch.unlock_x();
+    }
+}
+
+impl Partition {
+    fn lock(&self) -> PartitionGuard {
+        loop {
+            let state = self.latch.load();
+            if self.latch.try_lock_x(state) {
+                return PartitionGuard(self);
+            }
+            spin_loop();
+        }
+    }
+}
+
+impl PartitionGuard<'_> {
+    fn tree(&mut self) -> &mut BTree {
+        unsafe { &mut *self.0.tree.get() }
+    }
+}
+
+/// independent trees for consecutive key ranges that may be shared between threads.
+/// partition i holds the keys in [split_points[i - 1], split_points[i]).
+/// each operation latches the partitions it touches exclusively, so threads working on disjoint partitions never contend.
+/// operations spanning partitions visit them in key order and hold at most one latch at a time.
+pub struct PartitionedBTree {
+    split_points: Vec<Vec<u8>>,
+    partitions: Vec<Partition>,
+}
+
+unsafe impl Send for PartitionedBTree {}
+
+unsafe impl Sync for PartitionedBTree {}
+
+impl PartitionedBTree {
+    /// split points must be strictly ascending, there is one more partition than split points
+    pub fn new(layout: NodeLayout, split_points: Vec<Vec<u8>>) -> Self {
+        assert!(split_points.windows(2).all(|w| w[0] < w[1]), "split points must be strictly ascending");
+        let partitions = (0..=split_points.len()).map(|_| Partition {
+            latch: PageState::new(),
+            tree: UnsafeCell::new(BTree::with_layout(layout)),
+        }).collect();
+        PartitionedBTree { split_points, partitions }
+    }
+
+    pub fn partition_count(&self) -> usize {
+        self.partitions.len()
+    }
+
+    /// index of the partition responsible for key
+    pub fn partition_of(&self, key: &[u8]) -> usize {
+        self.split_points.partition_point(|split| &split[..] <= key)
+    }
+
+    fn lock(&self, key: &[u8]) -> PartitionGuard {
+        self.partitions[self.partition_of(key)].lock()
+    }
+
+    pub fn insert(&self, key: &[u8], payload: &[u8]) {
+        self.lock(key).tree().insert(key, payload)
+    }
+
+    pub fn lookup<R>(&self, key: &[u8], f: impl FnOnce(&[u8]) -> R) -> Option<R> {
+        let mut guard = self.lock(key);
+        let mut payload_len = 0;
+        unsafe {
+            let payload = guard.tree().lookup(&mut payload_len, key);
+            if payload.is_null() {
+                None
+            } else {
+                Some(f(std::slice::from_raw_parts(payload, payload_len as usize)))
+            }
+        }
+    }
+
+    pub fn update<R>(&self, key: &[u8], f: impl FnOnce(&mut [u8]) -> R) -> Option<R> {
+        self.lock(key).tree().update(key, f)
+    }
+
+    pub fn remove(&self, key: &[u8]) -> bool {
+        unsafe { self.lock(key).tree().remove(key) }
+    }
+
+    /// callback is invoked while holding the latch of a partition and must not access the tree
+    pub fn range_lookup(&self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
+        count_op();
+        let first = self.partition_of(initial_start);
+        for i in first..self.partitions.len() {
+            let start = if i == first { initial_start } else { &self.split_points[i - 1][..] };
+            let mut stopped = false;
+            self.partitions[i].lock().tree().range_lookup(start, key_out, &mut |key_len, payload| {
+                stopped = !callback(key_len, payload);
+                !stopped
+            });
+            if stopped {
+                return;
+            }
+        }
+    }
+
+    /// callback is invoked while holding the latch of a partition and must not access the tree
+    pub fn range_lookup_desc(&self, initial_start: &[u8], key_out: *mut u8, callback: &mut dyn FnMut(usize, &[u8]) -> bool) {
+        count_op();
+        let first = self.partition_of(initial_start);
+        for i in (0..=first).rev() {
+            // every key of a preceding partition is less than its upper split point
+            let start = if i == first { initial_start } else { &self.split_points[i][..] };
+            let mut stopped = false;
+            self.partitions[i].lock().tree().range_lookup_desc(start, key_out, &mut |key_len, payload| {
+                stopped = !callback(key_len, payload);
+                !stopped
+            });
+            if stopped {
+                return;
+            }
+        }
+    }
+
+    /// number of keys in [lower, upper), an absent upper bound is unbounded.
+    /// only partitions overlapping the range are visited.
+    pub fn count_range(&self, lower: &[u8], upper: Option<&[u8]>) -> u64 {
+        let first = self.partition_of(lower);
+        let last = upper.map_or(self.partitions.len() - 1, |upper| self.partition_of(upper));
+        (first..=last).map(|i| self.partitions[i].lock().tree().count_range(lower, upper)).sum()
+    }
+
+    /// fills batch with the entries following the position of cursor, continuing in the next partition at the end of one.
+    /// the partition is latched while copying, modifications between batches are allowed.
+    pub fn cursor_next_batch(&self, cursor: &mut Cursor, batch: &mut BatchWriter) -> usize {
+        while !cursor.done {
+            let i = self.partition_of(cursor.start());
+            // the leaf hint may have been freed since the last batch
+            cursor.leaf = ptr::null_mut();
+            self.partitions[i].lock().tree().cursor_next_batch(cursor, batch);
+            if !cursor.done || i + 1 == self.partitions.len() {
+                break;
+            }
+            if !cursor.continue_at(&self.split_points[i]) {
+                break;
+            }
+        }
+        batch.count()
+    }
+}
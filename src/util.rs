@@ -21,6 +21,17 @@ pub fn common_prefix_len(a: &[u8], b: &[u8]) -> usize {
     a.iter().zip(b.iter()).take_while(|(a, b)| a == b).count()
 }
 
+/// hints the cpu to load the first two cache lines at `p`
+#[inline(always)]
+pub fn prefetch<T>(p: *const T) {
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        use std::arch::x86_64::{_mm_prefetch, _MM_HINT_T0};
+        _mm_prefetch::<_MM_HINT_T0>(p as *const i8);
+        _mm_prefetch::<_MM_HINT_T0>((p as *const i8).wrapping_add(64));
+    }
+}
+
 pub fn trailing_bytes(b: &[u8], count: usize) -> &[u8] {
     &b[b.len() - count..]
 }
@@ -200,6 +211,13 @@ impl<'a> MergeFences<'a> {
     }
 }
 
+/// entry count, total key length, and total payload length of slots given as (key_len, val_len)
+pub fn entry_lengths(lengths: impl ExactSizeIterator<Item=(u16, u16)>) -> (usize, usize, usize) {
+    let count = lengths.len();
+    let (keys, vals) = lengths.fold((0, 0), |(k, v), (kl, vl)| (k + kl as usize, v + vl as usize));
+    (count, keys, vals)
+}
+
 /// implementation of InnerNode::get_key
 pub fn get_key_from_slice(
     src: PrefixTruncatedKey,
@@ -8,10 +8,11 @@ use crate::BTreeNode;
 use std::ptr::DynMetadata;
 use crate::art_node::ArtNode;
 use crate::hash_leaf::HashLeaf;
+use crate::int_leaf::{IntLeaf32, IntLeaf64};
 use crate::head_node::{AsciiHeadNode, U32ExplicitHeadNode, U32ZeroPaddedHeadNode, U64ExplicitHeadNode, U64ZeroPaddedHeadNode};
 
 static mut INNER_VTABLES: [MaybeUninit<DynMetadata<dyn InnerNode>>; 7] = [MaybeUninit::uninit(); 7];
-static mut LEAF_VTABLES: [MaybeUninit<DynMetadata<dyn LeafNode>>; 2] = [MaybeUninit::uninit(); 2];
+static mut LEAF_VTABLES: [MaybeUninit<DynMetadata<dyn LeafNode>>; 4] = [MaybeUninit::uninit(); 4];
 static mut NODE_VTABLES: [MaybeUninit<DynMetadata<dyn Node>>; 14] = [MaybeUninit::uninit(); 14];
 
 /// must be called before BTreeNode methods are used
@@ -39,6 +40,8 @@ pub fn init_vtables() {
     }
     make_leaf_vtables::<BasicNode>(BTreeNodeTag::BasicLeaf);
     make_leaf_vtables::<HashLeaf>(BTreeNodeTag::HashLeaf);
+    make_leaf_vtables::<IntLeaf32>(BTreeNodeTag::IntLeaf32);
+    make_leaf_vtables::<IntLeaf64>(BTreeNodeTag::IntLeaf64);
 
     make_inner_vtables::<BasicNode>(BTreeNodeTag::BasicInner);
     make_inner_vtables::<U32ExplicitHeadNode>(BTreeNodeTag::U32ExplicitHead);
@@ -56,7 +59,9 @@ pub enum BTreeNodeTag {
     BasicInner = 1,
     HashLeaf = 2,
     U64ExplicitHead = 3,
+    IntLeaf32 = 4,
     U32ExplicitHead = 5,
+    IntLeaf64 = 6,
     U64ZeroPaddedHead = 7,
     U32ZeroPaddedHead = 9,
     AsciiHead = 11,
@@ -0,0 +1,448 @@
+//! redo log of tree modifications.
+//! records are appended to per thread buffers, a flusher thread collects them and writes each group with a single kernel aio request.
+//! the log file is opened with O_DIRECT and O_DSYNC, so completion of a write implies durability.
+
+use once_cell::sync::OnceCell;
+use rustc_hash::FxHasher;
+use std::alloc::{alloc, dealloc, Layout};
+use std::cell::Cell;
+use std::fs::{File, OpenOptions};
+use std::hash::Hasher;
+use std::io::{ErrorKind, Read};
+use std::os::unix::io::AsRawFd;
+use std::os::unix::fs::OpenOptionsExt;
+use std::path::Path;
+use std::sync::{Arc, Condvar, Mutex};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Duration;
+use std::{mem, ptr, slice, thread};
+
+/// offset and length of log writes are multiples of this
+const BLOCK_SIZE: usize = 4096;
+
+#[derive(Clone, Copy, Eq, PartialEq, Debug)]
+#[repr(u32)]
+pub enum LogOp {
+    /// insert or replace key with payload
+    Put = 1,
+    Remove = 2,
+    /// remove [key, payload)
+    RemoveRange = 3,
+    /// remove all keys not less than key
+    RemoveFrom = 4,
+}
+
+impl LogOp {
+    fn from_raw(x: u32) -> Option<Self> {
+        match x {
+            1 => Some(LogOp::Put),
+            2 => Some(LogOp::Remove),
+            3 => Some(LogOp::RemoveRange),
+            4 => Some(LogOp::RemoveFrom),
+            _ => None,
+        }
+    }
+}
+
+/// each write starts at a block boundary with a group header, followed by the records, followed by padding.
+/// a group holds exactly the records with lsn in [start_lsn, end_lsn), so a prefix of complete groups is a prefix of the history.
+#[derive(Clone, Copy)]
+#[repr(C)]
+struct GroupHeader {
+    magic: u64,
+    /// of the records, excluding header and padding
+    len: u64,
+    checksum: u64,
+    start_lsn: u64,
+    end_lsn: u64,
+}
+
+const GROUP_MAGIC: u64 = u64::from_ne_bytes(*b"btreelog");
+
+/// key and payload follow
+#[derive(Clone, Copy)]
+#[repr(C)]
+struct RecordHeader {
+    len: u32,
+    tree: u32,
+    lsn: u64,
+    op: u32,
+    key_len: u32,
+}
+
+const GROUP_HEADER_LEN: usize = mem::size_of::<GroupHeader>();
+const HEADER_LEN: usize = mem::size_of::<RecordHeader>();
+
+pub struct LogRecord<'a> {
+    pub lsn: u64,
+    pub tree: u32,
+    pub op: LogOp,
+    pub key: &'a [u8],
+    pub payload: &'a [u8],
+}
+
+struct Wal {
+    next_lsn: AtomicU64,
+    /// all records with a smaller lsn are durable
+    durable_lsn: Mutex<u64>,
+    durable: Condvar,
+    /// notified by waiting committers so the flusher does not sleep through its interval
+    wake: Condvar,
+    buffers: Mutex<Vec<Arc<Mutex<Vec<u8>>>>>,
+}
+
+static WAL: OnceCell<Wal> = OnceCell::new();
+
+thread_local! {
+    static LOCAL_BUFFER: Arc<Mutex<Vec<u8>>> = {
+        let buffer = Arc::new(Mutex::new(Vec::new()));
+        WAL.get().unwrap().buffers.lock().unwrap().push(buffer.clone());
+        buffer
+    };
+    /// lsn of the last record appended by this thread, 0 if there is none
+    static THREAD_LSN: Cell<u64> = Cell::new(0);
+}
+
+fn checksum(bytes: &[u8]) -> u64 {
+    let mut hasher = FxHasher::default();
+    hasher.write(bytes);
+    hasher.finish()
+}
+
+fn as_bytes<T>(x: &T) -> &[u8] {
+    unsafe { slice::from_raw_parts(x as *const T as *const u8, mem::size_of::<T>()) }
+}
+
+fn read_header<T: Copy>(bytes: &[u8]) -> T {
+    assert!(bytes.len() >= mem::size_of::<T>());
+    unsafe { ptr::read_unaligned(bytes.as_ptr() as *const T) }
+}
+
+fn align_up(x: usize) -> usize {
+    (x + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE
+}
+
+fn encode_record(dst: &mut Vec<u8>, lsn: u64, tree: u32, op: LogOp, key: &[u8], payload: &[u8]) {
+    let header = RecordHeader {
+        len: (HEADER_LEN + key.len() + payload.len()) as u32,
+        tree,
+        lsn,
+        op: op as u32,
+        key_len: key.len() as u32,
+    };
+    dst.extend_from_slice(as_bytes(&header));
+    dst.extend_from_slice(key);
+    dst.extend_from_slice(payload);
+}
+
+fn records(mut bytes: &[u8]) -> impl Iterator<Item=LogRecord<'_>> {
+    std::iter::from_fn(move || {
+        if bytes.is_empty() {
+            return None;
+        }
+        let header: RecordHeader = read_header(bytes);
+        let (record, rest) = bytes.split_at(header.len as usize);
+        bytes = rest;
+        let (key, payload) = record[HEADER_LEN..].split_at(header.key_len as usize);
+        Some(LogRecord { lsn: header.lsn, tree: header.tree, op: LogOp::from_raw(header.op).unwrap(), key, payload })
+    })
+}
+
+/// calls f with the records of each complete group in file order.
+/// returns the offset following the last complete group and its end lsn.
+fn parse_groups<'a>(log: &'a [u8], mut f: impl FnMut(&'a [u8])) -> (usize, u64) {
+    let mut offset = 0;
+    let mut end_lsn = 1;
+    while offset + GROUP_HEADER_LEN <= log.len() {
+        let header: GroupHeader = read_header(&log[offset..]);
+        let records_start = offset + GROUP_HEADER_LEN;
+        if header.magic != GROUP_MAGIC || header.len as usize > log.len() - records_start || (offset > 0 && header.start_lsn != end_lsn) {
+            break;
+        }
+        let records = &log[records_start..][..header.len as usize];
+        if checksum(records) != header.checksum {
+            // torn write of the last group
+            break;
+        }
+        f(records);
+        end_lsn = header.end_lsn;
+        offset = align_up(records_start + records.len());
+    }
+    (offset, end_lsn)
+}
+
+fn read_log(path: &Path) -> Vec<u8> {
+    let mut log = Vec::new();
+    match File::open(path) {
+        Ok(mut file) => {
+            file.read_to_end(&mut log).unwrap();
+        }
+        Err(e) if e.kind() == ErrorKind::NotFound => {}
+        Err(e) => panic!("cannot read log: {e}"),
+    }
+    log
+}
+
+/// calls apply for each durable record with an lsn not less than from_lsn in lsn order
+pub fn replay(path: &Path, from_lsn: u64, mut apply: impl FnMut(LogRecord)) {
+    let log = read_log(path);
+    let mut group_records = Vec::new();
+    parse_groups(&log, |group| {
+        // threads append to separate buffers, so groups are not ordered internally
+        group_records.clear();
+        group_records.extend(records(group).filter(|r| r.lsn >= from_lsn));
+        group_records.sort_unstable_by_key(|r| r.lsn);
+        for record in group_records.drain(..) {
+            apply(record);
+        }
+    });
+}
+
+/// opens the log at path, appending after its last complete group unless truncate is set.
+/// a group is written whenever a committer waits or interval has passed since the last write.
+/// must be called at most once.
+pub fn open(path: &Path, interval: Duration, truncate: bool) {
+    let (end_offset, end_lsn) = if truncate {
+        (0, 1)
+    } else {
+        parse_groups(&read_log(path), |_| {})
+    };
+    let mut options = OpenOptions::new();
+    options.write(true).create(true).truncate(truncate);
+    let file = options.clone().custom_flags(libc::O_DIRECT | libc::O_DSYNC).open(path)
+        // some file systems do not support O_DIRECT, aio writes are synchronous then
+        .or_else(|_| options.custom_flags(libc::O_DSYNC).open(path))
+        .expect("cannot open log");
+    // drop the remains of a torn group
+    file.set_len(end_offset as u64).unwrap();
+    let wal = Wal {
+        next_lsn: AtomicU64::new(end_lsn),
+        durable_lsn: Mutex::new(end_lsn),
+        durable: Condvar::new(),
+        wake: Condvar::new(),
+        buffers: Mutex::new(Vec::new()),
+    };
+    assert!(WAL.set(wal).is_ok(), "log is already open");
+    thread::spawn(move || unsafe { flusher(WAL.get().unwrap(), file, end_offset as u64, end_lsn, interval) });
+}
+
+/// appends a record if the log is open
+pub fn append(tree: u32, op: LogOp, key: &[u8], payload: &[u8]) {
+    let Some(wal) = WAL.get() else { return };
+    LOCAL_BUFFER.with(|buffer| {
+        let mut buffer = buffer.lock().unwrap();
+        // assigned while holding the buffer, see `flusher`
+        let lsn = wal.next_lsn.fetch_add(1, Ordering::AcqRel);
+        encode_record(&mut buffer, lsn, tree, op, key, payload);
+        THREAD_LSN.with(|l| l.set(lsn));
+    });
+}
+
+/// the lsn of the last record appended by the calling thread, 0 if there is none
+pub fn thread_lsn() -> u64 {
+    THREAD_LSN.with(|l| l.get())
+}
+
+/// the lsn the next record will receive, 0 if the log is not open
+pub fn next_lsn() -> u64 {
+    WAL.get().map_or(0, |wal| wal.next_lsn.load(Ordering::Acquire))
+}
+
+/// blocks until the record with lsn and all records before it are durable
+pub fn wait_durable(lsn: u64) {
+    let Some(wal) = WAL.get() else { return };
+    let mut durable = wal.durable_lsn.lock().unwrap();
+    while *durable <= lsn {
+        wal.wake.notify_one();
+        durable = wal.durable.wait(durable).unwrap();
+    }
+}
+
+fn publish(wal: &Wal, lsn: u64) {
+    let mut durable = wal.durable_lsn.lock().unwrap();
+    *durable = lsn;
+    wal.durable.notify_all();
+}
+
+/// moves the records of buffer with an lsn below end_lsn to group.
+/// the records of one thread are in lsn order.
+unsafe fn take_records(buffer: &mut Vec<u8>, end_lsn: u64, group: &mut AlignedBuffer) {
+    let mut split = 0;
+    while split < buffer.len() {
+        let header: RecordHeader = read_header(&buffer[split..]);
+        if header.lsn >= end_lsn {
+            break;
+        }
+        split += header.len as usize;
+    }
+    group.extend(&buffer[..split]);
+    buffer.drain(..split);
+}
+
+unsafe fn flusher(wal: &'static Wal, file: File, mut offset: u64, mut start_lsn: u64, interval: Duration) {
+    let mut aio = AioContext::new();
+    let mut groups = [AlignedBuffer::new(), AlignedBuffer::new()];
+    let mut current = 0;
+    // end lsn of the group being written
+    let mut in_flight = None;
+    loop {
+        // an append that took a smaller lsn holds its buffer until its record is complete,
+        // so the group collected below contains all records in [start_lsn, end_lsn)
+        let end_lsn = wal.next_lsn.load(Ordering::Acquire);
+        let group = &mut groups[current];
+        group.clear();
+        group.extend(&[0u8; GROUP_HEADER_LEN]);
+        if end_lsn > start_lsn {
+            for buffer in wal.buffers.lock().unwrap().iter() {
+                take_records(&mut buffer.lock().unwrap(), end_lsn, group);
+            }
+        }
+        if let Some(lsn) = in_flight.take() {
+            aio.wait();
+            publish(wal, lsn);
+        }
+        if end_lsn == start_lsn {
+            let durable = wal.durable_lsn.lock().unwrap();
+            drop(wal.wake.wait_timeout(durable, interval).unwrap());
+            continue;
+        }
+        let records = &group.as_slice()[GROUP_HEADER_LEN..];
+        let header = GroupHeader {
+            magic: GROUP_MAGIC,
+            len: records.len() as u64,
+            checksum: checksum(records),
+            start_lsn,
+            end_lsn,
+        };
+        group.as_mut_slice()[..GROUP_HEADER_LEN].copy_from_slice(as_bytes(&header));
+        // the remainder of the last block is padding
+        group.pad_to(BLOCK_SIZE);
+        aio.submit_write(file.as_raw_fd(), group.as_slice(), offset);
+        offset += group.len as u64;
+        in_flight = Some(end_lsn);
+        start_lsn = end_lsn;
+        current ^= 1;
+    }
+}
+
+/// growable buffer aligned for O_DIRECT
+struct AlignedBuffer {
+    ptr: *mut u8,
+    capacity: usize,
+    len: usize,
+}
+
+impl AlignedBuffer {
+    fn new() -> Self {
+        AlignedBuffer { ptr: ptr::null_mut(), capacity: 0, len: 0 }
+    }
+
+    fn clear(&mut self) {
+        self.len = 0;
+    }
+
+    unsafe fn reserve(&mut self, additional: usize) {
+        if self.len + additional <= self.capacity {
+            return;
+        }
+        let capacity = (self.len + additional).next_power_of_two().max(BLOCK_SIZE);
+        let ptr = alloc(Layout::from_size_align(capacity, BLOCK_SIZE).unwrap());
+        assert!(!ptr.is_null());
+        if !self.ptr.is_null() {
+            ptr::copy_nonoverlapping(self.ptr, ptr, self.len);
+            dealloc(self.ptr, Layout::from_size_align(self.capacity, BLOCK_SIZE).unwrap());
+        }
+        self.ptr = ptr;
+        self.capacity = capacity;
+    }
+
+    unsafe fn extend(&mut self, data: &[u8]) {
+        self.reserve(data.len());
+        ptr::copy_nonoverlapping(data.as_ptr(), self.ptr.add(self.len), data.len());
+        self.len += data.len();
+    }
+
+    unsafe fn pad_to(&mut self, align: usize) {
+        let padding = (align - self.len % align) % align;
+        self.reserve(padding);
+        ptr::write_bytes(self.ptr.add(self.len), 0, padding);
+        self.len += padding;
+    }
+
+    unsafe fn as_slice(&self) -> &[u8] {
+        slice::from_raw_parts(self.ptr, self.len)
+    }
+
+    unsafe fn as_mut_slice(&mut self) -> &mut [u8] {
+        slice::from_raw_parts_mut(self.ptr, self.len)
+    }
+}
+
+/// `struct iocb` of the kernel aio interface, which libaio wraps
+#[repr(C)]
+#[derive(Default)]
+struct Iocb {
+    aio_data: u64,
+    aio_key: u32,
+    aio_rw_flags: i32,
+    aio_lio_opcode: u16,
+    aio_reqprio: i16,
+    aio_fildes: u32,
+    aio_buf: u64,
+    aio_nbytes: u64,
+    aio_offset: i64,
+    aio_reserved2: u64,
+    aio_flags: u32,
+    aio_resfd: u32,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct IoEvent {
+    data: u64,
+    obj: u64,
+    res: i64,
+    res2: i64,
+}
+
+const IOCB_CMD_PWRITE: u16 = 1;
+
+/// a kernel aio context with at most one request in flight, issued through raw system calls so the crate needs no libaio
+struct AioContext {
+    ctx: libc::c_ulong,
+    iocb: Iocb,
+}
+
+impl AioContext {
+    unsafe fn new() -> Self {
+        let mut ctx: libc::c_ulong = 0;
+        assert_eq!(libc::syscall(libc::SYS_io_setup, 1 as libc::c_long, &mut ctx as *mut libc::c_ulong), 0, "io_setup failed");
+        AioContext { ctx, iocb: Iocb::default() }
+    }
+
+    /// data must remain valid until `wait` returns
+    unsafe fn submit_write(&mut self, fd: i32, data: &[u8], offset: u64) {
+        self.iocb = Iocb {
+            aio_lio_opcode: IOCB_CMD_PWRITE,
+            aio_fildes: fd as u32,
+            aio_buf: data.as_ptr() as u64,
+            aio_nbytes: data.len() as u64,
+            aio_offset: offset as i64,
+            ..Iocb::default()
+        };
+        let mut iocbs = [&mut self.iocb as *mut Iocb];
+        assert_eq!(libc::syscall(libc::SYS_io_submit, self.ctx, 1 as libc::c_long, iocbs.as_mut_ptr()), 1, "io_submit failed");
+    }
+
+    unsafe fn wait(&self) {
+        let mut event = IoEvent::default();
+        loop {
+            let r = libc::syscall(libc::SYS_io_getevents, self.ctx, 1 as libc::c_long, 1 as libc::c_long, &mut event as *mut IoEvent, ptr::null_mut::<libc::timespec>());
+            if r == 1 {
+                break;
+            }
+            assert!(r == -1 && std::io::Error::last_os_error().raw_os_error() == Some(libc::EINTR), "io_getevents failed");
+        }
+        assert_eq!(event.res, self.iocb.aio_nbytes as i64, "log write failed");
+    }
+}
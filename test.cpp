@@ -1,6 +1,8 @@
 #include <csignal>
 #include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <map>
 #include <string>
 #include <cassert>
 #include "PerfEvent.hpp"
@@ -20,7 +22,30 @@ void runTest(BenchmarkParameters parameters, vector<string> &data) {
 
     BTree t;
     uint64_t count = data.size();
-    {
+    if (getenv("SORT") && getenv("BULK")) {
+        // bulk load, payloads are the indices like for inserts
+        struct BulkLoadCtx {
+            vector<string> &data;
+            uint64_t next;
+            // the pointed to payload must stay unchanged until the next call
+            uint64_t payload;
+        } ctx{data, 0, 0};
+        parameters.setParam("op", "bulk_load");
+        PerfEventBlock b(count, parameters);
+        t.bulk_load([](void *ctx_ptr, uint8_t const **key, uint64_t *key_len, uint8_t const **payload,
+                       uint64_t *payload_len) {
+            BulkLoadCtx &ctx = *static_cast<BulkLoadCtx *>(ctx_ptr);
+            if (ctx.next == ctx.data.size())
+                return false;
+            *key = (uint8_t const *) ctx.data[ctx.next].data();
+            *key_len = ctx.data[ctx.next].size();
+            ctx.payload = ctx.next;
+            *payload = reinterpret_cast<uint8_t const *>(&ctx.payload);
+            *payload_len = sizeof(uint64_t);
+            ctx.next++;
+            return true;
+        }, &ctx);
+    } else {
         // insert
         parameters.setParam("op", "insert");
         PerfEventBlock b(count, parameters);
@@ -84,6 +109,122 @@ void runTest(BenchmarkParameters parameters, vector<string> &data) {
     data.clear();
 }
 
+// randomized inserts, upserts and range deletes checked against std::map.
+// run with -DCARGO_FEATURES=subtree-counts_true as well to cover counting through inner nodes.
+void rangeTest(uint64_t n) {
+    BTree t;
+    map<string, uint64_t> expected;
+    uint64_t keySpace = 4 * n;
+    // variable length keys sharing prefixes, ordered like the integers they are derived from
+    auto makeKey = [](uint64_t x) {
+        string s(4, '\0');
+        for (unsigned i = 0; i < 4; i++)
+            s[i] = char(x >> (24 - 8 * i));
+        s.append(x % 7, char('a' + x % 26));
+        return s;
+    };
+    auto payloadOf = [](uint8_t const *payload) {
+        uint64_t v;
+        memcpy(&v, payload, sizeof(uint64_t));
+        return v;
+    };
+    auto countExpected = [&](string const &lower, string const *upper) {
+        uint64_t count = 0;
+        for (auto it = expected.lower_bound(lower); it != expected.end() && (!upper || it->first < *upper); ++it)
+            count++;
+        return count;
+    };
+    auto checkCount = [&](string const &lower, string const *upper) {
+        uint64_t count = t.count_range((uint8_t const *) lower.data(), lower.size(),
+                                       upper ? (uint8_t const *) upper->data() : nullptr, upper ? upper->size() : 0);
+        if (count != countExpected(lower, upper))
+            throw;
+    };
+    auto checkScan = [&]() {
+        RustBTreeCursor *cursor = btree_cursor_open();
+        uint8_t empty = 0;
+        btree_cursor_seek(cursor, &empty, 0, nullptr, 0);
+        BTreeCursorEntry entries[64];
+        vector<uint8_t> buffer(64 * 1024);
+        auto it = expected.begin();
+        while (uint64_t count = t.cursor_next_batch(cursor, entries, 64, buffer.data(), buffer.size())) {
+            for (uint64_t i = 0; i < count; i++, ++it) {
+                if (it == expected.end() || string((char const *) entries[i].key, entries[i].key_len) != it->first)
+                    throw;
+                if (entries[i].payload_len != sizeof(uint64_t) || payloadOf(entries[i].payload) != it->second)
+                    throw;
+            }
+        }
+        if (it != expected.end())
+            throw;
+        btree_cursor_close(cursor);
+    };
+
+    for (unsigned round = 0; round < 8; round++) {
+        for (uint64_t i = 0; i < n; i++) {
+            string key = makeKey(random() % keySpace);
+            uint64_t value = random();
+            switch (i % 3) {
+                case 0: {
+                    uint8_t *existing = t.insert_if_absent((uint8_t *) key.data(), key.size(), (uint8_t *) &value,
+                                                           sizeof(uint64_t));
+                    auto found = expected.find(key);
+                    if ((existing != nullptr) != (found != expected.end()))
+                        throw;
+                    if (!existing)
+                        expected[key] = value;
+                    else if (payloadOf(existing) != found->second)
+                        throw;
+                    break;
+                }
+                case 1:
+                    // increments existing payloads in place
+                    t.upsert((uint8_t *) key.data(), key.size(), (uint8_t *) &value, sizeof(uint64_t),
+                             [](void *, uint8_t *payload, uint64_t, uint8_t const **, uint64_t *) {
+                                 uint64_t v;
+                                 memcpy(&v, payload, sizeof(uint64_t));
+                                 v++;
+                                 memcpy(payload, &v, sizeof(uint64_t));
+                             }, nullptr);
+                    if (expected.count(key))
+                        expected[key]++;
+                    else
+                        expected[key] = value;
+                    break;
+                default:
+                    t.insert((uint8_t *) key.data(), key.size(), (uint8_t *) &value, sizeof(uint64_t));
+                    expected[key] = value;
+            }
+        }
+        checkScan();
+
+        for (unsigned i = 0; i < 32; i++) {
+            // mostly narrow ranges, some covering many leaves, and a few unbounded ones
+            uint64_t lowerInt = random() % keySpace;
+            uint64_t width = i % 4 == 0 ? random() % keySpace : random() % 64;
+            string lower = makeKey(lowerInt);
+            string upper = makeKey(min(lowerInt + width, keySpace));
+            bool bounded = i % 8 != 7;
+            t.remove_range((uint8_t const *) lower.data(), lower.size(),
+                           bounded ? (uint8_t const *) upper.data() : nullptr, bounded ? upper.size() : 0);
+            expected.erase(expected.lower_bound(lower), bounded ? expected.lower_bound(upper) : expected.end());
+
+            checkCount(lower, bounded ? &upper : nullptr);
+            checkCount(string(), nullptr);
+            for (unsigned j = 0; j < 8; j++) {
+                uint64_t a = random() % keySpace;
+                string countLower = makeKey(a);
+                string countUpper = makeKey(min(a + random() % (keySpace / 4 + 1), keySpace));
+                checkCount(countLower, &countUpper);
+            }
+            for (auto &key: {lower, upper})
+                if (bool(t.lookup((uint8_t *) key.data(), key.size())) != bool(expected.count(key)))
+                    throw;
+        }
+        checkScan();
+    }
+}
+
 int main() {
     srand(0x1a2b3c4d);
     vector<string> data;
@@ -131,6 +272,9 @@ int main() {
         runTest(parameters, data);
     }
 
+    if (getenv("RANGE"))
+        rangeTest(atof(getenv("RANGE")));
+
     if (getenv("FILE")) {
         ifstream in(getenv("FILE"));
         string line;
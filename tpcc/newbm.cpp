@@ -1,6 +1,7 @@
 #include <atomic>
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <csignal>
 #include <exception>
 #include <fcntl.h>
@@ -140,7 +141,7 @@ struct PageState {
     void operator=(PageState &) = delete;
 };
 
-static const u64 pageSize = 4096;
+static const u64 pageSize = btree_page_size();
 
 struct OLCRestartException {
 };
@@ -166,61 +167,128 @@ static unsigned btreeslotcounter = 0;
 
 typedef u64 KeyType;
 
+// scan cursors are not bound to a tree, so each thread reuses one for all tables
+struct ThreadCursor {
+    RustBTreeCursor *cursor = btree_cursor_open();
+
+    ~ThreadCursor() { btree_cursor_close(cursor); }
+};
+
+static thread_local ThreadCursor threadCursor;
+
 template<class Record>
 struct vmcacheAdapter {
-    RustBTree *tree;
+    RustConcurrentBTree *tree;
+    // set instead of tree by partitionByWarehouse
+    RustPartitionedBTree *partitioned = nullptr;
+    BTreeLeafLayout leafLayout;
+
+    // per call scan state, passed to the scan callback as context
+    struct ScanCtx {
+        u8 kk[Record::maxFoldLength()];
+        std::function<bool(const typename Record::Key &, const Record &)> const *found_record_cb;
+    };
 
 public:
-    vmcacheAdapter() {
-        tree = btree_new();
+    vmcacheAdapter(BTreeLeafLayout leaf = LEAF_DEFAULT) {
+        // per table leaf layouts, compile time defaults unless TABLE_LAYOUTS is set
+        if (!getenv("TABLE_LAYOUTS") || !atoi(getenv("TABLE_LAYOUTS")))
+            leaf = LEAF_DEFAULT;
+        leafLayout = leaf;
+        tree = btree_concurrent_new_with_layout(leaf, INNER_DEFAULT);
+    }
+
+    // replaces the empty tree by one partition per warehouse, keys must start with the warehouse id
+    void partitionByWarehouse(Integer warehouseCount) {
+        std::vector<u8> splits((warehouseCount - 1) * sizeof(Integer));
+        std::vector<u8 const *> splitPoints;
+        std::vector<u64> splitLens;
+        for (Integer w_id = 2; w_id <= warehouseCount; w_id++) {
+            u8 *split = splits.data() + (w_id - 2) * sizeof(Integer);
+            splitLens.push_back(fold(split, w_id));
+            splitPoints.push_back(split);
+        }
+        btree_concurrent_destroy(tree);
+        tree = nullptr;
+        partitioned = btree_partitioned_new(leafLayout, INNER_DEFAULT, splitPoints.data(), splitLens.data(), splitPoints.size());
+    }
+
+    // replaces the empty tree with the one recorded in slot of the page file
+    void restore(unsigned slot) {
+        RustConcurrentBTree *stored = btree_concurrent_open(slot);
+        if (!stored) {
+            cerr << "page file has no table in slot " << slot << endl;
+            exit(1);
+        }
+        btree_concurrent_destroy(tree);
+        tree = stored;
     }
 
+    void checkpoint(unsigned slot) {
+        btree_concurrent_checkpoint(tree, slot);
+    }
+
+    void logAs(unsigned id) {
+        btree_concurrent_wal_attach(tree, id);
+    }
+
+    // entries fetched per cursor batch, the callback runs without holding latches
+    static constexpr unsigned scanBatch = 16;
+
     void scan(const typename Record::Key &key,
               const std::function<bool(const typename Record::Key &, const Record &)> &found_record_cb,
               std::function<void()> reset_if_scan_failed_cb) {
-        static u8 k[Record::maxFoldLength()];
-        static std::function<bool(const typename Record::Key &, const Record &)> const *found_record_cb_ptr;
+        u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        static u8 kk[Record::maxFoldLength()];
-        found_record_cb_ptr = &found_record_cb;
-
-        btree_scan_asc(tree, k, l, kk, [](uint8_t const *payload) {
-            typename Record::Key typedKey;
-            Record::unfoldKey(kk, typedKey);
-            return (*found_record_cb_ptr)(typedKey, *reinterpret_cast<const Record *>(payload));
-        });
+        RustBTreeCursor *cursor = threadCursor.cursor;
+        btree_cursor_seek(cursor, k, l, nullptr, 0);
+        BTreeCursorEntry entries[scanBatch];
+        u8 buffer[scanBatch * (Record::maxFoldLength() + sizeof(Record))];
+        auto nextBatch = [&]() {
+            if (partitioned)
+                return btree_partitioned_cursor_next_batch(partitioned, cursor, entries, scanBatch, buffer, sizeof(buffer));
+            return btree_concurrent_cursor_next_batch(tree, cursor, entries, scanBatch, buffer, sizeof(buffer));
+        };
+        while (u64 count = nextBatch()) {
+            for (u64 i = 0; i < count; ++i) {
+                typename Record::Key typedKey;
+                Record::unfoldKey(entries[i].key, typedKey);
+                if (!found_record_cb(typedKey, *reinterpret_cast<const Record *>(entries[i].payload)))
+                    return;
+            }
+        }
     }
 
     // -------------------------------------------------------------------------------------
     void scanDesc(const typename Record::Key &key,
                   const std::function<bool(const typename Record::Key &, const Record &)> &found_record_cb,
                   std::function<void()> reset_if_scan_failed_cb) {
-        //TODO
-        /*u8 k[Record::maxFoldLength()];
+        u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        u8 kk[Record::maxFoldLength()];
-        bool first = true;
+        ScanCtx ctx;
+        ctx.found_record_cb = &found_record_cb;
 
-        tree.scanDesc({k, l}, [&](BTreeNode &node, unsigned slot, bool exactMatch) {
-            if (first) { // XXX: hack
-                first = false;
-                if (!exactMatch)
-                    return true;
-            }
-            memcpy(kk, node.getPrefix(), node.prefixLen);
-            memcpy(kk + node.prefixLen, node.getKey(slot), node.slot[slot].keyLen);
+        auto callback = [](void *ctx_ptr, uint64_t, uint8_t const *payload, uint64_t) {
+            ScanCtx &ctx = *static_cast<ScanCtx *>(ctx_ptr);
             typename Record::Key typedKey;
-            Record::unfoldKey(kk, typedKey);
-            return found_record_cb(typedKey, *reinterpret_cast<const Record *>(node.getPayload(slot).data()));
-        });
-         */
+            Record::unfoldKey(ctx.kk, typedKey);
+            return (*ctx.found_record_cb)(typedKey, *reinterpret_cast<const Record *>(payload));
+        };
+        // starts at the largest key less than or equal to key
+        if (partitioned)
+            btree_partitioned_scan_desc(partitioned, k, l, nullptr, 0, ctx.kk, callback, &ctx);
+        else
+            btree_concurrent_scan_desc(tree, k, l, nullptr, 0, ctx.kk, callback, &ctx);
     }
 
     // -------------------------------------------------------------------------------------
     void insert(const typename Record::Key &key, const Record &record) {
         u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        btree_insert(tree, k, l, (u8 *) (&record), sizeof(Record));
+        if (partitioned)
+            btree_partitioned_insert(partitioned, k, l, (u8 *) (&record), sizeof(Record));
+        else
+            btree_concurrent_insert(tree, k, l, (u8 *) (&record), sizeof(Record));
     }
 
     // -------------------------------------------------------------------------------------
@@ -228,10 +296,12 @@ public:
     void lookup1(const typename Record::Key &key, Fn fn) {
         u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        u64 len_out;
-        u8 *value_ptr = btree_lookup(tree, k, l, &len_out);
-        assert(value_ptr);
-        fn(*reinterpret_cast<const Record *>(value_ptr));
+        auto callback = [](void *ctx, uint8_t const *payload, uint64_t) {
+            (*static_cast<Fn *>(ctx))(*reinterpret_cast<const Record *>(payload));
+        };
+        bool found = partitioned ? btree_partitioned_lookup(partitioned, k, l, callback, &fn)
+                                 : btree_concurrent_lookup(tree, k, l, callback, &fn);
+        assert(found);
     }
 
     // -------------------------------------------------------------------------------------
@@ -239,11 +309,13 @@ public:
     void update1(const typename Record::Key &key, Fn fn) {
         u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        u64 len_out;
-        u8 *value_ptr = btree_lookup(tree, k, l, &len_out);
-        if (value_ptr) {
-            fn(*reinterpret_cast<Record *>(value_ptr));
-        }
+        auto callback = [](void *ctx, uint8_t *payload, uint64_t) {
+            (*static_cast<Fn *>(ctx))(*reinterpret_cast<Record *>(payload));
+        };
+        if (partitioned)
+            btree_partitioned_update(partitioned, k, l, callback, &fn);
+        else
+            btree_concurrent_update(tree, k, l, callback, &fn);
     }
 
     // -------------------------------------------------------------------------------------
@@ -251,7 +323,9 @@ public:
     bool erase(const typename Record::Key &key) {
         u8 k[Record::maxFoldLength()];
         u16 l = Record::foldKey(k, key);
-        return btree_remove(tree, k, l);
+        if (partitioned)
+            return btree_partitioned_remove(partitioned, k, l);
+        return btree_concurrent_remove(tree, k, l);
     }
 
     // -------------------------------------------------------------------------------------
@@ -263,31 +337,20 @@ public:
     }
 
     u64 count() {
-        static u8 kk[Record::maxFoldLength()];
-        static u64 cnt;
-        cnt = 0;
-        btree_scan_asc(tree, (u8 const *) &cnt, 0, kk, [](u8 const *payload) {
-            cnt++;
-            return true;
-        });
-        return cnt;
+        u8 k[1];
+        if (partitioned)
+            return btree_partitioned_count_range(partitioned, k, 0, nullptr, 0);
+        return btree_concurrent_count_range(tree, k, 0, nullptr, 0);
     }
 
     u64 countw(Integer w_id) {
-        static u8 k[sizeof(Integer)];
-        static u64 cnt;
-        static u8 kk[Record::maxFoldLength()];
-
+        u8 k[sizeof(Integer)];
+        u8 end[sizeof(Integer)];
         fold(k, w_id);
-        cnt = 0;
-
-        btree_scan_asc(tree, k, sizeof(Integer), kk, []() {
-            if (memcmp(k, kk, sizeof(Integer)) != 0)
-                return false;
-            cnt++;
-            return true;
-        });
-        return cnt;
+        fold(end, w_id + 1);
+        if (partitioned)
+            return btree_partitioned_count_range(partitioned, k, sizeof(Integer), end, sizeof(Integer));
+        return btree_concurrent_count_range(tree, k, sizeof(Integer), end, sizeof(Integer));
     }
 
     u64 countParallel(Integer warehouseCount) {
@@ -303,6 +366,131 @@ public:
     }
 };
 
+// percentages of reads, updates, inserts, scans and read-modify-writes
+struct YcsbWorkload {
+    char name;
+    unsigned read, update, insert, scan, readModifyWrite;
+    // reads prefer recently inserted records instead of a fixed set of hot records
+    bool latest;
+};
+
+static const YcsbWorkload ycsbWorkloads[] = {
+        {'A', 50, 50, 0, 0, 0, false},
+        {'B', 95, 5, 0, 0, 0, false},
+        {'C', 100, 0, 0, 0, 0, false},
+        {'D', 95, 0, 5, 0, 0, true},
+        {'E', 0, 0, 5, 95, 0, false},
+        {'F', 50, 0, 0, 0, 50, false},
+};
+
+static const unsigned ycsbPayloadSize = 100;
+static const unsigned ycsbMaxScanLength = 100;
+
+// bijective, spreads consecutive record ids over the key space
+static void ycsbKey(u8 *key, u64 recordId) {
+    u64 x = recordId;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    x = __builtin_bswap64(x);
+    memcpy(key, &x, sizeof(u64));
+}
+
+int runYcsb(unsigned nthreads, u64 recordCount, u64 runForSec) {
+    const char *workloadName = getenv("YCSB_WORKLOAD") ? getenv("YCSB_WORKLOAD") : "A";
+    auto workload = std::find_if(std::begin(ycsbWorkloads), std::end(ycsbWorkloads),
+                                 [&](const YcsbWorkload &w) { return w.name == workloadName[0]; });
+    if (workload == std::end(ycsbWorkloads)) {
+        cout << "unknown YCSB_WORKLOAD " << workloadName << endl;
+        exit(1);
+    }
+    double zipfExponent = getenv("YCSB_ZIPF") ? atof(getenv("YCSB_ZIPF")) : 0.99;
+
+    u64 statDiff = 1e8;
+    atomic<u64> opProgress(0);
+    atomic<bool> keepRunning(true);
+    // ids below this have been handed out for insertion
+    atomic<u64> nextRecordId(recordCount);
+    RustConcurrentBTree *tree = btree_concurrent_new();
+
+    tbb::parallel_for(tbb::blocked_range<u64>(0, recordCount), [&](const tbb::blocked_range<u64> &range) {
+        u8 key[sizeof(u64)];
+        u8 payload[ycsbPayloadSize];
+        RandomGenerator::getRandString(payload, ycsbPayloadSize);
+        for (u64 id = range.begin(); id < range.end(); id++) {
+            ycsbKey(key, id);
+            btree_concurrent_insert(tree, key, sizeof(u64), payload, ycsbPayloadSize);
+        }
+    });
+
+    std::cerr << "setup complete" << std::endl;
+    vector<thread> threads;
+
+    for (unsigned worker = 0; worker < nthreads; worker++) {
+        threads.emplace_back([&, worker]() {
+            workerThreadId = worker;
+            RustZipfGenerator *zipf = zipf_generator_new(recordCount, zipfExponent, worker);
+            u8 key[sizeof(u64)];
+            u8 keyBuffer[sizeof(u64)];
+            u8 payload[ycsbPayloadSize];
+            RandomGenerator::getRandString(payload, ycsbPayloadSize);
+            u64 cnt = 0;
+            u64 start = rdtsc();
+            while (keepRunning.load()) {
+                unsigned op = RandomGenerator::getRand<unsigned>(0, 100);
+                u64 id = zipf_generator_sample(zipf);
+                if (workload->latest) {
+                    // the most recent ids may not be inserted yet, those lookups miss
+                    id = nextRecordId.load() - 1 - id;
+                }
+                ycsbKey(key, id);
+                if (op < workload->read) {
+                    btree_concurrent_lookup(tree, key, sizeof(u64), [](void *ctx, uint8_t const *p, uint64_t len) {
+                        memcpy(ctx, p, len);
+                    }, payload);
+                } else if ((op -= workload->read) < workload->update) {
+                    btree_concurrent_update(tree, key, sizeof(u64), [](void *ctx, uint8_t *p, uint64_t len) {
+                        memcpy(p, ctx, len);
+                    }, payload);
+                } else if ((op -= workload->update) < workload->insert) {
+                    ycsbKey(key, nextRecordId++);
+                    btree_concurrent_insert(tree, key, sizeof(u64), payload, ycsbPayloadSize);
+                } else if ((op -= workload->insert) < workload->scan) {
+                    u64 remaining = RandomGenerator::getRand<u64>(1, ycsbMaxScanLength + 1);
+                    btree_concurrent_scan_asc(tree, key, sizeof(u64), nullptr, 0, keyBuffer, [](void *ctx, uint64_t, u8 const *, uint64_t) {
+                        return --*static_cast<u64 *>(ctx) > 0;
+                    }, &remaining);
+                } else {
+                    btree_concurrent_update(tree, key, sizeof(u64), [](void *ctx, uint8_t *p, uint64_t len) {
+                        memcpy(ctx, p, len);
+                        p[0]++;
+                    }, payload);
+                }
+                cnt++;
+                u64 stop = rdtsc();
+                if ((stop - start) > statDiff) {
+                    opProgress += cnt;
+                    start = stop;
+                    cnt = 0;
+                }
+            }
+            opProgress += cnt;
+            zipf_generator_destroy(zipf);
+        });
+    }
+
+    sleep(runForSec);
+    keepRunning = false;
+    for (auto &t: threads)
+        t.join();
+
+    print_ycsb_result(runForSec, opProgress, recordCount, workload->name, nthreads);
+    btree_concurrent_destroy(tree);
+    return 0;
+}
+
 int main(int argc, char **argv) {
     exception_hack::init_phdr_cache();
 
@@ -311,11 +499,15 @@ int main(int argc, char **argv) {
         cout << "usage: " << argv[0] << " <threads> <datasize>" << endl;
         exit(1);
     }
-    unsigned nthreads = 1;
+    unsigned nthreads = atoi(argv[1]);
     u64 n = atof(argv[2]);
     tbb::task_scheduler_init init(nthreads);
     u64 runForSec = envOr("RUNFOR", 30);
     bool isYcsb = envOr("YCSB", 0);
+    if (isYcsb) {
+        // datasize is the record count
+        return runYcsb(nthreads, n, runForSec);
+    }
 
     u64 statDiff = 1e8;
     atomic<u64> txProgress(0);
@@ -325,22 +517,84 @@ int main(int argc, char **argv) {
     // TPC-C
     Integer warehouseCount = n;
 
+    // PAGE_FILE keeps all tables in a file, the load phase is skipped if it holds a previous load.
+    // the file must have been created with the same warehouse count.
+    const char *pageFile = getenv("PAGE_FILE");
+    bool restored = pageFile && btree_page_file_map(pageFile, envOr("PAGE_FILE_GB", 64) << 30);
+    // PAGE_CACHE_FILE lets the tables exceed memory, the kernel page cache evicts cold nodes to it
+    if (const char *cacheFile = getenv("PAGE_CACHE_FILE")) {
+        if (pageFile) {
+            cerr << "PAGE_FILE and PAGE_CACHE_FILE are exclusive" << endl;
+            exit(1);
+        }
+        btree_page_cache_file_map(cacheFile, envOr("PAGE_CACHE_FILE_GB", 256) << 30, envOr("WRITEBACK_MS", 100));
+    }
+
+    // NUMA pins workers and runs each on the warehouses of its node, whose leaves are allocated on that node.
+    // inner nodes are interleaved across nodes.
+    bool numa = envOr("NUMA", 0);
+    if (numa && (pageFile || getenv("PAGE_CACHE_FILE"))) {
+        cerr << "NUMA cannot be combined with PAGE_FILE or PAGE_CACHE_FILE" << endl;
+        exit(1);
+    }
+    u64 numaNodes = numa ? btree_numa_enable() : 1;
+    // warehouses are partitioned contiguously, node n owns [partitionStart(n), partitionStart(n + 1))
+    auto partitionStart = [&](u64 node) { return Integer((node * warehouseCount + numaNodes - 1) / numaNodes) + 1; };
+    auto warehouseNode = [&](Integer w_id) { return u64(w_id - 1) * numaNodes / warehouseCount; };
+
+    // point lookup heavy tables use hash leaves, scanned tables use sorted leaves
     vmcacheAdapter<warehouse_t> warehouse;
     vmcacheAdapter<district_t> district;
-    vmcacheAdapter<customer_t> customer;
-    vmcacheAdapter<customer_wdl_t> customerwdl;
+    vmcacheAdapter<customer_t> customer(LEAF_HASH);
+    vmcacheAdapter<customer_wdl_t> customerwdl(LEAF_BASIC);
     vmcacheAdapter<history_t> history;
-    vmcacheAdapter<neworder_t> neworder;
+    vmcacheAdapter<neworder_t> neworder(LEAF_BASIC);
     vmcacheAdapter<order_t> order;
-    vmcacheAdapter<order_wdc_t> order_wdc;
-    vmcacheAdapter<orderline_t> orderline;
-    vmcacheAdapter<item_t> item;
-    vmcacheAdapter<stock_t> stock;
+    vmcacheAdapter<order_wdc_t> order_wdc(LEAF_BASIC);
+    vmcacheAdapter<orderline_t> orderline(LEAF_BASIC);
+    vmcacheAdapter<item_t> item(LEAF_HASH);
+    vmcacheAdapter<stock_t> stock(LEAF_HASH);
 
     TPCCWorkload<vmcacheAdapter> tpcc(warehouse, district, customer, customerwdl, history, neworder, order, order_wdc,
                                       orderline, item, stock, true, warehouseCount, true);
 
-    {
+    auto forEachTable = [&](auto fn) {
+        unsigned slot = 0;
+        fn(warehouse, slot++);
+        fn(district, slot++);
+        fn(customer, slot++);
+        fn(customerwdl, slot++);
+        fn(history, slot++);
+        fn(neworder, slot++);
+        fn(order, slot++);
+        fn(order_wdc, slot++);
+        fn(orderline, slot++);
+        fn(item, slot++);
+        fn(stock, slot++);
+    };
+
+    // PARTITIONED gives each warehouse its own tree in all tables keyed by warehouse, history and item stay shared.
+    // partitions are neither stored in page files nor logged.
+    if (envOr("PARTITIONED", 0)) {
+        if (pageFile || getenv("WAL")) {
+            cerr << "PARTITIONED cannot be combined with PAGE_FILE or WAL" << endl;
+            exit(1);
+        }
+        warehouse.partitionByWarehouse(warehouseCount);
+        district.partitionByWarehouse(warehouseCount);
+        customer.partitionByWarehouse(warehouseCount);
+        customerwdl.partitionByWarehouse(warehouseCount);
+        neworder.partitionByWarehouse(warehouseCount);
+        order.partitionByWarehouse(warehouseCount);
+        order_wdc.partitionByWarehouse(warehouseCount);
+        orderline.partitionByWarehouse(warehouseCount);
+        stock.partitionByWarehouse(warehouseCount);
+    }
+
+    auto loadStart = std::chrono::steady_clock::now();
+    if (restored) {
+        forEachTable([](auto &table, unsigned slot) { table.restore(slot); });
+    } else {
         //PerfEventBlock b(e, warehouseCount*644446ull);
         tpcc.loadItem();
         tpcc.loadWarehouse();
@@ -348,6 +602,8 @@ int main(int argc, char **argv) {
                           [&](const tbb::blocked_range<Integer> &range) {
                               initWorkerId();
                               for (Integer w_id = range.begin(); w_id < range.end(); w_id++) {
+                                  if (numaNodes > 1)
+                                      btree_set_home_node(warehouseNode(w_id));
                                   tpcc.loadStock(w_id);
                                   tpcc.loadDistrinct(w_id);
                                   for (Integer d_id = 1; d_id <= 10; d_id++) {
@@ -356,6 +612,24 @@ int main(int argc, char **argv) {
                                   }
                               }
                           });
+        if (pageFile) {
+            forEachTable([](auto &table, unsigned slot) { table.checkpoint(slot); });
+            btree_page_file_sync();
+        }
+    }
+    double loadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+
+    // WAL logs all modifications after the load phase, transactions wait until their records are durable.
+    // a restored page file is brought up to date with the log first.
+    const char *walPath = getenv("WAL");
+    if (walPath) {
+        if (restored) {
+            vector<RustConcurrentBTree *> trees;
+            forEachTable([&](auto &table, unsigned) { trees.push_back(table.tree); });
+            btree_concurrent_wal_replay(walPath, btree_page_file_log_lsn(), trees.data(), trees.size());
+        }
+        btree_wal_open(walPath, envOr("GROUP_COMMIT_US", 100), !restored);
+        forEachTable([](auto &table, unsigned slot) { table.logAs(slot); });
     }
     /*
     {
@@ -376,15 +650,36 @@ int main(int argc, char **argv) {
 
     std::cerr << "setup complete" << std::endl;
     vector<thread> threads;
+    // TX_STATS reports latency and hardware counters per transaction type
+    bool txStats = envOr("TX_STATS", 1);
+    vector<RustTxRecorder *> recorders(nthreads);
 
     for (unsigned worker = 0; worker < nthreads; worker++) {
         threads.emplace_back([&, worker]() {
             workerThreadId = worker;
+            RustTxRecorder *recorder = nullptr;
+            if (txStats)
+                recorders[worker] = recorder = tpcc_recorder_new(envOr("TX_SAMPLE_INTERVAL", 16), envOr("TX_COUNTERS", 0));
+            Integer firstWarehouse = 1;
+            Integer lastWarehouse = warehouseCount;
+            if (numaNodes > 1) {
+                u64 node = btree_pin_thread(worker % std::thread::hardware_concurrency());
+                if (partitionStart(node + 1) > partitionStart(node)) {
+                    firstWarehouse = partitionStart(node);
+                    lastWarehouse = partitionStart(node + 1) - 1;
+                }
+            }
             u64 cnt = 0;
             u64 start = rdtsc();
             while (keepRunning.load()) {
-                int w_id = tpcc.urand(1, warehouseCount); // wh crossing
-                tpcc.tx(w_id);
+                int w_id = tpcc.urand(firstWarehouse, lastWarehouse); // wh crossing
+                if (recorder)
+                    tpcc_recorder_begin(recorder);
+                int txType = tpcc.tx(w_id);
+                if (walPath)
+                    btree_wal_wait(btree_wal_thread_lsn());
+                if (recorder)
+                    tpcc_recorder_end(recorder, txType);
                 cnt++;
                 u64 stop = rdtsc();
                 if ((stop - start) > statDiff) {
@@ -403,6 +698,11 @@ int main(int argc, char **argv) {
         t.join();
 
     print_tpcc_result(runForSec, txProgress, warehouseCount);
+    if (txStats) {
+        print_tpcc_tx_stats(recorders.data(), recorders.size(), runForSec, loadTime, warehouseCount);
+        for (RustTxRecorder *recorder: recorders)
+            tpcc_recorder_destroy(recorder);
+    }
 
     return 0;
 }